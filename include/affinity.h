@@ -0,0 +1,22 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+// CPU pinning for the reactor and worker threads, plus NUMA topology read
+// from sysfs. Memory locality relies on first touch: a pinned thread that
+// initializes its own buffers gets them on its local node.
+#define AFFINITY_MAX_CPUS 1024
+
+// "0-3,8,10-11" -> cpu numbers; returns the count, or -1 if malformed
+int affinity_parse_cpulist(const char *list, int *out, int max);
+
+int affinity_set_worker_cpus(const char *list);  // Workers take these round-robin
+int affinity_set_reactor_cpu(int cpu);
+
+// Pin the calling thread; return the CPU, or -1 if no pinning is configured
+int affinity_pin_reactor(void);
+int affinity_pin_worker(int index, const char *role);
+
+int affinity_node_of_cpu(int cpu);  // -1 if unknown
+void affinity_report(void);         // Log NUMA nodes and the configured placement
+
+#endif // AFFINITY_H
@@ -1,28 +1,99 @@
 // bank.h (Revised)
+#ifndef BANK_H
+#define BANK_H
 
 #include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h> // for malloc/free
 
 #define MAX_ACCOUNTS 1000
+#define ACCOUNT_STRIPES 16  // Sub-balances in a striped (hot) account
 
-// Account Structure remains the same
+// One sub-balance of a striped account, on its own cache line
 typedef struct {
-    int id;
+    pthread_mutex_t lock;
     double balance;
-    pthread_mutex_t lock; 
-    char padding[64 - (sizeof(int) + sizeof(double) + sizeof(pthread_mutex_t))];
-} Account;
+} __attribute__((aligned(64))) AccountStripe;
+
+// Account Structure (cache-line aligned so neighbouring accounts don't share lines)
+typedef struct {
+    int id;
+    double balance;           // Unused when the account is striped
+    pthread_mutex_t lock;     // Unused when the account is striped
+    uint64_t version;         // Bumped on every balance change (optimistic transfers)
+    AccountStripe *stripes;   // ACCOUNT_STRIPES sub-balances, or NULL for a plain account
+    struct HistoryRing *history;  // Recent balance changes (see history.h)
+} __attribute__((aligned(64))) Account;
 
 // The Bank State
 extern Account *bank[MAX_ACCOUNTS]; // Array of Pointers
 extern pthread_mutex_t bank_state_lock; // Lock for the array/counter
 extern int next_account_id; // Global counter for new unique IDs
 
+// Per-account lock contention counters (only collected while profiling)
+typedef struct {
+    int id;
+    uint64_t acquisitions;  // Total lock acquisitions
+    uint64_t contended;     // Acquisitions that had to wait
+    uint64_t wait_ns;       // Total time spent waiting
+} AccountLockReport;
+
+// One step of a batched transaction (TXN command)
+#define TXN_MAX_OPS 16
+
+typedef enum {
+    TXN_DEPOSIT,
+    TXN_WITHDRAW,
+    TXN_TRANSFER
+} TxnOpType;
+
+typedef struct {
+    TxnOpType type;
+    int account_id;
+    int target_id;    // TXN_TRANSFER only
+    double amount;
+} TxnOp;
+
+// How transfer() synchronizes the two accounts
+typedef enum {
+    TRANSFER_PESSIMISTIC,   // Lock both accounts, then check and apply
+    TRANSFER_OPTIMISTIC     // Read versions unlocked, validate under trylock, retry on conflict
+} TransferMode;
+
 // New Prototypes
 void init_bank();
 int create_account(); // Returns new account ID or -1
+int create_striped_account(); // Same, but balance is split across per-CPU stripes
+int create_account_with_id(int id, int striped); // Caller-chosen ID (shard proxy); -1 if taken
 int deposit(int id, double amount);
 int withdraw(int id, double amount);
 int transfer(int from_id, int to_id, double amount);
-Account* get_account(int id);
\ No newline at end of file
+// The two halves of a transfer run by different threads (partitioned engine);
+// like withdraw()/deposit(), but recorded in history against the other account
+int transfer_debit(int from_id, int to_id, double amount);
+int transfer_credit(int to_id, int from_id, double amount);
+int execute_batch(const TxnOp *ops, int count); // 1 committed, 0 insufficient funds, -1 invalid
+Account* get_account(int id);
+double get_balance(int id);
+double peek_balance(int id); // Unlocked, possibly stale read for informational replies
+
+// Replication follower: rebuild the primary's accounts under the same ids
+int bank_replica_create(int id, int striped);   // 0, or -1 if id is taken
+int bank_replica_set_balance(int id, double balance);            // From a snapshot
+int bank_replica_apply(int id, double delta, int counterparty);  // Logged change, no funds check
+
+// Partitioned engine: skip account locks (call before any worker starts)
+void bank_set_single_writer(int enabled);
+
+// Transfer concurrency control
+void bank_set_transfer_mode(TransferMode mode);
+TransferMode bank_get_transfer_mode(void);
+void bank_get_occ_stats(uint64_t *commits, uint64_t *retries, uint64_t *fallbacks);
+
+// Lock contention profiling
+void bank_set_lock_profiling(int enabled);
+int bank_get_lock_profiling(void);
+void bank_reset_lock_profile(void);
+int bank_top_contended(AccountLockReport *out, int max); // Returns number filled
+
+#endif // BANK_H
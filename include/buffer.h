@@ -0,0 +1,25 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <stdint.h>
+
+// Reference-counted request buffers from a fixed pool. The reactor reads
+// straight into one, and every command framed in it is handed to a worker
+// as a pointer plus a reference instead of a copy.
+#define BUFFER_CAPACITY 2048
+
+typedef struct Buffer {
+    _Atomic int refs;
+    int len;                  // Bytes of data in use
+    uint32_t index;           // Slot in the pool, or BUFFER_UNPOOLED
+    _Atomic uint32_t next;    // Free-list link while in the pool
+    char data[BUFFER_CAPACITY];
+} Buffer;
+
+#define BUFFER_UNPOOLED UINT32_MAX
+
+Buffer *buffer_alloc(void);      // refs = 1, len = 0; NULL only if memory is exhausted
+void buffer_ref(Buffer *buf);
+void buffer_release(Buffer *buf);  // Returns it to the pool on the last release
+
+#endif // BUFFER_H
@@ -0,0 +1,57 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Per-connection state, indexed by fd in a table preallocated at startup
+#define CONN_MAX_COMMAND 256  // Longest command line, including the terminator
+
+typedef struct {
+    int fd;                   // -1 while the slot is free
+    int discarding;           // Skipping the rest of an over-long line
+    uint64_t last_active_s;   // Monotonic seconds of the last read
+    uint64_t requests;
+    uint64_t bytes_in;
+    int wheel_slot;           // Timer wheel slot, -1 when not scheduled
+    int wheel_prev;           // fds of the neighbours in that slot's list
+    int wheel_next;
+    struct Buffer *rx;        // Pooled read buffer (holds any partial command), or NULL
+    _Atomic int in_flight;    // Requests handed to workers and not answered yet
+    int closing;              // Closed by us, fd kept open until in_flight drains
+    int next_closing;         // Next fd on the deferred-close list
+} Connection;
+
+// max_conns bounds the fds the table can hold; idle_timeout_s = 0 never expires
+int conn_table_init(int max_conns, int idle_timeout_s);
+void conn_table_free(void);
+int conn_capacity(void);
+
+Connection *conn_open(int fd);   // NULL if fd doesn't fit in the table
+Connection *conn_get(int fd);    // NULL if fd isn't an open connection (or is closing)
+void conn_touch(Connection *c);  // Record activity (cheap: no wheel update)
+void conn_close(int fd);
+
+// A request went to a worker / its reply has been sent (any thread). A
+// connection with requests in flight is never idle, and its fd isn't closed
+// until they are answered, so the number can't pass to a new client that
+// would then receive the old one's replies.
+void conn_request_start(int fd);
+void conn_request_done(int fd);
+// Requests of fd still owed a reply. Once 0, every earlier reply has been
+// sent, so the reactor may answer the next command itself without
+// overtaking them.
+int conn_requests_in_flight(int fd);
+
+// Returns 1 if fd still has requests in flight: it's then parked until
+// conn_reap() finds them answered. Returns 0 if it can be closed now.
+int conn_defer_close(int fd);
+int conn_closing(int fd);
+// Call on_closed (which must call conn_close) for every parked fd that has drained
+void conn_reap(void (*on_closed)(int fd));
+
+// Advance the timer wheel to now and call on_idle for every connection idle
+// longer than the timeout. on_idle must call conn_close().
+void conn_tick(void (*on_idle)(int fd));
+
+#endif // CONNECTION_H
@@ -0,0 +1,38 @@
+#ifndef CORO_H
+#define CORO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Stackful coroutines, scheduled cooperatively by the thread that created
+// them. A worker runs each request as a coroutine, and a coroutine that has
+// to wait (simulated delay, a duplicate request in flight) yields its thread
+// to the others instead of blocking it.
+#define CORO_MAX_PER_THREAD 4096
+#define CORO_ARG_MAX        64     // Bytes of argument copied into each coroutine
+
+int coro_sched_init(int max_coros);   // Per thread; 0 on success
+void coro_sched_free(void);
+
+// Start fn on a copy of arg (up to CORO_ARG_MAX bytes). It first runs on
+// the next coro_run(). Returns -1 when all slots are taken.
+int coro_spawn(void (*fn)(void *), const void *arg, size_t arg_size);
+
+// Run every coroutine that is ready or whose sleep has ended, each until it
+// yields or returns. Returns the number still alive and sets *next_wake_ns
+// to the earliest sleeper's wake time (0 if none is sleeping).
+int coro_run(uint64_t *next_wake_ns);
+
+int coro_free_slots(void);
+int coro_active(void);        // Is the caller running inside a coroutine?
+
+// One pointer of per-coroutine state, the coroutine's answer to __thread.
+// NULL when a coroutine starts.
+void coro_set_local(void *value);
+void *coro_get_local(void);
+
+// Inside a coroutine: give other coroutines a turn
+void coro_yield(void);
+void coro_sleep_ms(int ms);
+
+#endif // CORO_H
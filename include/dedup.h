@@ -0,0 +1,36 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stddef.h>
+
+#include "protocol.h"
+
+// Fixed-memory cache of recent request ids and their responses, so a
+// retried mutating command is answered without executing it again.
+#define DEDUP_DEFAULT_TTL_MS 60000
+
+typedef enum {
+    DEDUP_NEW,        // First time seen: execute, then call dedup_finish()
+    DEDUP_HIT,        // Already executed: response holds the cached reply
+    DEDUP_BUSY,       // Same id still executing elsewhere: reply IN_PROGRESS
+    DEDUP_MISMATCH,   // Id already taken by a different command: reject it
+    DEDUP_UNTRACKED   // No slot free (all in flight): execute without caching
+} DedupResult;
+
+// Look up cmd->request_id, reserving it if new. The entry also remembers a
+// hash of the command, so reusing an id for another command is caught.
+DedupResult dedup_begin(const ParsedCommand *cmd, char *response, size_t resp_size);
+void dedup_finish(const char *request_id, const char *response);
+// Reply for a request dedup_begin() kept from executing: the cached
+// response on a hit, "IN_PROGRESS <CMD> -1" when busy, FAILURE on a mismatch
+int dedup_reply(DedupResult seen, CommandType type, char *response, size_t resp_size);
+
+// A duplicate of a request that is still executing returns DEDUP_BUSY at
+// once, unless it runs in a coroutine or on a thread that called this.
+// Pool workers may wait; partition workers and the reactor must not.
+void dedup_allow_waiting(void);
+
+void dedup_set_ttl_ms(int ms);
+int dedup_get_ttl_ms(void);
+
+#endif // DEDUP_H
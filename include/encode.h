@@ -0,0 +1,20 @@
+#ifndef ENCODE_H
+#define ENCODE_H
+
+#include <stddef.h>
+
+#include "protocol.h"
+
+// Allocation-free reply encoding for the hot commands. Each function writes
+// a complete reply line and returns its length, so callers can send it
+// without a strlen.
+#define REPLY_MAX 64   // Longest reply these produce, including the NUL
+
+int encode_int(char *out, long long value);
+int encode_money(char *out, double value);   // Two decimals, like "%.2f"
+
+int reply_money(char *out, size_t size, CommandType type, double value);    // "SUCCESS <CMD> 12.34\n"
+int reply_int(char *out, size_t size, CommandType type, long long value);   // "SUCCESS <CMD> 7\n"
+int reply_failure(char *out, size_t size, CommandType type);                // "FAILURE <CMD> -1\n"
+
+#endif // ENCODE_H
@@ -0,0 +1,47 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+
+// Per-account transaction history: the last HISTORY_DEPTH balance changes
+// of each account, kept in a fixed ring carved from a shared arena.
+#define HISTORY_DEPTH 64
+
+typedef struct {
+    _Atomic uint64_t seq;   // 1-based position in the account's history; 0 while being written
+    double delta;           // Signed balance change
+    int32_t counterparty;   // Other account of a transfer, or -1
+    uint32_t time_s;        // Wall clock, seconds since the epoch
+} HistoryEntry;
+
+typedef struct HistoryRing {
+    _Atomic uint64_t head;  // Entries ever recorded
+    HistoryEntry entries[HISTORY_DEPTH];
+} HistoryRing;
+
+// Plain copy of an entry for readers
+typedef struct {
+    uint64_t seq;
+    double delta;
+    int counterparty;
+    uint32_t time_s;
+} HistoryRecord;
+
+HistoryRing *history_ring_alloc(void);
+// Only for an account that was never published; live accounts keep theirs
+void history_ring_free(HistoryRing *ring);
+
+// Safe to call concurrently with other writers and readers of the same ring
+void history_record(HistoryRing *ring, double delta, int counterparty);
+
+// Newest-first copy of up to max entries with seq < before_seq (0 = from the
+// newest). Returns the number filled.
+int history_read(HistoryRing *ring, HistoryRecord *out, int max, uint64_t before_seq);
+
+// Replication follower: empty a ring, then put back entries copied from the
+// primary with their original seq and time. Only for a ring nothing else
+// writes meanwhile; readers may run concurrently.
+void history_clear(HistoryRing *ring);
+void history_restore(HistoryRing *ring, const HistoryRecord *record);
+
+#endif // HISTORY_H
@@ -1,11 +1,24 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
+// Log levels, from least to most verbose
+typedef enum {
+    LOG_LEVEL_ERROR = 0,
+    LOG_LEVEL_INFO  = 1,
+    LOG_LEVEL_DEBUG = 2
+} LogLevel;
+
+// Start the background writer. filename == NULL logs to stdout.
 void logger_init(const char *filename);
-void logger_log(const char *level, const char *format, ...);
-void logger_info(const char *format, ...);
-void logger_error(const char *format, ...);
-void logger_debug(const char *format, ...);
+void logger_set_level(LogLevel level);
+LogLevel logger_get_level(void);
+int logger_parse_level(const char *name);  // Returns a LogLevel, or -1 if unknown
+const char *logger_level_name(LogLevel level);
+
+void logger_log(const char *level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void logger_info(const char *format, ...) __attribute__((format(printf, 1, 2)));
+void logger_error(const char *format, ...) __attribute__((format(printf, 1, 2)));
+void logger_debug(const char *format, ...) __attribute__((format(printf, 1, 2)));
 void logger_cleanup();
 
 #endif // LOGGER_H
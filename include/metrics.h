@@ -0,0 +1,57 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+// Request phases that get a latency histogram per command type
+typedef enum {
+    PHASE_PARSE,    // Parsing the command line
+    PHASE_QUEUE,    // Waiting in the thread pool queue
+    PHASE_EXEC,     // Executing (including simulated delay and account locks)
+    PHASE_SEND,     // Writing the response to the socket
+    PHASE_COUNT
+} MetricPhase;
+
+uint64_t metrics_now_ns(void);
+
+// Hot-path recording: each thread writes only its own counters, and times
+// only a sample of events (counts stay exact)
+void metrics_set_recording(int enabled);   // Off: latency histograms stay empty
+// Start of a phase that only feeds a histogram: 0 (no clock read) when this
+// event isn't sampled or recording is off. Pass it to metrics_phase_end.
+uint64_t metrics_phase_start(MetricPhase phase);
+void metrics_phase_end(CommandType type, MetricPhase phase, uint64_t start);
+// A duration the caller measured anyway
+void metrics_record(CommandType type, MetricPhase phase, uint64_t ns);
+void metrics_record_lock_wait(uint64_t ns);
+void metrics_record_timeout(void);   // Request dropped after its deadline passed
+void metrics_record_shed(void);      // Request refused because the queue was too long
+void metrics_connection_opened(void);
+void metrics_connection_closed(void);
+
+// Gauge callback for the task queue depth (registered by the thread pool)
+void metrics_set_queue_depth_source(int (*fn)(void));
+
+// Replication gauges (registered by the replication module)
+typedef struct {
+    const char *role;       // "primary" or "follower"
+    uint64_t lsn;           // Primary: last logged change; follower: last applied
+    uint64_t lag_records;   // Follower: announced by the primary, not applied yet
+    double lag_seconds;     // Follower: commit-to-apply delay of the last change
+    int followers;          // Connected followers
+} MetricsReplication;
+
+void metrics_set_replication_source(void (*fn)(MetricsReplication *out));
+
+// Snapshots for the STATS command and the Prometheus endpoint
+size_t metrics_format_stats(char *buf, size_t size);
+size_t metrics_format_prometheus(char *buf, size_t size);
+
+// Serve Prometheus text format on 127.0.0.1:port from a background thread
+int metrics_start_http(int port);
+void metrics_stop_http(void);
+
+#endif // METRICS_H
@@ -0,0 +1,15 @@
+#ifndef PARTITION_H
+#define PARTITION_H
+
+// Shared-nothing execution engine: account id -> owning worker thread.
+// Each worker executes its accounts' commands without account locks;
+// cross-partition transfers are completed by message passing.
+#define PARTITION_MAX 64
+
+int partition_init(int num_partitions);
+int partition_submit(int client_fd, const char *command, int trace);  // trace: span or 0
+void partition_shutdown(void);
+int partition_enabled(void);
+int partition_queue_depth(void);
+
+#endif // PARTITION_H
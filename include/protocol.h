@@ -1,9 +1,101 @@
 #ifndef PROTOCOL_H
 #define PROTOCOL_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "bank.h"
 
-void execute_command(int client_fd, const char *input, char *response, size_t resp_size);
+// Protocol command types
+typedef enum {
+    CMD_CREATE,
+    CMD_DEPOSIT,
+    CMD_WITHDRAW,
+    CMD_TRANSFER,
+    CMD_BALANCE,
+    CMD_SHUTDOWN,
+    CMD_INVALID,
+    CMD_BALANCE_ALL,
+    CMD_MODE_SINGLE,
+    CMD_MODE_MULTI,
+    CMD_MODE_STATUS,
+    CMD_LOG_LEVEL,
+    CMD_STATS,
+    CMD_CONTENTION,
+    CMD_LOCK_PROFILE,
+    CMD_TXN,
+    CMD_TXMODE,
+    CMD_HISTORY,
+    CMD_MODE_HYBRID,
+    CMD_PROMOTE,
+    CMD_CREATE_ID,
+    CMD_PREPARE,
+    CMD_COMMIT,
+    CMD_ABORT,
+    CMD_COUNT  // Number of command types (not a command)
+} CommandType;
+
+// Execution strategies the MODE_* commands switch between
+typedef enum {
+    EXEC_MULTI,    // Thread pool
+    EXEC_SINGLE,   // Everything inline on the reactor
+    EXEC_HYBRID    // Cheap commands on the reactor, the rest on the pool
+} ExecMode;
+
+// Longest accepted request id ("RID=<id>" option)
+#define REQUEST_ID_MAX 32
+
+// Parsed command structure
+typedef struct {
+    CommandType type;
+    int account_id;
+    int target_id;
+    double amount;
+    int count;     // Optional result count (e.g. CONTENTION top-N)
+    uint64_t cursor;  // HISTORY only: return entries older than this sequence number
+    char arg[16];  // Free-form argument (e.g. LOG_LEVEL name)
+    int op_count;  // TXN only: ops[0..op_count)
+    TxnOp ops[TXN_MAX_OPS];
+    char request_id[REQUEST_ID_MAX + 1];  // Idempotency key, "" if none
+    int ttl_ms;    // Client deadline relative to arrival ("TTL=<ms>"), 0 if none
+    unsigned int tag;  // "TAG=<n>": reply is framed with its length (see below), 0 if none
+    char txn_id[REQUEST_ID_MAX + 1];  // PREPARE/COMMIT/ABORT: two-phase transaction id
+} ParsedCommand;
+
+// Command names, kept next to the enum so the two stay in sync. Inline so
+// that modules like metrics can use it without linking the protocol layer.
+static inline const char *protocol_command_name(CommandType type) {
+    static const char *const names[CMD_COUNT] = {
+        "CREATE", "DEPOSIT", "WITHDRAW", "TRANSFER", "BALANCE", "SHUTDOWN", "INVALID",
+        "BALANCE_ALL", "MODE_SINGLE", "MODE_MULTI", "MODE_STATUS", "LOG_LEVEL", "STATS",
+        "CONTENTION", "LOCK_PROFILE", "TXN", "TXMODE", "HISTORY", "MODE_HYBRID", "PROMOTE", "CREATE_ID", "PREPARE", "COMMIT",
+        "ABORT"
+    };
+    if (type < 0 || type >= CMD_COUNT) return "UNKNOWN";
+    return names[type];
+}
+
+// Commands may be prefixed by KEY=value options, e.g. "RID=abc DEPOSIT 1 10"
+ParsedCommand parse_command(const char *input);
+
+// Executes one request and returns its command type (for metrics); the
+// reply's length is stored in *resp_len unless it is NULL
+CommandType execute_command(const char *input, char *response, size_t resp_size, int *resp_len);
+// Same, minus the simulated delay, for a command the caller has already
+// parsed: for cheap commands run on the reactor
+CommandType execute_command_inline(const ParsedCommand *cmd, char *response, size_t resp_size, int *resp_len);
+// Cheap enough to run on the reactor in hybrid mode (never waits on I/O or other requests)
+int command_is_inline_safe(const ParsedCommand *cmd);
+// A tagged request's reply is sent as "TAG=<n> <len>\n" followed by <len>
+// bytes of the plain reply, so a client pipelining over one connection (the
+// shard proxy) can match replies that complete out of order. Rewrites
+// response in place and returns the new length; untagged replies pass as-is.
+int protocol_frame_reply(unsigned int tag, char *response, size_t resp_size, int len);
 Account* get_account_ptr(int id);
+int command_is_mutating(CommandType type);
+
+void simulate_processing_delay(void);
+void protocol_set_delay_ms(int ms);
+int protocol_get_delay_ms(void);
 
 #endif // PROTOCOL_H
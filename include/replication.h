@@ -0,0 +1,25 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+// Streams every committed balance change from a primary to hot-standby
+// followers on the same machine. A follower applies the stream in log
+// order, serves reads, refuses writes until it is promoted.
+#define REPL_LOG_SIZE 65536   // Records a follower may fall behind before it must resync
+
+// Primary: log changes and serve followers on 127.0.0.1:port
+int repl_start_primary(int port);
+// Follower: mirror the primary listening on 127.0.0.1:port (read-only)
+int repl_start_follower(int primary_port);
+void repl_stop(void);
+
+// Called by transactions.c. Every mutation runs between begin and end, so
+// a snapshot for a new follower never sees a change without its log record.
+void repl_write_begin(void);
+void repl_write_end(void);
+void repl_log_create(int id, int striped);
+void repl_log_change(int id, double delta, int counterparty);
+
+int repl_is_read_only(void);   // A follower that hasn't been promoted
+int repl_promote(void);        // Stop following and accept writes; -1 if not a follower
+
+#endif // REPLICATION_H
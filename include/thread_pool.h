@@ -1,8 +1,27 @@
 #ifndef THREAD_POOL_H
 #define THREAD_POOL_H
 
+// Priority lanes: the admin lane is always served first, the others share
+// the workers by weight
+typedef enum {
+    LANE_ADMIN,   // MODE_*, SHUTDOWN and other control commands
+    LANE_READ,    // Single-account reads (BALANCE, HISTORY)
+    LANE_WRITE,   // Mutations (CREATE, DEPOSIT, WITHDRAW, TRANSFER, TXN)
+    LANE_BULK,    // Whole-bank scans (BALANCE_ALL)
+    LANE_COUNT
+} QueueLane;
+
 void thread_pool_init(int num_workers);
-int submit_task(int client_fd, const char *command);
+void thread_pool_set_lane_weights(int read, int write, int bulk);
+void thread_pool_set_coroutines(int per_worker);  // Requests in flight per worker (0 = 1, blocking)
+void thread_pool_set_shed_ms(int ms);  // Refuse work expected to queue longer than ms (0 = off)
+// Takes over one reference to buf; command must point inside it. trace is
+// the request's span from trace_begin() (0 if not traced).
+struct Buffer;
+int submit_task(int client_fd, struct Buffer *buf, const char *command, int trace);
+void thread_pool_drain(void);    // Wait until queued and running tasks are all answered
+int thread_pool_running(void);
 void thread_pool_shutdown();
+int thread_pool_queue_depth(void);
 
 #endif // THREAD_POOL_H
@@ -0,0 +1,62 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Sampled per-request tracing. One request in every N gets a span that is
+// stamped as it passes each stage below; when the reply has been sent the
+// span is written to a fixed ring of compact records in a memory-mapped
+// file, which trace_dump turns into Chrome trace-event JSON.
+typedef enum {
+    TRACE_READ,        // Reactor read the bytes carrying the command
+    TRACE_ENQUEUE,     // Queued for a worker or partition
+    TRACE_DEQUEUE,     // Taken off the queue
+    TRACE_LOCK,        // Last account lock acquired
+    TRACE_EXEC_DONE,   // Reply built
+    TRACE_SEND_DONE,   // Reply handed to the socket
+    TRACE_STAGE_COUNT
+} TraceStage;
+
+#define TRACE_RING_RECORDS 65536   // Power of two
+#define TRACE_TYPE_MAX     64      // Command names kept in the file header
+#define TRACE_NAME_MAX     16
+#define TRACE_SKIPPED      UINT32_MAX
+
+// File layout: one header, then TRACE_RING_RECORDS records. Record n (from
+// 0, in the order requests finished) lives in slot n % capacity.
+typedef struct {
+    char magic[8];                 // TRACE_MAGIC
+    uint32_t record_size;
+    uint32_t capacity;
+    uint64_t written;              // Records ever written
+    char type_names[TRACE_TYPE_MAX][TRACE_NAME_MAX];
+} TraceHeader;
+
+#define TRACE_MAGIC "BANKTRC1"
+
+typedef struct {
+    uint64_t start_ns;             // TRACE_READ, CLOCK_MONOTONIC; 0 while being written
+    uint32_t offset_ns[TRACE_STAGE_COUNT - 1];  // Later stages after start_ns, or TRACE_SKIPPED
+    uint16_t type;                 // CommandType
+    uint16_t thread;               // Thread that finished the request (numbered from 1)
+} TraceRecord;
+
+// Server side. Sampling is off (and every call below is a no-op) until
+// trace_init() succeeds.
+int trace_init(int sample_every, const char *path);
+void trace_name_type(int type, const char *name);  // Label records of this type
+void trace_shutdown(void);
+int trace_enabled(void);
+
+// Reactor: start a span for a request read at read_ns if it's sampled.
+// Returns the span, or 0 when it isn't traced.
+int trace_begin(uint64_t read_ns);
+void trace_mark(int span, TraceStage stage);
+// Stamp TRACE_SEND_DONE, write the record and release the span
+void trace_end(int span, int type);
+
+// The span TRACE_LOCK stamps go to, for the calling thread or coroutine
+void trace_set_current(int span);
+void trace_mark_lock(void);
+
+#endif // TRACE_H
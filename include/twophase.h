@@ -0,0 +1,17 @@
+#ifndef TWOPHASE_H
+#define TWOPHASE_H
+
+// Participant side of the shard proxy's two-phase commit for transfers whose
+// accounts live on different servers. PREPARE moves no money into the
+// destination until the coordinator decides, and a prepared debit holds the
+// funds so the decision can't fail.
+#define TWOPHASE_MAX 1024   // Prepared transactions held at once
+
+// 1 if prepared; 0 if refused (no such account, bad amount, or for a debit
+// insufficient funds); -1 if txid is already prepared here or the table is full
+int twophase_prepare(const char *txid, int is_debit, int account_id, int counterparty, double amount);
+// Apply or undo the half txid prepared on account_id: 1, or -1 if there is none
+int twophase_commit(const char *txid, int account_id);
+int twophase_abort(const char *txid, int account_id);
+
+#endif // TWOPHASE_H
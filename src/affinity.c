@@ -0,0 +1,159 @@
+// affinity.c - CPU pinning and NUMA topology
+// ============================================================================
+// Threads are pinned with pthread_setaffinity_np. Topology comes straight
+// from /sys/devices/system/node, so there's no libnuma dependency; on a
+// machine without that directory everything is treated as node 0.
+// ============================================================================
+
+#define _GNU_SOURCE  // CPU_SET, pthread_setaffinity_np
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include "../include/affinity.h"
+#include "../include/logger.h"
+
+#define MAX_NODES 64
+
+static int worker_cpus[AFFINITY_MAX_CPUS];
+static int num_worker_cpus = 0;
+static int reactor_cpu = -1;
+
+static int cpu_node[AFFINITY_MAX_CPUS];
+static int topology_loaded = 0;
+
+int affinity_parse_cpulist(const char *list, int *out, int max) {
+    int count = 0;
+    const char *p = list;
+    
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= AFFINITY_MAX_CPUS) return -1;
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first || last >= AFFINITY_MAX_CPUS) return -1;
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            if (count >= max) return -1;
+            out[count++] = (int)cpu;
+        }
+        if (*p == ',') p++;
+        else if (*p && !isspace((unsigned char)*p)) return -1;
+        else break;
+    }
+    
+    return count;
+}
+
+static void load_topology(void) {
+    if (topology_loaded) return;
+    topology_loaded = 1;
+    
+    for (int i = 0; i < AFFINITY_MAX_CPUS; i++) {
+        cpu_node[i] = -1;
+    }
+    
+    for (int node = 0; node < MAX_NODES; node++) {
+        char path[64], line[512];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *f = fopen(path, "r");
+        if (!f) continue;
+        if (fgets(line, sizeof(line), f)) {
+            int cpus[AFFINITY_MAX_CPUS];
+            int n = affinity_parse_cpulist(line, cpus, AFFINITY_MAX_CPUS);
+            for (int i = 0; i < n; i++) {
+                cpu_node[cpus[i]] = node;
+            }
+        }
+        fclose(f);
+    }
+}
+
+int affinity_node_of_cpu(int cpu) {
+    if (cpu < 0 || cpu >= AFFINITY_MAX_CPUS) return -1;
+    load_topology();
+    return cpu_node[cpu];
+}
+
+int affinity_set_worker_cpus(const char *list) {
+    int n = affinity_parse_cpulist(list, worker_cpus, AFFINITY_MAX_CPUS);
+    if (n <= 0) return -1;
+    num_worker_cpus = n;
+    return 0;
+}
+
+int affinity_set_reactor_cpu(int cpu) {
+    if (cpu < 0 || cpu >= AFFINITY_MAX_CPUS) return -1;
+    reactor_cpu = cpu;
+    return 0;
+}
+
+static int pin_self(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+int affinity_pin_reactor(void) {
+    if (reactor_cpu < 0) return -1;
+    if (pin_self(reactor_cpu) != 0) {
+        logger_error("[Affinity] Could not pin reactor to CPU %d", reactor_cpu);
+        return -1;
+    }
+    logger_info("[Affinity] Reactor pinned to CPU %d (node %d)",
+                reactor_cpu, affinity_node_of_cpu(reactor_cpu));
+    return reactor_cpu;
+}
+
+int affinity_pin_worker(int index, const char *role) {
+    if (num_worker_cpus == 0) return -1;
+    int cpu = worker_cpus[index % num_worker_cpus];
+    if (pin_self(cpu) != 0) {
+        logger_error("[Affinity] Could not pin %s %d to CPU %d", role, index, cpu);
+        return -1;
+    }
+    logger_info("[Affinity] %s %d pinned to CPU %d (node %d)",
+                role, index, cpu, affinity_node_of_cpu(cpu));
+    return cpu;
+}
+
+void affinity_report(void) {
+    load_topology();
+    
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    int nodes_seen = 0;
+    for (int node = 0; node < MAX_NODES; node++) {
+        char cpus[256] = "";
+        size_t len = 0;
+        for (int cpu = 0; cpu < AFFINITY_MAX_CPUS; cpu++) {
+            if (cpu_node[cpu] != node) continue;
+            // Compress runs into ranges: 0-7,16-23
+            int last = cpu;
+            while (last + 1 < AFFINITY_MAX_CPUS && cpu_node[last + 1] == node) last++;
+            size_t room = len < sizeof(cpus) ? sizeof(cpus) - len : 0;
+            if (last > cpu) {
+                len += snprintf(cpus + len, room, "%s%d-%d", len ? "," : "", cpu, last);
+            } else {
+                len += snprintf(cpus + len, room, "%s%d", len ? "," : "", cpu);
+            }
+            cpu = last;
+        }
+        if (len == 0) continue;
+        logger_info("[Affinity] NUMA node %d: CPUs %s", node, cpus);
+        nodes_seen++;
+    }
+    
+    logger_info("[Affinity] %ld CPUs online, %d NUMA node(s); reactor %s, workers %s",
+                online, nodes_seen ? nodes_seen : 1,
+                reactor_cpu >= 0 ? "pinned" : "unpinned",
+                num_worker_cpus > 0 ? "pinned" : "unpinned");
+}
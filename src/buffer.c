@@ -0,0 +1,81 @@
+// buffer.c - Pool of reference-counted request buffers
+// ============================================================================
+// BUFFER_POOL_SIZE buffers are carved from one slab on first use. Free
+// buffers sit on a lock-free stack that links them by slab index, and the
+// head packs a 32-bit index with a 32-bit tag bumped on every update, so a
+// pop racing with a pop-push of the same buffer (ABA) fails its CAS. When
+// the pool is empty, buffers fall back to malloc and are freed on release.
+// ============================================================================
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#include "../include/buffer.h"
+
+#define BUFFER_POOL_SIZE 1024
+#define EMPTY_INDEX UINT32_MAX
+
+static Buffer *slab = NULL;
+static _Atomic uint64_t free_head = EMPTY_INDEX;   // (tag << 32) | index
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+static void push_free(Buffer *buf) {
+    uint64_t old = atomic_load_explicit(&free_head, memory_order_relaxed);
+    uint64_t new_head;
+    do {
+        atomic_store_explicit(&buf->next, (uint32_t)old, memory_order_relaxed);
+        new_head = ((old >> 32) + 1) << 32 | buf->index;
+    } while (!atomic_compare_exchange_weak_explicit(&free_head, &old, new_head,
+                                                    memory_order_release, memory_order_relaxed));
+}
+
+static Buffer *pop_free(void) {
+    uint64_t old = atomic_load_explicit(&free_head, memory_order_acquire);
+    uint64_t new_head;
+    do {
+        uint32_t index = (uint32_t)old;
+        if (index == EMPTY_INDEX) return NULL;
+        uint32_t next = atomic_load_explicit(&slab[index].next, memory_order_relaxed);
+        new_head = ((old >> 32) + 1) << 32 | next;
+    } while (!atomic_compare_exchange_weak_explicit(&free_head, &old, new_head,
+                                                    memory_order_acquire, memory_order_acquire));
+    return &slab[(uint32_t)old];
+}
+
+static void init_pool(void) {
+    slab = aligned_alloc(64, sizeof(Buffer) * BUFFER_POOL_SIZE);
+    if (!slab) return;
+    for (uint32_t i = BUFFER_POOL_SIZE; i-- > 0;) {
+        slab[i].index = i;
+        push_free(&slab[i]);
+    }
+}
+
+Buffer *buffer_alloc(void) {
+    pthread_once(&pool_once, init_pool);
+    
+    Buffer *buf = slab ? pop_free() : NULL;
+    if (!buf) {
+        buf = malloc(sizeof(Buffer));
+        if (!buf) return NULL;
+        buf->index = BUFFER_UNPOOLED;
+    }
+    atomic_store_explicit(&buf->refs, 1, memory_order_relaxed);
+    buf->len = 0;
+    return buf;
+}
+
+void buffer_ref(Buffer *buf) {
+    atomic_fetch_add_explicit(&buf->refs, 1, memory_order_relaxed);
+}
+
+void buffer_release(Buffer *buf) {
+    if (atomic_fetch_sub_explicit(&buf->refs, 1, memory_order_acq_rel) != 1) return;
+    
+    if (buf->index == BUFFER_UNPOOLED) {
+        free(buf);
+    } else {
+        push_free(buf);
+    }
+}
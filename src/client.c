@@ -6,6 +6,8 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <sys/un.h>
+#include <stddef.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <time.h>
@@ -19,6 +21,8 @@
 #define STRESS_OPS_PER_CLIENT 10
 
 static int server_sock_fd = -1;
+static int server_port = SERVER_PORT;
+static const char *unix_path = NULL;  // --unix: the server's Unix socket ("@name": abstract)
 static pthread_mutex_t socket_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 void display_welcome() {
@@ -236,31 +240,56 @@ void handle_balance() {
     display_all_accounts();
 }
 
-// Setup connection to the server
-int setup_connection() {
-    server_sock_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_sock_fd < 0) {
-        perror("socket");
-        return -1;
+// Open a connection over TCP, or over unix_path if one was given
+static int connect_server(void) {
+    struct sockaddr_storage storage;
+    socklen_t addrlen;
+    memset(&storage, 0, sizeof(storage));
+    
+    if (unix_path) {
+        struct sockaddr_un *un = (struct sockaddr_un *)&storage;
+        size_t len = strlen(unix_path);
+        if (len >= sizeof(un->sun_path)) len = sizeof(un->sun_path) - 1;
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, unix_path, len);
+        addrlen = sizeof(*un);
+        if (unix_path[0] == '@') {
+            un->sun_path[0] = '\0';
+            addrlen = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len);
+        }
+    } else {
+        struct sockaddr_in *in = (struct sockaddr_in *)&storage;
+        in->sin_family = AF_INET;
+        in->sin_port = htons(server_port);
+        inet_pton(AF_INET, SERVER_HOST, &in->sin_addr);
+        addrlen = sizeof(*in);
     }
     
-    struct sockaddr_in server_addr;
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(SERVER_PORT);
-    
-    if (inet_pton(AF_INET, SERVER_HOST, &server_addr.sin_addr) <= 0) {
-        perror("inet_pton");
-        close(server_sock_fd);
+    int sock = socket(storage.ss_family, SOCK_STREAM, 0);
+    if (sock < 0) {
+        perror("socket");
         return -1;
     }
-    
-    if (connect(server_sock_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+    if (connect(sock, (struct sockaddr *)&storage, addrlen) < 0) {
         perror("connect");
-        close(server_sock_fd);
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Setup connection to the server
+int setup_connection() {
+    server_sock_fd = connect_server();
+    if (server_sock_fd < 0) {
         return -1;
     }
     
-    printf("[Client] Connected to server at %s:%d\n", SERVER_HOST, SERVER_PORT);
+    if (unix_path) {
+        printf("[Client] Connected to server at %s\n", unix_path);
+    } else {
+        printf("[Client] Connected to server at %s:%d\n", SERVER_HOST, server_port);
+    }
     return 0;
 }
 
@@ -339,19 +368,9 @@ static void* stress_client_thread(void *arg) {
     char cmd[BUFFER_SIZE], response[BUFFER_SIZE];
     
     // Connect to server
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    int sock = connect_server();
     if (sock < 0) return NULL;
     
-    struct sockaddr_in addr;
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(SERVER_PORT);
-    inet_pton(AF_INET, SERVER_HOST, &addr.sin_addr);
-    
-    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        close(sock);
-        return NULL;
-    }
-    
     // Create account
     snprintf(cmd, sizeof(cmd), "CREATE\n");
     stress_send_command(sock, cmd, response, sizeof(response));
@@ -451,7 +470,18 @@ void run_stress_test(const char *mode_name, int num_clients) {
 }
 
 // Main program
-int main() {
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            server_port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--unix") == 0 && i + 1 < argc) {
+            unix_path = argv[++i];
+        } else {
+            printf("Usage: %s [--port PORT | --unix PATH]\n", argv[0]);
+            return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+    
     if (setup_connection() < 0) {
         printf("Failed to connect to the bank server.\n");
         return 1;
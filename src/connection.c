@@ -0,0 +1,212 @@
+// connection.c - Fd-indexed connection table with an idle-timeout wheel
+// ============================================================================
+// All connection state lives in one array indexed by fd, allocated once at
+// startup, so memory is predictable no matter how many clients come and go.
+// Only the reactor thread touches the table.
+//
+// Idle connections are found with a hashed timer wheel of one-second slots.
+// A connection sits in the slot of its expiry time. Activity only updates
+// last_active_s; when the slot comes round the connection is either closed
+// or lazily moved to the slot of its new expiry. That keeps the per-read
+// cost at a single store, and each tick only visits one slot.
+//
+// Workers answer requests on the fd after the reactor has handed them off,
+// so a connection with requests in flight is never expired, and when the
+// reactor closes one anyway (the peer hung up) the fd stays open on a
+// deferred-close list until the last reply has been sent.
+// ============================================================================
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../include/connection.h"
+#include "../include/logger.h"
+#include "../include/buffer.h"
+
+#define CONN_WHEEL_SLOTS 64
+
+static Connection *table = NULL;
+static int capacity = 0;
+static int idle_timeout = 0;
+static int wheel[CONN_WHEEL_SLOTS];   // First fd in each slot, -1 if empty
+static uint64_t last_tick_s = 0;
+static int closing_head = -1;         // Deferred-close list
+
+static uint64_t now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec;
+}
+
+static void wheel_insert(Connection *c, uint64_t expiry_s) {
+    int slot = (int)(expiry_s % CONN_WHEEL_SLOTS);
+    c->wheel_slot = slot;
+    c->wheel_prev = -1;
+    c->wheel_next = wheel[slot];
+    if (wheel[slot] >= 0) table[wheel[slot]].wheel_prev = c->fd;
+    wheel[slot] = c->fd;
+}
+
+static void wheel_remove(Connection *c) {
+    if (c->wheel_slot < 0) return;
+    if (c->wheel_prev >= 0) table[c->wheel_prev].wheel_next = c->wheel_next;
+    else wheel[c->wheel_slot] = c->wheel_next;
+    if (c->wheel_next >= 0) table[c->wheel_next].wheel_prev = c->wheel_prev;
+    c->wheel_slot = -1;
+}
+
+int conn_table_init(int max_conns, int idle_timeout_s) {
+    if (max_conns <= 0) return -1;
+    
+    // calloc: pages of slots never used are never touched
+    table = calloc((size_t)max_conns, sizeof(Connection));
+    if (!table) return -1;
+    
+    capacity = max_conns;
+    for (int i = 0; i < capacity; i++) {
+        table[i].fd = -1;
+        table[i].wheel_slot = -1;
+    }
+    for (int s = 0; s < CONN_WHEEL_SLOTS; s++) {
+        wheel[s] = -1;
+    }
+    idle_timeout = idle_timeout_s > 0 ? idle_timeout_s : 0;
+    last_tick_s = now_s();
+    
+    logger_info("[Conn] Table for %d connections (%zu KB), idle timeout %ds",
+                capacity, (size_t)capacity * sizeof(Connection) / 1024, idle_timeout);
+    return 0;
+}
+
+void conn_table_free(void) {
+    free(table);
+    table = NULL;
+    capacity = 0;
+}
+
+int conn_capacity(void) {
+    return capacity;
+}
+
+Connection *conn_open(int fd) {
+    if (fd < 0 || fd >= capacity) return NULL;
+    
+    Connection *c = &table[fd];
+    c->fd = fd;
+    c->rx = NULL;
+    atomic_store(&c->in_flight, 0);
+    c->closing = 0;
+    c->discarding = 0;
+    c->requests = 0;
+    c->bytes_in = 0;
+    c->last_active_s = now_s();
+    c->wheel_slot = -1;
+    if (idle_timeout > 0) {
+        wheel_insert(c, c->last_active_s + idle_timeout);
+    }
+    return c;
+}
+
+Connection *conn_get(int fd) {
+    if (fd < 0 || fd >= capacity || table[fd].fd < 0 || table[fd].closing) return NULL;
+    return &table[fd];
+}
+
+void conn_touch(Connection *c) {
+    c->last_active_s = now_s();
+}
+
+void conn_close(int fd) {
+    if (fd < 0 || fd >= capacity || table[fd].fd < 0) return;
+    Connection *c = &table[fd];
+    wheel_remove(c);
+    c->fd = -1;
+    c->closing = 0;
+    if (c->rx) {
+        buffer_release(c->rx);
+        c->rx = NULL;
+    }
+}
+
+void conn_request_start(int fd) {
+    if (fd < 0 || fd >= capacity) return;
+    atomic_fetch_add_explicit(&table[fd].in_flight, 1, memory_order_relaxed);
+}
+
+void conn_request_done(int fd) {
+    if (fd < 0 || fd >= capacity) return;
+    atomic_fetch_sub_explicit(&table[fd].in_flight, 1, memory_order_release);
+}
+
+int conn_requests_in_flight(int fd) {
+    if (fd < 0 || fd >= capacity) return 0;
+    return atomic_load_explicit(&table[fd].in_flight, memory_order_acquire);
+}
+
+int conn_defer_close(int fd) {
+    Connection *c = conn_get(fd);
+    if (!c || atomic_load_explicit(&c->in_flight, memory_order_acquire) == 0) return 0;
+    
+    wheel_remove(c);
+    if (c->rx) {
+        buffer_release(c->rx);
+        c->rx = NULL;
+    }
+    c->closing = 1;
+    c->next_closing = closing_head;
+    closing_head = fd;
+    return 1;
+}
+
+int conn_closing(int fd) {
+    return fd >= 0 && fd < capacity && table[fd].fd >= 0 && table[fd].closing;
+}
+
+void conn_reap(void (*on_closed)(int fd)) {
+    int *link = &closing_head;
+    while (*link >= 0) {
+        Connection *c = &table[*link];
+        if (atomic_load_explicit(&c->in_flight, memory_order_acquire) > 0) {
+            link = &c->next_closing;
+            continue;
+        }
+        int fd = *link;
+        *link = c->next_closing;
+        on_closed(fd);
+    }
+}
+
+void conn_tick(void (*on_idle)(int fd)) {
+    if (idle_timeout == 0) return;
+    
+    uint64_t now = now_s();
+    // Visit every slot whose second has passed (at most one full turn)
+    uint64_t from = (now - last_tick_s >= CONN_WHEEL_SLOTS) ? now - CONN_WHEEL_SLOTS + 1 : last_tick_s + 1;
+    
+    for (uint64_t s = from; s <= now; s++) {
+        int slot = (int)(s % CONN_WHEEL_SLOTS);
+        int fd = wheel[slot];
+        while (fd >= 0) {
+            Connection *c = &table[fd];
+            int next = c->wheel_next;
+            // Still waiting for a worker's reply: busy, not idle
+            if (atomic_load_explicit(&c->in_flight, memory_order_relaxed) > 0) {
+                c->last_active_s = now;
+            }
+            uint64_t expiry = c->last_active_s + idle_timeout;
+            
+            if (expiry <= now) {
+                wheel_remove(c);
+                on_idle(fd);
+            } else if ((int)(expiry % CONN_WHEEL_SLOTS) != slot) {
+                // Active since it was scheduled: move to its new expiry slot
+                wheel_remove(c);
+                wheel_insert(c, expiry);
+            }
+            fd = next;
+        }
+    }
+    
+    last_tick_s = now;
+}
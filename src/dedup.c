@@ -0,0 +1,306 @@
+// dedup.c - Bounded idempotency cache for retried requests
+// ============================================================================
+// A request tagged "RID=<id>" reserves its id here before executing and
+// stores its response afterwards. A retry with the same id is answered from
+// the cache, skipping both the command and the simulated delay. A retry that
+// arrives while the original is still running waits for its response on a
+// pool worker, and is told IN_PROGRESS anywhere a wait would stall other
+// requests. Each entry keeps a hash of its command, so an id reused for a
+// different command is rejected instead of answered with the wrong reply.
+//
+// Memory is fixed: ids hash to one of DEDUP_SHARDS shards, each with its own
+// mutex, a small chained hash table and an LRU list over a static entry
+// array. Entries older than the TTL are treated as absent, and when a shard
+// is full its least recently used finished entry is recycled.
+// ============================================================================
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <stdatomic.h>
+
+#include "../include/dedup.h"
+#include "../include/metrics.h"
+#include "../include/coro.h"
+#include "../include/encode.h"
+#include "../include/logger.h"
+
+#define DEDUP_SHARDS         64
+#define DEDUP_SHARD_ENTRIES  64    // 4096 ids in total
+#define DEDUP_BUCKETS        128   // Per shard; keeps chains short
+#define DEDUP_RESPONSE_MAX   64    // Mutating commands have one-line replies
+#define DEDUP_WAIT_MS        2000  // How long a retry waits for the original
+
+typedef enum {
+    SLOT_FREE,
+    SLOT_PENDING,   // Reserved, command still executing
+    SLOT_DONE       // Response cached
+} SlotState;
+
+typedef struct {
+    char key[REQUEST_ID_MAX + 1];
+    uint8_t state;
+    int16_t next;       // Bucket chain, or free list when SLOT_FREE
+    int16_t lru_prev;
+    int16_t lru_next;
+    uint64_t hash;
+    uint64_t command_hash;
+    uint64_t stored_ns;
+    char response[DEDUP_RESPONSE_MAX];
+} DedupEntry;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+    int16_t buckets[DEDUP_BUCKETS];
+    int16_t lru_head;   // Most recently used
+    int16_t lru_tail;
+    int16_t free_head;
+    DedupEntry entries[DEDUP_SHARD_ENTRIES];
+} __attribute__((aligned(64))) DedupShard;
+
+static DedupShard shards[DEDUP_SHARDS];
+static pthread_once_t shards_once = PTHREAD_ONCE_INIT;
+static _Atomic int ttl_ms = DEDUP_DEFAULT_TTL_MS;
+static __thread int may_wait = 0;
+
+static void init_shards(void) {
+    for (int s = 0; s < DEDUP_SHARDS; s++) {
+        DedupShard *shard = &shards[s];
+        pthread_mutex_init(&shard->lock, NULL);
+        pthread_cond_init(&shard->finished, NULL);
+        for (int b = 0; b < DEDUP_BUCKETS; b++) {
+            shard->buckets[b] = -1;
+        }
+        shard->lru_head = shard->lru_tail = -1;
+        for (int i = 0; i < DEDUP_SHARD_ENTRIES; i++) {
+            shard->entries[i].state = SLOT_FREE;
+            shard->entries[i].next = (i + 1 < DEDUP_SHARD_ENTRIES) ? i + 1 : -1;
+        }
+        shard->free_head = 0;
+    }
+}
+
+// FNV-1a
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static uint64_t hash_key(const char *key) {
+    return hash_bytes(1469598103934665603ULL, key, strlen(key));
+}
+
+// What the command does, field by field (struct padding is not hashed).
+// The RID, TTL and TAG options are left out: a retry may change them.
+static uint64_t hash_command(const ParsedCommand *cmd) {
+    uint64_t h = hash_bytes(1469598103934665603ULL, &cmd->type, sizeof(cmd->type));
+    h = hash_bytes(h, &cmd->account_id, sizeof(cmd->account_id));
+    h = hash_bytes(h, &cmd->target_id, sizeof(cmd->target_id));
+    h = hash_bytes(h, &cmd->amount, sizeof(cmd->amount));
+    h = hash_bytes(h, cmd->arg, strnlen(cmd->arg, sizeof(cmd->arg)));
+    h = hash_bytes(h, &cmd->op_count, sizeof(cmd->op_count));
+    for (int i = 0; i < cmd->op_count && i < TXN_MAX_OPS; i++) {
+        const TxnOp *op = &cmd->ops[i];
+        h = hash_bytes(h, &op->type, sizeof(op->type));
+        h = hash_bytes(h, &op->account_id, sizeof(op->account_id));
+        h = hash_bytes(h, &op->target_id, sizeof(op->target_id));
+        h = hash_bytes(h, &op->amount, sizeof(op->amount));
+    }
+    return h;
+}
+
+static void lru_unlink(DedupShard *shard, int i) {
+    DedupEntry *e = &shard->entries[i];
+    if (e->lru_prev >= 0) shard->entries[e->lru_prev].lru_next = e->lru_next;
+    else shard->lru_head = e->lru_next;
+    if (e->lru_next >= 0) shard->entries[e->lru_next].lru_prev = e->lru_prev;
+    else shard->lru_tail = e->lru_prev;
+}
+
+static void lru_push_front(DedupShard *shard, int i) {
+    DedupEntry *e = &shard->entries[i];
+    e->lru_prev = -1;
+    e->lru_next = shard->lru_head;
+    if (shard->lru_head >= 0) shard->entries[shard->lru_head].lru_prev = i;
+    shard->lru_head = i;
+    if (shard->lru_tail < 0) shard->lru_tail = i;
+}
+
+static int find_entry(DedupShard *shard, const char *key, uint64_t hash) {
+    for (int i = shard->buckets[(hash >> 32) % DEDUP_BUCKETS]; i >= 0; i = shard->entries[i].next) {
+        DedupEntry *e = &shard->entries[i];
+        if (e->hash == hash && strcmp(e->key, key) == 0) return i;
+    }
+    return -1;
+}
+
+static void bucket_unlink(DedupShard *shard, int i) {
+    int16_t *link = &shard->buckets[(shard->entries[i].hash >> 32) % DEDUP_BUCKETS];
+    while (*link != i) {
+        link = &shard->entries[*link].next;
+    }
+    *link = shard->entries[i].next;
+}
+
+// Take a free entry, or recycle the least recently used finished one
+static int alloc_entry(DedupShard *shard) {
+    if (shard->free_head >= 0) {
+        int i = shard->free_head;
+        shard->free_head = shard->entries[i].next;
+        return i;
+    }
+    for (int i = shard->lru_tail; i >= 0; i = shard->entries[i].lru_prev) {
+        if (shard->entries[i].state == SLOT_DONE) {
+            bucket_unlink(shard, i);
+            lru_unlink(shard, i);
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int is_expired(const DedupEntry *e, uint64_t now) {
+    return now - e->stored_ns > (uint64_t)atomic_load(&ttl_ms) * 1000000ULL;
+}
+
+DedupResult dedup_begin(const ParsedCommand *cmd, char *response, size_t resp_size) {
+    pthread_once(&shards_once, init_shards);
+
+    const char *request_id = cmd->request_id;
+    uint64_t hash = hash_key(request_id);
+    uint64_t command_hash = hash_command(cmd);
+    DedupShard *shard = &shards[hash % DEDUP_SHARDS];
+    int waits = may_wait || coro_active();
+
+    struct timespec deadline;
+    uint64_t wait_until = 0;
+    if (waits) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += DEDUP_WAIT_MS / 1000;
+        deadline.tv_nsec += (DEDUP_WAIT_MS % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        wait_until = metrics_now_ns() + DEDUP_WAIT_MS * 1000000ULL;
+    }
+
+    pthread_mutex_lock(&shard->lock);
+
+    int i;
+    while ((i = find_entry(shard, request_id, hash)) >= 0 &&
+           shard->entries[i].state == SLOT_PENDING &&
+           shard->entries[i].command_hash == command_hash) {
+        // The original is still executing; its response is what we want.
+        // A coroutine polls instead of blocking its thread, which may be
+        // the one the original is waiting to run on.
+        if (!waits) {
+            pthread_mutex_unlock(&shard->lock);
+            return DEDUP_BUSY;
+        }
+        if (coro_active()) {
+            pthread_mutex_unlock(&shard->lock);
+            if (metrics_now_ns() > wait_until) return DEDUP_BUSY;
+            coro_sleep_ms(1);
+            pthread_mutex_lock(&shard->lock);
+            continue;
+        }
+        if (pthread_cond_timedwait(&shard->finished, &shard->lock, &deadline) == ETIMEDOUT) {
+            pthread_mutex_unlock(&shard->lock);
+            return DEDUP_BUSY;
+        }
+    }
+
+    if (i >= 0) {
+        DedupEntry *e = &shard->entries[i];
+        lru_unlink(shard, i);
+        lru_push_front(shard, i);
+        if (e->state == SLOT_PENDING || !is_expired(e, metrics_now_ns())) {
+            // Only a different command gets here while the id is pending
+            if (e->command_hash != command_hash) {
+                pthread_mutex_unlock(&shard->lock);
+                return DEDUP_MISMATCH;
+            }
+            strncpy(response, e->response, resp_size - 1);
+            response[resp_size - 1] = '\0';
+            pthread_mutex_unlock(&shard->lock);
+            return DEDUP_HIT;
+        }
+        // Expired: execute again and reuse the slot
+        e->command_hash = command_hash;
+        e->state = SLOT_PENDING;
+        pthread_mutex_unlock(&shard->lock);
+        return DEDUP_NEW;
+    }
+
+    i = alloc_entry(shard);
+    if (i < 0) {
+        pthread_mutex_unlock(&shard->lock);
+        return DEDUP_UNTRACKED;
+    }
+
+    DedupEntry *e = &shard->entries[i];
+    strncpy(e->key, request_id, REQUEST_ID_MAX);
+    e->key[REQUEST_ID_MAX] = '\0';
+    e->hash = hash;
+    e->command_hash = command_hash;
+    e->state = SLOT_PENDING;
+    e->response[0] = '\0';
+    int16_t *bucket = &shard->buckets[(hash >> 32) % DEDUP_BUCKETS];
+    e->next = *bucket;
+    *bucket = i;
+    lru_push_front(shard, i);
+
+    pthread_mutex_unlock(&shard->lock);
+    return DEDUP_NEW;
+}
+
+void dedup_finish(const char *request_id, const char *response) {
+    uint64_t hash = hash_key(request_id);
+    DedupShard *shard = &shards[hash % DEDUP_SHARDS];
+
+    pthread_mutex_lock(&shard->lock);
+    int i = find_entry(shard, request_id, hash);
+    if (i >= 0 && shard->entries[i].state == SLOT_PENDING) {
+        DedupEntry *e = &shard->entries[i];
+        strncpy(e->response, response, DEDUP_RESPONSE_MAX - 1);
+        e->response[DEDUP_RESPONSE_MAX - 1] = '\0';
+        e->stored_ns = metrics_now_ns();
+        e->state = SLOT_DONE;
+        pthread_cond_broadcast(&shard->finished);
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+int dedup_reply(DedupResult seen, CommandType type, char *response, size_t resp_size) {
+    switch (seen) {
+        case DEDUP_BUSY:
+            return snprintf(response, resp_size, "IN_PROGRESS %s -1\n", protocol_command_name(type));
+        case DEDUP_MISMATCH:
+            logger_error("[Dedup] Request id reused for a different %s, rejected",
+                         protocol_command_name(type));
+            return reply_failure(response, resp_size, type);
+        default:
+            return (int)strlen(response);
+    }
+}
+
+void dedup_allow_waiting(void) {
+    may_wait = 1;
+}
+
+void dedup_set_ttl_ms(int ms) {
+    atomic_store(&ttl_ms, ms > 0 ? ms : DEDUP_DEFAULT_TTL_MS);
+}
+
+int dedup_get_ttl_ms(void) {
+    return atomic_load(&ttl_ms);
+}
@@ -0,0 +1,141 @@
+// encode.c - Fast decimal and reply-line encoding
+// ============================================================================
+// snprintf("%.2f") parses its format string and runs a general
+// floating-point conversion for every reply. Balances only ever need two
+// decimals, so money is converted to integer cents and printed two digits
+// at a time from a 200-byte lookup table. The "SUCCESS <CMD> " prefix and
+// the whole "FAILURE <CMD> -1\n" line are built once per command type and
+// copied with memcpy.
+//
+// Rounding is half away from zero on value * 100, while printf rounds the
+// exact binary value. The two can differ only on an exact half cent.
+// Values too large for int64 cents (and NaN/inf) fall back to snprintf.
+// ============================================================================
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../include/encode.h"
+
+#define PREFIX_MAX 32
+#define MONEY_FAST_MAX 9.0e15   // |value| * 100 still fits in int64
+#define MONEY_TEXT_MAX 40       // What's left of REPLY_MAX after the longest prefix
+
+typedef struct {
+    char text[PREFIX_MAX];
+    int len;
+} Template;
+
+static Template success_prefix[CMD_COUNT];  // "SUCCESS BALANCE "
+static Template failure_line[CMD_COUNT];    // "FAILURE BALANCE -1\n"
+static pthread_once_t templates_once = PTHREAD_ONCE_INIT;
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static void build_templates(void) {
+    for (int t = 0; t < CMD_COUNT; t++) {
+        const char *name = protocol_command_name((CommandType)t);
+        success_prefix[t].len = snprintf(success_prefix[t].text, PREFIX_MAX, "SUCCESS %s ", name);
+        failure_line[t].len = snprintf(failure_line[t].text, PREFIX_MAX, "FAILURE %s -1\n", name);
+    }
+}
+
+static int encode_uint(char *out, uint64_t value) {
+    char tmp[20];
+    char *p = tmp + sizeof(tmp);
+
+    while (value >= 100) {
+        unsigned pair = (unsigned)(value % 100) * 2;
+        value /= 100;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    }
+    if (value >= 10) {
+        *--p = digit_pairs[value * 2 + 1];
+        *--p = digit_pairs[value * 2];
+    } else {
+        *--p = (char)('0' + value);
+    }
+
+    int len = (int)(tmp + sizeof(tmp) - p);
+    memcpy(out, p, len);
+    return len;
+}
+
+int encode_int(char *out, long long value) {
+    if (value < 0) {
+        *out = '-';
+        return 1 + encode_uint(out + 1, 0 - (uint64_t)value);
+    }
+    return encode_uint(out, (uint64_t)value);
+}
+
+int encode_money(char *out, double value) {
+    if (!(value > -MONEY_FAST_MAX && value < MONEY_FAST_MAX)) {
+        int len = snprintf(out, MONEY_TEXT_MAX, "%.2f", value);
+        return len < MONEY_TEXT_MAX ? len : MONEY_TEXT_MAX - 1;
+    }
+
+    char *p = out;
+    int64_t cents = (int64_t)(value * 100.0 + (value < 0 ? -0.5 : 0.5));
+    if (cents < 0) {
+        *p++ = '-';
+        cents = -cents;
+    }
+    p += encode_uint(p, (uint64_t)cents / 100);
+    unsigned frac = (unsigned)(cents % 100) * 2;
+    *p++ = '.';
+    *p++ = digit_pairs[frac];
+    *p++ = digit_pairs[frac + 1];
+    return (int)(p - out);
+}
+
+// Prefix + value + newline; falls back to snprintf if out might be too small
+static int reply_with(char *out, size_t size, CommandType type, int is_money,
+                      double money, long long integer) {
+    pthread_once(&templates_once, build_templates);
+
+    if (size < REPLY_MAX) {
+        return is_money ? snprintf(out, size, "SUCCESS %s %.2f\n", protocol_command_name(type), money)
+                        : snprintf(out, size, "SUCCESS %s %lld\n", protocol_command_name(type), integer);
+    }
+
+    const Template *prefix = &success_prefix[type];
+    memcpy(out, prefix->text, prefix->len);
+    int len = prefix->len;
+    len += is_money ? encode_money(out + len, money) : encode_int(out + len, integer);
+    out[len++] = '\n';
+    out[len] = '\0';
+    return len;
+}
+
+int reply_money(char *out, size_t size, CommandType type, double value) {
+    return reply_with(out, size, type, 1, value, 0);
+}
+
+int reply_int(char *out, size_t size, CommandType type, long long value) {
+    return reply_with(out, size, type, 0, 0.0, value);
+}
+
+int reply_failure(char *out, size_t size, CommandType type) {
+    pthread_once(&templates_once, build_templates);
+
+    const Template *line = &failure_line[type];
+    if (size <= (size_t)line->len) {
+        return snprintf(out, size, "%s", line->text);
+    }
+    memcpy(out, line->text, line->len + 1);
+    return line->len;
+}
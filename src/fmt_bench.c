@@ -0,0 +1,173 @@
+// fmt_bench.c - Reply formatting micro-benchmark
+// ============================================================================
+// Times the per-response cost of building a reply line the old way
+// (snprintf, then strlen before send) against the encoders in encode.c,
+// for money, integer and failure replies. Before timing, it checks that
+// both produce the same bytes for every sample value.
+// ============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "../include/encode.h"
+
+#define DEFAULT_ITERATIONS 10000000
+#define SAMPLE_COUNT       4096      // Power of two
+#define REPLY_SIZE         1024      // Same as the server's response buffer
+
+static int iterations = DEFAULT_ITERATIONS;
+static double money_samples[SAMPLE_COUNT];
+static int int_samples[SAMPLE_COUNT];
+
+// Keeps the compiler from discarding the formatting work
+static volatile size_t sink;
+
+static double get_time_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+// Balances as the server produces them: sums of amounts with cents, over
+// several orders of magnitude
+static void build_samples(void) {
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < SAMPLE_COUNT; i++) {
+        double balance = 0.0;
+        int deposits = 1 + (int)(next_random(&rng) % 8);
+        uint64_t scale = 1;
+        for (int d = (int)(next_random(&rng) % 8); d > 0; d--) scale *= 10;
+        for (int d = 0; d < deposits; d++) {
+            balance += (double)(next_random(&rng) % (scale * 100)) / 100.0;
+        }
+        money_samples[i] = balance;
+        int_samples[i] = (int)(next_random(&rng) % 100000);
+    }
+}
+
+static int check_identical(void) {
+    char expected[REPLY_SIZE], actual[REPLY_SIZE];
+    int mismatches = 0;
+
+    for (int i = 0; i < SAMPLE_COUNT; i++) {
+        snprintf(expected, sizeof(expected), "SUCCESS BALANCE %.2f\n", money_samples[i]);
+        int len = reply_money(actual, sizeof(actual), CMD_BALANCE, money_samples[i]);
+        if (strcmp(expected, actual) != 0 || len != (int)strlen(expected)) {
+            if (mismatches++ < 5) printf("  mismatch: %s  vs %s", expected, actual);
+        }
+
+        snprintf(expected, sizeof(expected), "SUCCESS CREATE %d\n", int_samples[i]);
+        len = reply_int(actual, sizeof(actual), CMD_CREATE, int_samples[i]);
+        if (strcmp(expected, actual) != 0 || len != (int)strlen(expected)) mismatches++;
+    }
+
+    snprintf(expected, sizeof(expected), "FAILURE TRANSFER -1\n");
+    int len = reply_failure(actual, sizeof(actual), CMD_TRANSFER);
+    if (strcmp(expected, actual) != 0 || len != (int)strlen(expected)) mismatches++;
+
+    return mismatches;
+}
+
+static void report(const char *name, double snprintf_sec, double encode_sec) {
+    double old_ns = snprintf_sec * 1e9 / iterations;
+    double new_ns = encode_sec * 1e9 / iterations;
+    printf("  %-8s snprintf+strlen %7.1f ns   encoder %6.1f ns   %5.1fx\n",
+           name, old_ns, new_ns, old_ns / new_ns);
+}
+
+static void bench_money(void) {
+    char out[REPLY_SIZE];
+
+    double start = get_time_sec();
+    for (int i = 0; i < iterations; i++) {
+        snprintf(out, sizeof(out), "SUCCESS BALANCE %.2f\n", money_samples[i & (SAMPLE_COUNT - 1)]);
+        sink += strlen(out);
+    }
+    double old_sec = get_time_sec() - start;
+
+    start = get_time_sec();
+    for (int i = 0; i < iterations; i++) {
+        sink += reply_money(out, sizeof(out), CMD_BALANCE, money_samples[i & (SAMPLE_COUNT - 1)]);
+    }
+    report("money", old_sec, get_time_sec() - start);
+}
+
+static void bench_int(void) {
+    char out[REPLY_SIZE];
+
+    double start = get_time_sec();
+    for (int i = 0; i < iterations; i++) {
+        snprintf(out, sizeof(out), "SUCCESS CREATE %d\n", int_samples[i & (SAMPLE_COUNT - 1)]);
+        sink += strlen(out);
+    }
+    double old_sec = get_time_sec() - start;
+
+    start = get_time_sec();
+    for (int i = 0; i < iterations; i++) {
+        sink += reply_int(out, sizeof(out), CMD_CREATE, int_samples[i & (SAMPLE_COUNT - 1)]);
+    }
+    report("integer", old_sec, get_time_sec() - start);
+}
+
+static void bench_failure(void) {
+    char out[REPLY_SIZE];
+
+    double start = get_time_sec();
+    for (int i = 0; i < iterations; i++) {
+        snprintf(out, sizeof(out), "FAILURE TRANSFER -1\n");
+        sink += strlen(out);
+    }
+    double old_sec = get_time_sec() - start;
+
+    start = get_time_sec();
+    for (int i = 0; i < iterations; i++) {
+        sink += reply_failure(out, sizeof(out), CMD_TRANSFER);
+    }
+    report("failure", old_sec, get_time_sec() - start);
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else {
+            printf("Usage: %s [-n replies per case]\n", argv[0]);
+            return strcmp(argv[i], "-h") == 0 ? 0 : 1;
+        }
+    }
+
+    if (iterations <= 0) {
+        fprintf(stderr, "Need replies > 0\n");
+        return 1;
+    }
+
+    build_samples();
+
+    printf("============================================================\n");
+    printf("  REPLY FORMATTING BENCHMARK: %d replies per case\n", iterations);
+    printf("============================================================\n");
+
+    int mismatches = check_identical();
+    if (mismatches > 0) {
+        printf("  %d of %d sample replies differ from snprintf\n", mismatches, 2 * SAMPLE_COUNT + 1);
+    }
+
+    bench_money();
+    bench_int();
+    bench_failure();
+
+    printf("============================================================\n");
+    return mismatches > 0;
+}
@@ -0,0 +1,128 @@
+// history.c - Compact per-account transaction history
+// ============================================================================
+// Every account owns a ring of its HISTORY_DEPTH most recent balance changes.
+// Rings are handed out from slabs so account creation does one allocation
+// per HISTORY_SLAB_RINGS accounts rather than one per entry, and a statement
+// lookup reads one account's ring instead of scanning a global log.
+//
+// Writers claim a slot with fetch_add on the ring head and publish it by
+// stamping its sequence number last, so striped deposits (which hold only a
+// stripe lock) can record concurrently. Readers skip slots whose stamp
+// changes while they copy them.
+// ============================================================================
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "../include/history.h"
+
+#define HISTORY_SLAB_RINGS 32
+
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+static HistoryRing *slab = NULL;
+static int slab_used = HISTORY_SLAB_RINGS;
+
+// Rings handed back by a failed account creation, reused before the slab.
+// The link is stored over the ring's (unused) head.
+static HistoryRing *free_rings = NULL;
+
+HistoryRing *history_ring_alloc(void) {
+    pthread_mutex_lock(&arena_lock);
+    
+    if (free_rings) {
+        HistoryRing *ring = free_rings;
+        memcpy(&free_rings, ring, sizeof(free_rings));
+        memset(ring, 0, sizeof(*ring));
+        pthread_mutex_unlock(&arena_lock);
+        return ring;
+    }
+    
+    if (slab_used == HISTORY_SLAB_RINGS) {
+        HistoryRing *fresh = aligned_alloc(64, sizeof(HistoryRing) * HISTORY_SLAB_RINGS);
+        if (!fresh) {
+            pthread_mutex_unlock(&arena_lock);
+            return NULL;
+        }
+        memset(fresh, 0, sizeof(HistoryRing) * HISTORY_SLAB_RINGS);
+        slab = fresh;
+        slab_used = 0;
+    }
+    HistoryRing *ring = &slab[slab_used++];
+    
+    pthread_mutex_unlock(&arena_lock);
+    return ring;
+}
+
+void history_ring_free(HistoryRing *ring) {
+    if (!ring) return;
+    
+    pthread_mutex_lock(&arena_lock);
+    memcpy(ring, &free_rings, sizeof(free_rings));
+    free_rings = ring;
+    pthread_mutex_unlock(&arena_lock);
+}
+
+void history_record(HistoryRing *ring, double delta, int counterparty) {
+    if (!ring) return;
+    
+    uint64_t n = atomic_fetch_add_explicit(&ring->head, 1, memory_order_relaxed);
+    HistoryEntry *e = &ring->entries[n % HISTORY_DEPTH];
+    
+    // Unstamp, fill in, then stamp: readers never accept a half-written slot
+    atomic_store_explicit(&e->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    e->delta = delta;
+    e->counterparty = counterparty;
+    e->time_s = (uint32_t)time(NULL);
+    atomic_store_explicit(&e->seq, n + 1, memory_order_release);
+}
+
+int history_read(HistoryRing *ring, HistoryRecord *out, int max, uint64_t before_seq) {
+    if (!ring || max <= 0) return 0;
+    
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint64_t end = (before_seq > 0 && before_seq - 1 < head) ? before_seq - 1 : head;
+    uint64_t oldest = (head > HISTORY_DEPTH) ? head - HISTORY_DEPTH : 0;
+    
+    int filled = 0;
+    for (uint64_t n = end; n > oldest && filled < max; n--) {
+        HistoryEntry *e = &ring->entries[(n - 1) % HISTORY_DEPTH];
+        
+        if (atomic_load_explicit(&e->seq, memory_order_acquire) != n) continue;
+        HistoryRecord r = { n, e->delta, e->counterparty, e->time_s };
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&e->seq, memory_order_relaxed) != n) continue;  // Overwritten meanwhile
+        
+        out[filled++] = r;
+    }
+    
+    return filled;
+}
+
+void history_clear(HistoryRing *ring) {
+    if (!ring) return;
+    
+    atomic_store_explicit(&ring->head, 0, memory_order_release);
+    for (int i = 0; i < HISTORY_DEPTH; i++) {
+        atomic_store_explicit(&ring->entries[i].seq, 0, memory_order_release);
+    }
+}
+
+void history_restore(HistoryRing *ring, const HistoryRecord *record) {
+    if (!ring || record->seq == 0) return;
+    
+    HistoryEntry *e = &ring->entries[(record->seq - 1) % HISTORY_DEPTH];
+    atomic_store_explicit(&e->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    e->delta = record->delta;
+    e->counterparty = record->counterparty;
+    e->time_s = record->time_s;
+    atomic_store_explicit(&e->seq, record->seq, memory_order_release);
+    
+    if (record->seq > atomic_load_explicit(&ring->head, memory_order_relaxed)) {
+        atomic_store_explicit(&ring->head, record->seq, memory_order_release);
+    }
+}
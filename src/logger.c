@@ -0,0 +1,243 @@
+// logger.c - Asynchronous logger
+// ============================================================================
+// Every thread that logs gets its own single-producer ring buffer. Producers
+// format the message into a free slot and publish it with one atomic store -
+// no locks, no syscalls, and no contention with other threads. A background
+// writer thread drains all rings to the log file. If a ring is full the
+// message is dropped (and counted) rather than stalling the hot path.
+// ============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <strings.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/logger.h"
+
+#define LOG_RING_SLOTS   1024   // Messages buffered per thread (power of two)
+#define LOG_MSG_SIZE     240    // Max formatted message length
+#define LOG_IDLE_SLEEP_US 2000  // Writer back-off when every ring is empty
+
+// One buffered message
+typedef struct {
+    uint64_t timestamp_ns;  // CLOCK_REALTIME at the time of the call
+    int level;
+    int len;
+    char msg[LOG_MSG_SIZE];
+} LogSlot;
+
+// Per-thread ring: the owning thread advances head, the writer advances tail
+typedef struct LogRing {
+    _Atomic uint64_t head;
+    char pad1[64 - sizeof(uint64_t)];
+    _Atomic uint64_t tail;
+    char pad2[64 - sizeof(uint64_t)];
+    _Atomic uint64_t dropped;
+    struct LogRing *next;   // Registry of all rings (append-only)
+    LogSlot slots[LOG_RING_SLOTS];
+} LogRing;
+
+static const char *level_names[] = { "ERROR", "INFO", "DEBUG" };
+
+static _Atomic int current_level = LOG_LEVEL_INFO;
+static _Atomic int logger_running = 0;
+static _Atomic(LogRing *) ring_list = NULL;
+static __thread LogRing *thread_ring = NULL;
+
+static FILE *log_file = NULL;
+static pthread_t writer_thread;
+
+// Get (or lazily create and register) the calling thread's ring
+static LogRing *get_thread_ring(void) {
+    if (thread_ring) return thread_ring;
+
+    LogRing *ring = calloc(1, sizeof(LogRing));
+    if (!ring) return NULL;
+
+    // Lock-free push onto the registry so the writer can find this ring
+    LogRing *old = atomic_load(&ring_list);
+    do {
+        ring->next = old;
+    } while (!atomic_compare_exchange_weak(&ring_list, &old, ring));
+
+    thread_ring = ring;
+    return ring;
+}
+
+// Write one slot to the log file
+static void write_slot(const LogSlot *slot) {
+    time_t secs = (time_t)(slot->timestamp_ns / 1000000000ULL);
+    int ms = (int)((slot->timestamp_ns / 1000000ULL) % 1000);
+    struct tm tm;
+    localtime_r(&secs, &tm);
+
+    fprintf(log_file, "%02d:%02d:%02d.%03d %-5s %.*s\n",
+            tm.tm_hour, tm.tm_min, tm.tm_sec, ms,
+            level_names[slot->level], slot->len, slot->msg);
+}
+
+// Drain every ring once; returns the number of messages written
+static int drain_rings(void) {
+    int written = 0;
+
+    for (LogRing *ring = atomic_load(&ring_list); ring; ring = ring->next) {
+        uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+        while (tail != head) {
+            write_slot(&ring->slots[tail & (LOG_RING_SLOTS - 1)]);
+            tail++;
+            written++;
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+        uint64_t dropped = atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+        if (dropped > 0) {
+            fprintf(log_file, "[Logger] %llu messages dropped (ring full)\n",
+                    (unsigned long long)dropped);
+        }
+    }
+
+    if (written > 0) fflush(log_file);
+    return written;
+}
+
+// Background writer: drain rings until shutdown, sleeping when idle
+static void *logger_writer(void *arg) {
+    (void)arg;
+
+    while (atomic_load(&logger_running)) {
+        if (drain_rings() == 0) {
+            usleep(LOG_IDLE_SLEEP_US);
+        }
+    }
+
+    drain_rings();  // Final flush of anything logged before shutdown
+    return NULL;
+}
+
+void logger_init(const char *filename) {
+    if (atomic_load(&logger_running)) return;
+
+    log_file = stdout;
+    if (filename) {
+        log_file = fopen(filename, "a");
+        if (!log_file) {
+            perror("fopen");
+            log_file = stdout;
+        }
+    }
+
+    atomic_store(&logger_running, 1);
+    if (pthread_create(&writer_thread, NULL, logger_writer, NULL) != 0) {
+        perror("pthread_create");
+        atomic_store(&logger_running, 0);
+    }
+}
+
+void logger_set_level(LogLevel level) {
+    atomic_store(&current_level, level);
+}
+
+LogLevel logger_get_level(void) {
+    return (LogLevel)atomic_load(&current_level);
+}
+
+int logger_parse_level(const char *name) {
+    for (int i = 0; i < (int)(sizeof(level_names) / sizeof(level_names[0])); i++) {
+        if (strcasecmp(name, level_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+const char *logger_level_name(LogLevel level) {
+    return level_names[level];
+}
+
+// Core logging routine shared by all the public entry points
+static void logger_vlog(int level, const char *format, va_list ap) {
+    if (level > atomic_load_explicit(&current_level, memory_order_relaxed)) return;
+
+    // Before init / after cleanup there is no writer: log synchronously
+    if (!atomic_load_explicit(&logger_running, memory_order_acquire)) {
+        printf("%-5s ", level_names[level]);
+        vprintf(format, ap);
+        if (format[0] && format[strlen(format) - 1] != '\n') putchar('\n');
+        return;
+    }
+
+    LogRing *ring = get_thread_ring();
+    if (!ring) return;
+
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= LOG_RING_SLOTS) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    LogSlot *slot = &ring->slots[head & (LOG_RING_SLOTS - 1)];
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    slot->timestamp_ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    slot->level = level;
+
+    int len = vsnprintf(slot->msg, sizeof(slot->msg), format, ap);
+    if (len < 0) len = 0;
+    if (len >= (int)sizeof(slot->msg)) len = sizeof(slot->msg) - 1;
+    // The writer adds the line ending
+    while (len > 0 && (slot->msg[len - 1] == '\n' || slot->msg[len - 1] == '\r')) len--;
+    slot->len = len;
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+void logger_log(const char *level, const char *format, ...) {
+    int lvl = logger_parse_level(level);
+    if (lvl < 0) lvl = LOG_LEVEL_INFO;
+
+    va_list ap;
+    va_start(ap, format);
+    logger_vlog(lvl, format, ap);
+    va_end(ap);
+}
+
+void logger_info(const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    logger_vlog(LOG_LEVEL_INFO, format, ap);
+    va_end(ap);
+}
+
+void logger_error(const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    logger_vlog(LOG_LEVEL_ERROR, format, ap);
+    va_end(ap);
+}
+
+void logger_debug(const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    logger_vlog(LOG_LEVEL_DEBUG, format, ap);
+    va_end(ap);
+}
+
+// Stop the writer after it flushes everything. Rings stay allocated because
+// threads that have not exited yet may still hold pointers to them.
+void logger_cleanup() {
+    if (!atomic_exchange(&logger_running, 0)) return;
+
+    pthread_join(writer_thread, NULL);
+
+    if (log_file && log_file != stdout) {
+        fclose(log_file);
+    }
+    log_file = NULL;
+}
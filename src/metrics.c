@@ -0,0 +1,464 @@
+// metrics.c - Low-overhead server metrics
+// ============================================================================
+// Every thread that records a metric owns a private shard of counters and
+// latency histograms. Recording is a relaxed load + store on the thread's own
+// cache lines (no locked instructions, no sharing), so the hot-path cost is a
+// clock read and a few adds. Readers (STATS, /metrics) sum all shards; the
+// totals may be a few events stale, which is fine for monitoring.
+//
+// Histograms are log-linear: each power of two is split into 4 sub-buckets,
+// so any reported percentile is within 25% of the true value.
+//
+// Only one in METRICS_SAMPLE_EVERY events per thread and phase is timed and
+// bucketed; the rest just bump the count. That skips most of the clock reads
+// and bucket writes, and with thousands of requests per second the sampled
+// percentiles are as good as the full ones. Counts stay exact.
+// ============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../include/metrics.h"
+#include "../include/logger.h"
+
+#define HIST_SUB_BITS   2
+#define HIST_SUB        (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS    160     // Covers up to ~2^40 ns (about 18 minutes)
+#define PROM_BUFFER_SIZE (256 * 1024)
+#define METRICS_SAMPLE_EVERY 16 // Events per timed sample, per thread and phase
+
+typedef struct {
+    _Atomic uint64_t count;     // Every event
+    _Atomic uint64_t sampled;   // Events timed into sum_ns and buckets
+    _Atomic uint64_t sum_ns;
+    _Atomic uint64_t buckets[HIST_BUCKETS];
+} Histogram;
+
+// Plain copy of a histogram summed across shards
+typedef struct {
+    uint64_t count;
+    uint64_t sampled;
+    uint64_t sum_ns;
+    uint64_t buckets[HIST_BUCKETS];
+} HistSnapshot;
+
+// One thread's private counters
+typedef struct MetricsShard {
+    Histogram hist[CMD_COUNT][PHASE_COUNT];
+    _Atomic uint64_t lock_waits;
+    _Atomic uint64_t lock_wait_ns;
+    _Atomic uint64_t timeouts;
+    _Atomic uint64_t shed;
+    struct MetricsShard *next;
+} MetricsShard;
+
+static _Atomic(MetricsShard *) shard_list = NULL;
+static __thread MetricsShard *thread_shard = NULL;
+static __thread uint8_t sample_countdown[PHASE_COUNT];  // 0: time the next event
+
+static _Atomic int active_connections = 0;
+static int (*queue_depth_source)(void) = NULL;
+static void (*replication_source)(MetricsReplication *out) = NULL;
+
+static pthread_t http_thread;
+static int http_fd = -1;
+static _Atomic int http_running = 0;
+
+// Cleared by --no-metrics, to measure what the latency histograms cost.
+// Timestamps taken only for a histogram come from metrics_phase_start(), so
+// that switches off their clock reads too; deadlines and shedding keep
+// reading metrics_now_ns().
+static int recording = 1;
+
+static const char *phase_names[PHASE_COUNT] = { "parse", "queue", "exec", "send" };
+
+uint64_t metrics_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static MetricsShard *get_thread_shard(void) {
+    if (thread_shard) return thread_shard;
+
+    MetricsShard *shard = calloc(1, sizeof(MetricsShard));
+    if (!shard) return NULL;
+
+    MetricsShard *old = atomic_load(&shard_list);
+    do {
+        shard->next = old;
+    } while (!atomic_compare_exchange_weak(&shard_list, &old, shard));
+
+    thread_shard = shard;
+    return shard;
+}
+
+// Single-writer increment: only the owning thread ever stores to these
+static inline void shard_add(_Atomic uint64_t *counter, uint64_t delta) {
+    uint64_t v = atomic_load_explicit(counter, memory_order_relaxed);
+    atomic_store_explicit(counter, v + delta, memory_order_relaxed);
+}
+
+static int bucket_index(uint64_t ns) {
+    if (ns < HIST_SUB) return (int)ns;
+    int exp = 63 - __builtin_clzll(ns);
+    int sub = (int)((ns >> (exp - HIST_SUB_BITS)) & (HIST_SUB - 1));
+    int idx = (exp - HIST_SUB_BITS + 1) * HIST_SUB + sub;
+    return idx < HIST_BUCKETS ? idx : HIST_BUCKETS - 1;
+}
+
+// Exclusive upper bound of a bucket in nanoseconds
+static uint64_t bucket_upper(int idx) {
+    if (idx < HIST_SUB) return (uint64_t)idx + 1;
+    int exp = idx / HIST_SUB + HIST_SUB_BITS - 1;
+    uint64_t sub = (uint64_t)(idx % HIST_SUB);
+    return (HIST_SUB + sub + 1) << (exp - HIST_SUB_BITS);
+}
+
+void metrics_set_recording(int enabled) {
+    recording = enabled;
+}
+
+// Whether this thread times its next event in `phase`
+static inline int take_sample(MetricPhase phase) {
+    if (sample_countdown[phase] > 0) {
+        sample_countdown[phase]--;
+        return 0;
+    }
+    sample_countdown[phase] = METRICS_SAMPLE_EVERY - 1;
+    return 1;
+}
+
+static Histogram *thread_histogram(CommandType type, MetricPhase phase) {
+    if (type < 0 || type >= CMD_COUNT) return NULL;
+    MetricsShard *shard = thread_shard ? thread_shard : get_thread_shard();
+    return shard ? &shard->hist[type][phase] : NULL;
+}
+
+static void histogram_add(Histogram *h, uint64_t ns) {
+    shard_add(&h->count, 1);
+    shard_add(&h->sampled, 1);
+    shard_add(&h->sum_ns, ns);
+    shard_add(&h->buckets[bucket_index(ns)], 1);
+}
+
+uint64_t metrics_phase_start(MetricPhase phase) {
+    return (recording && take_sample(phase)) ? metrics_now_ns() : 0;
+}
+
+void metrics_phase_end(CommandType type, MetricPhase phase, uint64_t start) {
+    if (!recording) return;
+    Histogram *h = thread_histogram(type, phase);
+    if (!h) return;
+
+    if (start == 0) {
+        shard_add(&h->count, 1);
+    } else {
+        histogram_add(h, metrics_now_ns() - start);
+    }
+}
+
+void metrics_record(CommandType type, MetricPhase phase, uint64_t ns) {
+    if (!recording) return;
+    Histogram *h = thread_histogram(type, phase);
+    if (!h) return;
+
+    if (take_sample(phase)) {
+        histogram_add(h, ns);
+    } else {
+        shard_add(&h->count, 1);
+    }
+}
+
+void metrics_record_lock_wait(uint64_t ns) {
+    if (!recording) return;
+    MetricsShard *shard = get_thread_shard();
+    if (!shard) return;
+    shard_add(&shard->lock_waits, 1);
+    shard_add(&shard->lock_wait_ns, ns);
+}
+
+void metrics_record_timeout(void) {
+    MetricsShard *shard = get_thread_shard();
+    if (shard) shard_add(&shard->timeouts, 1);
+}
+
+void metrics_record_shed(void) {
+    MetricsShard *shard = get_thread_shard();
+    if (shard) shard_add(&shard->shed, 1);
+}
+
+void metrics_connection_opened(void) {
+    atomic_fetch_add_explicit(&active_connections, 1, memory_order_relaxed);
+}
+
+void metrics_connection_closed(void) {
+    atomic_fetch_sub_explicit(&active_connections, 1, memory_order_relaxed);
+}
+
+void metrics_set_queue_depth_source(int (*fn)(void)) {
+    queue_depth_source = fn;
+}
+
+static int queue_depth(void) {
+    return queue_depth_source ? queue_depth_source() : 0;
+}
+
+void metrics_set_replication_source(void (*fn)(MetricsReplication *out)) {
+    replication_source = fn;
+}
+
+// Sum one histogram across all thread shards
+static void collect_histogram(CommandType type, MetricPhase phase, HistSnapshot *out) {
+    memset(out, 0, sizeof(*out));
+    for (MetricsShard *s = atomic_load(&shard_list); s; s = s->next) {
+        Histogram *h = &s->hist[type][phase];
+        out->count += atomic_load_explicit(&h->count, memory_order_relaxed);
+        out->sampled += atomic_load_explicit(&h->sampled, memory_order_relaxed);
+        out->sum_ns += atomic_load_explicit(&h->sum_ns, memory_order_relaxed);
+        for (int b = 0; b < HIST_BUCKETS; b++) {
+            out->buckets[b] += atomic_load_explicit(&h->buckets[b], memory_order_relaxed);
+        }
+    }
+}
+
+static void collect_lock_waits(uint64_t *waits, uint64_t *wait_ns) {
+    *waits = 0;
+    *wait_ns = 0;
+    for (MetricsShard *s = atomic_load(&shard_list); s; s = s->next) {
+        *waits += atomic_load_explicit(&s->lock_waits, memory_order_relaxed);
+        *wait_ns += atomic_load_explicit(&s->lock_wait_ns, memory_order_relaxed);
+    }
+}
+
+static void collect_dropped(uint64_t *timeouts, uint64_t *shed) {
+    *timeouts = 0;
+    *shed = 0;
+    for (MetricsShard *s = atomic_load(&shard_list); s; s = s->next) {
+        *timeouts += atomic_load_explicit(&s->timeouts, memory_order_relaxed);
+        *shed += atomic_load_explicit(&s->shed, memory_order_relaxed);
+    }
+}
+
+// Approximate percentile (0-100) in nanoseconds: upper bound of its bucket
+static uint64_t histogram_percentile(const HistSnapshot *h, double pct) {
+    if (h->sampled == 0) return 0;
+    uint64_t rank = (uint64_t)(h->sampled * pct / 100.0);
+    if (rank >= h->sampled) rank = h->sampled - 1;
+
+    uint64_t seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen > rank) return bucket_upper(b);
+    }
+    return bucket_upper(HIST_BUCKETS - 1);
+}
+
+// Append to a buffer without overflowing; returns the new length
+static size_t append(char *buf, size_t size, size_t len, const char *fmt, ...) __attribute__((format(printf, 4, 5)));
+static size_t append(char *buf, size_t size, size_t len, const char *fmt, ...) {
+    if (len >= size) return len;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + len, size - len, fmt, ap);
+    va_end(ap);
+    if (n < 0) return len;
+    return (len + (size_t)n < size) ? len + (size_t)n : size - 1;
+}
+
+size_t metrics_format_stats(char *buf, size_t size) {
+    uint64_t waits, wait_ns, timeouts, shed;
+    collect_lock_waits(&waits, &wait_ns);
+    collect_dropped(&timeouts, &shed);
+
+    size_t len = 0;
+    buf[0] = '\0';
+    len = append(buf, size, len,
+                 "SUCCESS STATS conns=%d queue=%d lock_waits=%llu lock_wait_us=%llu timeouts=%llu shed=%llu\n",
+                 atomic_load(&active_connections), queue_depth(),
+                 (unsigned long long)waits, (unsigned long long)(wait_ns / 1000),
+                 (unsigned long long)timeouts, (unsigned long long)shed);
+    if (replication_source) {
+        MetricsReplication r;
+        replication_source(&r);
+        // Continue the first line, before its newline
+        len = append(buf, size, len - 1,
+                     " repl=%s lsn=%llu lag=%llu lag_ms=%.1f followers=%d\n",
+                     r.role, (unsigned long long)r.lsn, (unsigned long long)r.lag_records,
+                     r.lag_seconds * 1e3, r.followers);
+    }
+
+    // One line per command seen so far: count plus p50/p99 per phase in us
+    for (int t = 0; t < CMD_COUNT; t++) {
+        HistSnapshot h[PHASE_COUNT];
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            collect_histogram((CommandType)t, (MetricPhase)p, &h[p]);
+        }
+        if (h[PHASE_EXEC].count == 0) continue;
+
+        len = append(buf, size, len, "%s n=%llu", protocol_command_name((CommandType)t),
+                     (unsigned long long)h[PHASE_EXEC].count);
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            if (h[p].sampled == 0) continue;
+            len = append(buf, size, len, " %s=%llu/%lluus", phase_names[p],
+                         (unsigned long long)(histogram_percentile(&h[p], 50) / 1000),
+                         (unsigned long long)(histogram_percentile(&h[p], 99) / 1000));
+        }
+        len = append(buf, size, len, "\n");
+    }
+    return len;
+}
+
+size_t metrics_format_prometheus(char *buf, size_t size) {
+    // Bucket boundaries exported to Prometheus, in nanoseconds
+    static const uint64_t le_ns[] = {
+        1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000ULL, 10000000000ULL
+    };
+    const int num_le = sizeof(le_ns) / sizeof(le_ns[0]);
+
+    uint64_t waits, wait_ns, timeouts, shed;
+    collect_lock_waits(&waits, &wait_ns);
+    collect_dropped(&timeouts, &shed);
+
+    size_t len = 0;
+    buf[0] = '\0';
+    len = append(buf, size, len,
+                 "# TYPE bank_active_connections gauge\nbank_active_connections %d\n"
+                 "# TYPE bank_queue_depth gauge\nbank_queue_depth %d\n"
+                 "# TYPE bank_lock_waits_total counter\nbank_lock_waits_total %llu\n"
+                 "# TYPE bank_lock_wait_seconds_total counter\nbank_lock_wait_seconds_total %.9f\n"
+                 "# TYPE bank_requests_timed_out_total counter\nbank_requests_timed_out_total %llu\n"
+                 "# TYPE bank_requests_shed_total counter\nbank_requests_shed_total %llu\n"
+                 "# TYPE bank_request_phase_seconds histogram\n",
+                 atomic_load(&active_connections), queue_depth(),
+                 (unsigned long long)waits, wait_ns / 1e9,
+                 (unsigned long long)timeouts, (unsigned long long)shed);
+    if (replication_source) {
+        MetricsReplication r;
+        replication_source(&r);
+        len = append(buf, size, len,
+                     "# TYPE bank_replication_lsn gauge\nbank_replication_lsn{role=\"%s\"} %llu\n"
+                     "# TYPE bank_replication_lag_records gauge\nbank_replication_lag_records %llu\n"
+                     "# TYPE bank_replication_lag_seconds gauge\nbank_replication_lag_seconds %.6f\n"
+                     "# TYPE bank_replication_followers gauge\nbank_replication_followers %d\n",
+                     r.role, (unsigned long long)r.lsn, (unsigned long long)r.lag_records,
+                     r.lag_seconds, r.followers);
+    }
+
+    for (int t = 0; t < CMD_COUNT; t++) {
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            HistSnapshot h;
+            collect_histogram((CommandType)t, (MetricPhase)p, &h);
+            if (h.sampled == 0) continue;
+
+            const char *cmd = protocol_command_name((CommandType)t);
+            // Scale the sampled buckets and sum up to the exact count
+            double scale = (double)h.count / h.sampled;
+            // Cumulative counts of buckets that end at or below each boundary
+            int b = 0;
+            uint64_t cumulative = 0;
+            for (int i = 0; i < num_le; i++) {
+                while (b < HIST_BUCKETS && bucket_upper(b) <= le_ns[i]) {
+                    cumulative += h.buckets[b++];
+                }
+                len = append(buf, size, len,
+                             "bank_request_phase_seconds_bucket{cmd=\"%s\",phase=\"%s\",le=\"%g\"} %llu\n",
+                             cmd, phase_names[p], le_ns[i] / 1e9,
+                             (unsigned long long)(cumulative * scale + 0.5));
+            }
+            len = append(buf, size, len,
+                         "bank_request_phase_seconds_bucket{cmd=\"%s\",phase=\"%s\",le=\"+Inf\"} %llu\n"
+                         "bank_request_phase_seconds_sum{cmd=\"%s\",phase=\"%s\"} %.9f\n"
+                         "bank_request_phase_seconds_count{cmd=\"%s\",phase=\"%s\"} %llu\n",
+                         cmd, phase_names[p], (unsigned long long)h.count,
+                         cmd, phase_names[p], h.sum_ns * scale / 1e9,
+                         cmd, phase_names[p], (unsigned long long)h.count);
+        }
+    }
+    return len;
+}
+
+// Minimal HTTP responder: every request gets the current metrics snapshot
+static void *metrics_http_thread(void *arg) {
+    (void)arg;
+    char *body = malloc(PROM_BUFFER_SIZE);
+    if (!body) return NULL;
+
+    while (atomic_load(&http_running)) {
+        struct pollfd pfd = { .fd = http_fd, .events = POLLIN };
+        if (poll(&pfd, 1, 500) <= 0) continue;
+
+        int fd = accept(http_fd, NULL, NULL);
+        if (fd < 0) continue;
+
+        // Drain the request; its content doesn't matter
+        char req[1024];
+        struct timeval tv = { .tv_sec = 1, .tv_usec = 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        if (recv(fd, req, sizeof(req), 0) < 0) {
+            close(fd);
+            continue;
+        }
+
+        size_t body_len = metrics_format_prometheus(body, PROM_BUFFER_SIZE);
+        char header[160];
+        int header_len = snprintf(header, sizeof(header),
+                                  "HTTP/1.0 200 OK\r\n"
+                                  "Content-Type: text/plain; version=0.0.4\r\n"
+                                  "Content-Length: %zu\r\n\r\n", body_len);
+        send(fd, header, header_len, MSG_NOSIGNAL);
+        send(fd, body, body_len, MSG_NOSIGNAL);
+        close(fd);
+    }
+
+    free(body);
+    return NULL;
+}
+
+int metrics_start_http(int port) {
+    http_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (http_fd < 0) return -1;
+
+    int opt = 1;
+    setsockopt(http_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    // Local only: metrics are for the box's own scraper
+    struct sockaddr_in addr;
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    if (bind(http_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(http_fd, 16) < 0) {
+        close(http_fd);
+        http_fd = -1;
+        return -1;
+    }
+
+    atomic_store(&http_running, 1);
+    if (pthread_create(&http_thread, NULL, metrics_http_thread, NULL) != 0) {
+        atomic_store(&http_running, 0);
+        close(http_fd);
+        http_fd = -1;
+        return -1;
+    }
+
+    logger_info("[Metrics] Serving Prometheus metrics on 127.0.0.1:%d", port);
+    return 0;
+}
+
+void metrics_stop_http(void) {
+    if (!atomic_exchange(&http_running, 0)) return;
+    pthread_join(http_thread, NULL);
+    close(http_fd);
+    http_fd = -1;
+}
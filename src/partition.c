@@ -0,0 +1,536 @@
+// partition.c - Deterministic single-writer partitioned execution engine
+// ============================================================================
+// The account space is split across worker threads by account id
+// (owner = id % num_partitions). The reactor routes each request to its
+// owner's private queue, and since only the owner ever touches an account,
+// transactions run with account mutexes disabled (bank_set_single_writer).
+//
+// A transfer whose destination lives on another partition is split in two:
+// the source owner debits and then posts a credit to the destination owner,
+// which credits and sends the client its reply. Between those two steps the
+// money is in flight and appears in neither balance. Credits travel on a
+// separate unbounded list so two partitions can never block on each other.
+//
+// A request that needs accounts of several partitions is copied to each of
+// their queues with a shared Gather. BALANCE_ALL copies each report their
+// own accounts and the last one to arrive replies. A TXN spanning
+// partitions parks every owner on its copy; the last to arrive runs the
+// batch while the others wait, then releases them. Only the reactor queues
+// requests, so every partition sees the gathers in the same order and two
+// of them can never wait on each other.
+// ============================================================================
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <sys/socket.h>
+
+#include "../include/bank.h"
+#include "../include/protocol.h"
+#include "../include/partition.h"
+#include "../include/dedup.h"
+#include "../include/encode.h"
+#include "../include/logger.h"
+#include "../include/metrics.h"
+#include "../include/affinity.h"
+#include "../include/trace.h"
+#include "../include/connection.h"
+
+#define PARTITION_QUEUE_SIZE 1024
+#define BUFFER_SIZE 1024
+
+// Request copied to several partitions (see the top of the file)
+typedef struct {
+    int copies;            // Partitions the request was queued on
+    int arrived;           // Copies dequeued so far
+    int left;              // TXN: copies finished with the gather
+    int done;              // TXN: the batch has run, parked owners may go
+    int trace;
+    uint64_t exec_start_ns;  // BALANCE_ALL: when the first copy started
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+    double *balances;      // BALANCE_ALL: per account id, NAN if absent
+} Gather;
+
+// Client command routed by the reactor
+typedef struct {
+    int client_fd;
+    uint64_t enqueue_ns;
+    int trace;             // Sampled span, 0 if not traced
+    Gather *gather;        // Set on each copy of a multi-partition request
+    int lead;              // The copy that is timed and traced
+    char command[256];
+} Request;
+
+// Second half of a cross-partition transfer
+typedef struct Credit {
+    int client_fd;
+    int from_id;
+    int to_id;
+    double amount;
+    double from_balance;   // Source balance after the debit, for the reply
+    uint64_t exec_start_ns;
+    char request_id[REQUEST_ID_MAX + 1];  // Cache the reply under this id, if set
+    unsigned int tag;      // Client's TAG= option, echoed in the reply frame
+    int trace;             // The request's span, finished by the credit's owner
+    struct Credit *next;
+} Credit;
+
+// One partition: queues only its worker consumes, padded to avoid sharing
+typedef struct {
+    Request queue[PARTITION_QUEUE_SIZE];
+    int head;
+    int tail;
+    int count;
+    Credit *credits_head;   // Pending credits, FIFO
+    Credit *credits_tail;
+    int index;
+    pthread_mutex_t queue_lock;
+    pthread_cond_t queue_not_empty;
+    pthread_cond_t queue_not_full;
+    pthread_t worker;
+} __attribute__((aligned(64))) Partition;
+
+static Partition *partitions = NULL;
+static int num_partitions = 0;
+static _Atomic int shutting_down = 0;
+static _Atomic int in_flight = 0;  // Queued or executing requests and credits
+static unsigned int next_unrouted = 0;  // Round-robin for commands without an owner
+
+// Startup handshake: partition_init waits until every worker has pinned
+// itself and faulted in its own queue
+static pthread_mutex_t ready_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ready_cond = PTHREAD_COND_INITIALIZER;
+static int workers_ready = 0;
+
+static int owner_of(int account_id) {
+    return account_id % num_partitions;
+}
+
+// Queue a client request; blocks the reactor while the partition is full
+static void enqueue_request(Partition *p, const Request *req) {
+    atomic_fetch_add(&in_flight, 1);
+    pthread_mutex_lock(&p->queue_lock);
+    while (p->count >= PARTITION_QUEUE_SIZE) {
+        pthread_cond_wait(&p->queue_not_full, &p->queue_lock);
+    }
+    p->queue[p->tail] = *req;
+    p->tail = (p->tail + 1) % PARTITION_QUEUE_SIZE;
+    p->count++;
+    pthread_cond_signal(&p->queue_not_empty);
+    pthread_mutex_unlock(&p->queue_lock);
+}
+
+// Queue a credit; never blocks, so partitions can't deadlock on each other
+static void enqueue_credit(Partition *p, Credit *credit) {
+    atomic_fetch_add(&in_flight, 1);
+    credit->next = NULL;
+    pthread_mutex_lock(&p->queue_lock);
+    if (p->credits_tail) {
+        p->credits_tail->next = credit;
+    } else {
+        p->credits_head = credit;
+    }
+    p->credits_tail = credit;
+    pthread_cond_signal(&p->queue_not_empty);
+    pthread_mutex_unlock(&p->queue_lock);
+}
+
+// Wake every worker so they can re-check the shutdown condition
+static void wake_all(void) {
+    for (int i = 0; i < num_partitions; i++) {
+        pthread_mutex_lock(&partitions[i].queue_lock);
+        pthread_cond_broadcast(&partitions[i].queue_not_empty);
+        pthread_mutex_unlock(&partitions[i].queue_lock);
+    }
+}
+
+// Mark one message as fully handled
+static void message_done(void) {
+    if (atomic_fetch_sub(&in_flight, 1) == 1 && atomic_load(&shutting_down)) {
+        wake_all();
+    }
+}
+
+static void send_reply(int client_fd, CommandType type, unsigned int tag, int trace,
+                       char *response, int len) {
+    trace_mark(trace, TRACE_EXEC_DONE);
+    len = protocol_frame_reply(tag, response, BUFFER_SIZE, len);
+    uint64_t send_start = metrics_phase_start(PHASE_SEND);
+    if (send(client_fd, response, len, MSG_NOSIGNAL) < 0) {
+        logger_error("[Partition] Failed to send response to FD %d: %s",
+                     client_fd, strerror(errno));
+    }
+    metrics_phase_end(type, PHASE_SEND, send_start);
+    trace_end(trace, type);
+    conn_request_done(client_fd);
+}
+
+static void gather_free(Gather *g) {
+    pthread_mutex_destroy(&g->lock);
+    pthread_cond_destroy(&g->finished);
+    free(g->balances);
+    free(g);
+}
+
+// BALANCE_ALL copy: report this partition's accounts; the last copy replies
+static void gather_balances(Partition *self, const Request *req, unsigned int tag) {
+    Gather *g = req->gather;
+    uint64_t start = metrics_phase_start(PHASE_EXEC);
+    for (int id = self->index; id < MAX_ACCOUNTS; id += num_partitions) {
+        if (get_account(id)) g->balances[id] = get_balance(id);
+    }
+
+    pthread_mutex_lock(&g->lock);
+    if (g->arrived == 0) g->exec_start_ns = start;
+    int last = (++g->arrived == g->copies);
+    pthread_mutex_unlock(&g->lock);
+    if (!last) return;
+
+    // Same listing execute_command() produces
+    char response[BUFFER_SIZE];
+    snprintf(response, sizeof(response), "--- All Account Balances ---\n");
+    int found = 0;
+    for (int id = 0; id < MAX_ACCOUNTS; id++) {
+        if (isnan(g->balances[id])) continue;
+        found = 1;
+        char line[128];
+        snprintf(line, sizeof(line), "Account ID %d: $%.2f\n", id, g->balances[id]);
+        strncat(response, line, sizeof(response) - strlen(response) - 1);
+    }
+    if (!found) {
+        snprintf(response, sizeof(response), "No accounts found.\n");
+    }
+    metrics_phase_end(CMD_BALANCE_ALL, PHASE_EXEC, g->exec_start_ns);
+    send_reply(req->client_fd, CMD_BALANCE_ALL, tag, g->trace, response, (int)strlen(response));
+    gather_free(g);
+}
+
+// Multi-partition TXN copy: every owner but the last to arrive parks here,
+// so the last one can run the batch on accounts nobody else is touching
+static void gather_txn(const Request *req) {
+    Gather *g = req->gather;
+
+    pthread_mutex_lock(&g->lock);
+    if (++g->arrived < g->copies) {
+        while (!g->done) {
+            pthread_cond_wait(&g->finished, &g->lock);
+        }
+    } else {
+        pthread_mutex_unlock(&g->lock);
+
+        // Already framed by execute_command()
+        char response[BUFFER_SIZE];
+        int len;
+        CommandType type = execute_command(req->command, response, sizeof(response), &len);
+        send_reply(req->client_fd, type, 0, g->trace, response, len);
+
+        pthread_mutex_lock(&g->lock);
+        g->done = 1;
+        pthread_cond_broadcast(&g->finished);
+    }
+    int last = (++g->left == g->copies);
+    pthread_mutex_unlock(&g->lock);
+    if (last) gather_free(g);
+}
+
+// Execute a routed client request on its owning partition
+static void handle_request(Partition *self, const Request *req, const ParsedCommand *parsed) {
+    char response[BUFFER_SIZE];
+    int len;
+    ParsedCommand cmd = *parsed;
+
+    if (cmd.type == CMD_TRANSFER && cmd.account_id >= 0 && cmd.target_id >= 0 &&
+        owner_of(cmd.target_id) != self->index) {
+        // Cross-partition: debit here, then hand the credit to the other owner.
+        // execute_command() is bypassed, so the request id is checked here and
+        // the reply is cached by whichever side produces it.
+        uint64_t exec_start = metrics_now_ns();
+        int cache_result = 0;
+        if (cmd.request_id[0]) {
+            DedupResult seen = dedup_begin(&cmd, response, sizeof(response));
+            if (seen == DEDUP_HIT || seen == DEDUP_BUSY || seen == DEDUP_MISMATCH) {
+                len = dedup_reply(seen, CMD_TRANSFER, response, sizeof(response));
+                send_reply(req->client_fd, CMD_TRANSFER, cmd.tag, req->trace, response, len);
+                return;
+            }
+            cache_result = (seen == DEDUP_NEW);
+        }
+
+        simulate_processing_delay();
+
+        Credit *credit = NULL;
+        if (cmd.account_id == cmd.target_id || !get_account(cmd.target_id) ||
+            !(credit = malloc(sizeof(Credit))) ||
+            transfer_debit(cmd.account_id, cmd.target_id, cmd.amount) <= 0) {
+            free(credit);
+            len = reply_failure(response, sizeof(response), CMD_TRANSFER);
+            if (cache_result) dedup_finish(cmd.request_id, response);
+            metrics_record(CMD_TRANSFER, PHASE_EXEC, metrics_now_ns() - exec_start);
+            send_reply(req->client_fd, CMD_TRANSFER, cmd.tag, req->trace, response, len);
+            return;
+        }
+        credit->client_fd = req->client_fd;
+        credit->from_id = cmd.account_id;
+        credit->to_id = cmd.target_id;
+        credit->amount = cmd.amount;
+        credit->from_balance = get_balance(cmd.account_id);
+        credit->exec_start_ns = exec_start;
+        strcpy(credit->request_id, cache_result ? cmd.request_id : "");
+        credit->tag = cmd.tag;
+        credit->trace = req->trace;
+        enqueue_credit(&partitions[owner_of(cmd.target_id)], credit);
+        return;
+    }
+
+    if (req->gather) {
+        if (cmd.type == CMD_BALANCE_ALL) {
+            gather_balances(self, req, cmd.tag);
+        } else {
+            gather_txn(req);
+        }
+        return;
+    }
+
+    // Already framed by execute_command()
+    CommandType type = execute_command(req->command, response, sizeof(response), &len);
+    send_reply(req->client_fd, type, 0, req->trace, response, len);
+}
+
+// Finish a cross-partition transfer on the destination's owner
+static void handle_credit(const Credit *credit) {
+    char response[BUFFER_SIZE];
+
+    transfer_credit(credit->to_id, credit->from_id, credit->amount);
+    metrics_record(CMD_TRANSFER, PHASE_EXEC, metrics_now_ns() - credit->exec_start_ns);
+
+    int len = reply_money(response, sizeof(response), CMD_TRANSFER, credit->from_balance);
+    if (credit->request_id[0]) dedup_finish(credit->request_id, response);
+    send_reply(credit->client_fd, CMD_TRANSFER, credit->tag, credit->trace, response, len);
+}
+
+static void *partition_worker(void *arg) {
+    Partition *self = (Partition *)arg;
+
+    // First touch after pinning puts the queue pages on this worker's node
+    affinity_pin_worker(self->index, "Partition");
+    memset(self->queue, 0, sizeof(self->queue));
+
+    pthread_mutex_lock(&ready_lock);
+    workers_ready++;
+    pthread_cond_signal(&ready_cond);
+    pthread_mutex_unlock(&ready_lock);
+
+    while (1) {
+        pthread_mutex_lock(&self->queue_lock);
+        // Exit only once no partition holds work that could still send us a credit
+        while (self->count == 0 && !self->credits_head &&
+               !(atomic_load(&shutting_down) && atomic_load(&in_flight) == 0)) {
+            pthread_cond_wait(&self->queue_not_empty, &self->queue_lock);
+        }
+        if (self->count == 0 && !self->credits_head) {
+            pthread_mutex_unlock(&self->queue_lock);
+            break;
+        }
+
+        // Credits first: they complete transfers that already debited money
+        Credit *credit = self->credits_head;
+        if (credit) {
+            self->credits_head = credit->next;
+            if (!self->credits_head) self->credits_tail = NULL;
+            pthread_mutex_unlock(&self->queue_lock);
+
+            handle_credit(credit);
+            free(credit);
+            message_done();
+            continue;
+        }
+
+        Request req = self->queue[self->head];
+        self->head = (self->head + 1) % PARTITION_QUEUE_SIZE;
+        self->count--;
+        pthread_cond_signal(&self->queue_not_full);
+        pthread_mutex_unlock(&self->queue_lock);
+
+        trace_mark(req.trace, TRACE_DEQUEUE);
+        ParsedCommand cmd = parse_command(req.command);
+        if (req.lead) {
+            metrics_record(cmd.type, PHASE_QUEUE, metrics_now_ns() - req.enqueue_ns);
+        }
+        handle_request(self, &req, &cmd);
+        message_done();
+    }
+
+    return NULL;
+}
+
+int partition_init(int count) {
+    if (count <= 0) count = 1;
+    if (count > PARTITION_MAX) count = PARTITION_MAX;
+
+    // Only the control fields are set here; each worker faults in its own
+    // queue (the bulk of the struct) once pinned
+    partitions = aligned_alloc(64, sizeof(Partition) * count);
+    if (!partitions) return -1;
+
+    num_partitions = count;
+    atomic_store(&shutting_down, 0);
+
+    // Must happen before any worker runs: from here on accounts are unlocked
+    bank_set_single_writer(1);
+
+    for (int i = 0; i < count; i++) {
+        Partition *p = &partitions[i];
+        p->head = p->tail = p->count = 0;
+        p->credits_head = p->credits_tail = NULL;
+        p->index = i;
+        pthread_mutex_init(&p->queue_lock, NULL);
+        pthread_cond_init(&p->queue_not_empty, NULL);
+        pthread_cond_init(&p->queue_not_full, NULL);
+        pthread_create(&p->worker, NULL, partition_worker, p);
+    }
+
+    pthread_mutex_lock(&ready_lock);
+    while (workers_ready < count) {
+        pthread_cond_wait(&ready_cond, &ready_lock);
+    }
+    pthread_mutex_unlock(&ready_lock);
+
+    metrics_set_queue_depth_source(partition_queue_depth);
+    logger_info("[Partition] Initialized %d single-writer partitions", count);
+    return 0;
+}
+
+// Partitions owning an account the TXN touches, as a bitmask
+static uint64_t txn_owners(const ParsedCommand *cmd) {
+    uint64_t owners = 0;
+    for (int i = 0; i < cmd->op_count; i++) {
+        const TxnOp *op = &cmd->ops[i];
+        if (op->account_id >= 0) owners |= 1ULL << owner_of(op->account_id);
+        if (op->type == TXN_TRANSFER && op->target_id >= 0) owners |= 1ULL << owner_of(op->target_id);
+    }
+    return owners;
+}
+
+// Queue a copy of the request on every partition in `owners`
+static int submit_gather(const Request *base, CommandType type, uint64_t owners) {
+    Gather *g = calloc(1, sizeof(Gather));
+    if (!g) return -1;
+    if (type == CMD_BALANCE_ALL) {
+        g->balances = malloc(sizeof(double) * MAX_ACCOUNTS);
+        if (!g->balances) {
+            free(g);
+            return -1;
+        }
+        for (int id = 0; id < MAX_ACCOUNTS; id++) {
+            g->balances[id] = NAN;
+        }
+    }
+    g->copies = __builtin_popcountll(owners);
+    g->trace = base->trace;
+    pthread_mutex_init(&g->lock, NULL);
+    pthread_cond_init(&g->finished, NULL);
+
+    Request req = *base;
+    req.gather = g;
+    for (int i = 0; i < num_partitions; i++) {
+        if (!(owners & (1ULL << i))) continue;
+        enqueue_request(&partitions[i], &req);
+        req.lead = 0;
+        req.trace = 0;  // The span's stages are stamped by one copy only
+    }
+    return 0;
+}
+
+// Route a request to the partition owning its (first) account
+int partition_submit(int client_fd, const char *command, int trace) {
+    ParsedCommand cmd = parse_command(command);
+
+    Request req;
+    req.client_fd = client_fd;
+    req.enqueue_ns = metrics_now_ns();
+    req.trace = trace;
+    req.gather = NULL;
+    req.lead = 1;
+    trace_mark(trace, TRACE_ENQUEUE);
+    strncpy(req.command, command, sizeof(req.command) - 1);
+    req.command[sizeof(req.command) - 1] = '\0';
+
+    int target;
+    switch (cmd.type) {
+        case CMD_DEPOSIT:
+        case CMD_WITHDRAW:
+        case CMD_TRANSFER:
+        case CMD_BALANCE:
+        case CMD_HISTORY:
+        case CMD_CREATE_ID:
+        case CMD_PREPARE:
+        case CMD_COMMIT:
+        case CMD_ABORT:
+            target = (cmd.account_id >= 0) ? owner_of(cmd.account_id) : 0;
+            break;
+        case CMD_TXN:
+        case CMD_BALANCE_ALL: {
+            // BALANCE_ALL needs every owner to read its own accounts
+            uint64_t owners = (cmd.type == CMD_TXN) ? txn_owners(&cmd)
+                            : (num_partitions >= 64) ? ~0ULL : (1ULL << num_partitions) - 1;
+            if (__builtin_popcountll(owners) <= 1) {
+                target = owners ? __builtin_ctzll(owners) : 0;
+                break;
+            }
+            if (submit_gather(&req, cmd.type, owners) < 0) {
+                char response[BUFFER_SIZE];
+                int len = reply_failure(response, sizeof(response), cmd.type);
+                send_reply(client_fd, cmd.type, cmd.tag, trace, response, len);
+            }
+            return 0;
+        }
+        default:
+            // CREATE and control commands touch no existing account; spread them out
+            target = (int)(next_unrouted++ % (unsigned int)num_partitions);
+            break;
+    }
+
+    enqueue_request(&partitions[target], &req);
+    return 0;
+}
+
+int partition_enabled(void) {
+    return num_partitions > 0;
+}
+
+int partition_queue_depth(void) {
+    int depth = 0;
+    for (int i = 0; i < num_partitions; i++) {
+        pthread_mutex_lock(&partitions[i].queue_lock);
+        depth += partitions[i].count;
+        pthread_mutex_unlock(&partitions[i].queue_lock);
+    }
+    return depth;
+}
+
+// Drain every queue (including in-flight credits) and stop the workers
+void partition_shutdown(void) {
+    if (!partitions) return;
+
+    atomic_store(&shutting_down, 1);
+    wake_all();
+
+    for (int i = 0; i < num_partitions; i++) {
+        pthread_join(partitions[i].worker, NULL);
+    }
+
+    for (int i = 0; i < num_partitions; i++) {
+        pthread_mutex_destroy(&partitions[i].queue_lock);
+        pthread_cond_destroy(&partitions[i].queue_not_empty);
+        pthread_cond_destroy(&partitions[i].queue_not_full);
+    }
+
+    free(partitions);
+    partitions = NULL;
+    num_partitions = 0;
+}
@@ -1,47 +1,41 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <ctype.h>
 #include <unistd.h>  // for usleep()
 
 #include "../include/bank.h"
+#include "../include/protocol.h"
+#include "../include/logger.h"
+#include "../include/metrics.h"
+#include "../include/partition.h"
+#include "../include/dedup.h"
+#include "../include/history.h"
+#include "../include/coro.h"
+#include "../include/encode.h"
+#include "../include/replication.h"
+#include "../include/twophase.h"
 
 // ============================================================================
 // SIMULATED PROCESSING DELAY - Makes threading difference visible
 // ============================================================================
 // Set to 0 to disable delay, or any value in milliseconds (e.g., 100)
 // This simulates real-world latency: database access, validation, etc.
+// The server's --delay-ms option overrides this default at startup.
 #define SIMULATED_DELAY_MS 100
 // ============================================================================
 
-// External declarations
-extern Account *bank[MAX_ACCOUNTS];
+#define CONTENTION_DEFAULT_TOP 5
+#define CONTENTION_MAX_TOP     10
+#define HISTORY_DEFAULT_COUNT  10
+#define HISTORY_MAX_COUNT      20   // Keeps the reply within one response buffer
 
-// Protocol command types
-typedef enum {
-    CMD_CREATE,
-    CMD_DEPOSIT,
-    CMD_WITHDRAW,
-    CMD_TRANSFER,
-    CMD_BALANCE,
-    CMD_SHUTDOWN,
-    CMD_INVALID,
-    CMD_BALANCE_ALL,
-    CMD_MODE_SINGLE,
-    CMD_MODE_MULTI,
-    CMD_MODE_STATUS
-} CommandType;
+static int simulated_delay_ms = SIMULATED_DELAY_MS;
 
-// Parsed command structure
-typedef struct {
-    CommandType type;
-    int account_id;
-    int target_id;
-    double amount;
-} ParsedCommand;
 
-// Forward declaration
-Account* get_account_ptr(int id);
+// External declarations
+extern Account *bank[MAX_ACCOUNTS];
 
 // Trim whitespace from string
 static void trim(char *str) {
@@ -55,6 +49,70 @@ static void trim(char *str) {
     }
 }
 
+// Parse the body of "TXN op; op; ..." into cmd->ops. Returns 0 on success.
+static int parse_txn_ops(char *body, ParsedCommand *cmd) {
+    char *save = NULL;
+    cmd->op_count = 0;
+    
+    for (char *part = strtok_r(body, ";", &save); part; part = strtok_r(NULL, ";", &save)) {
+        char verb[16] = {0};
+        if (sscanf(part, "%15s", verb) != 1) continue;  // Allow a trailing ';'
+        if (cmd->op_count >= TXN_MAX_OPS) return -1;
+        
+        for (int i = 0; verb[i]; i++) {
+            verb[i] = toupper(verb[i]);
+        }
+        
+        TxnOp *op = &cmd->ops[cmd->op_count];
+        op->target_id = -1;
+        if (strcmp(verb, "DEPOSIT") == 0 &&
+            sscanf(part, "%*s %d %lf", &op->account_id, &op->amount) == 2) {
+            op->type = TXN_DEPOSIT;
+        } else if (strcmp(verb, "WITHDRAW") == 0 &&
+                   sscanf(part, "%*s %d %lf", &op->account_id, &op->amount) == 2) {
+            op->type = TXN_WITHDRAW;
+        } else if (strcmp(verb, "TRANSFER") == 0 &&
+                   sscanf(part, "%*s %d %d %lf", &op->account_id, &op->target_id, &op->amount) == 3) {
+            op->type = TXN_TRANSFER;
+        } else {
+            return -1;
+        }
+        cmd->op_count++;
+    }
+    
+    return cmd->op_count > 0 ? 0 : -1;
+}
+
+// Consume leading KEY=value options and shift the command to the front of
+// buffer. Unknown keys are skipped so newer clients still work.
+static void parse_options(char *buffer, ParsedCommand *cmd) {
+    char *p = buffer;
+    
+    while (*p) {
+        size_t len = strcspn(p, " \t");
+        char *eq = memchr(p, '=', len);
+        if (!eq) break;
+        
+        size_t key_len = eq - p;
+        size_t val_len = len - key_len - 1;
+        if (key_len == 3 && strncasecmp(p, "RID", 3) == 0 && val_len > 0) {
+            if (val_len > REQUEST_ID_MAX) val_len = REQUEST_ID_MAX;
+            memcpy(cmd->request_id, eq + 1, val_len);
+            cmd->request_id[val_len] = '\0';
+        } else if (key_len == 3 && strncasecmp(p, "TTL", 3) == 0) {
+            cmd->ttl_ms = atoi(eq + 1);
+            if (cmd->ttl_ms < 0) cmd->ttl_ms = 0;
+        } else if (key_len == 3 && strncasecmp(p, "TAG", 3) == 0) {
+            cmd->tag = (unsigned int)strtoul(eq + 1, NULL, 10);
+        }
+        
+        p += len;
+        p += strspn(p, " \t");
+    }
+    
+    memmove(buffer, p, strlen(p) + 1);
+}
+
 // Parse incoming command string
 ParsedCommand parse_command(const char *input) {
     ParsedCommand cmd = {0};
@@ -70,6 +128,7 @@ ParsedCommand parse_command(const char *input) {
     
     // Trim newline/spaces
     trim(buffer);
+    parse_options(buffer, &cmd);
     
     char cmd_name[32] = {0};
     sscanf(buffer, "%31s", cmd_name);
@@ -81,7 +140,25 @@ ParsedCommand parse_command(const char *input) {
     
     // Parse based on command type
     if (strcmp(cmd_name, "CREATE") == 0) {
-        cmd.type = CMD_CREATE;
+        // Optional account type: CREATE STRIPED
+        sscanf(buffer, "%*s %15s", cmd.arg);
+        for (int i = 0; cmd.arg[i]; i++) {
+            cmd.arg[i] = toupper(cmd.arg[i]);
+        }
+        if (cmd.arg[0] == '\0' || strcmp(cmd.arg, "STRIPED") == 0) {
+            cmd.type = CMD_CREATE;
+        }
+    }
+    else if (strcmp(cmd_name, "CREATE_ID") == 0) {
+        // CREATE_ID <id> [STRIPED]: the shard proxy places global ids itself
+        if (sscanf(buffer, "%*s %d %15s", &cmd.account_id, cmd.arg) >= 1) {
+            for (int i = 0; cmd.arg[i]; i++) {
+                cmd.arg[i] = toupper(cmd.arg[i]);
+            }
+            if (cmd.arg[0] == '\0' || strcmp(cmd.arg, "STRIPED") == 0) {
+                cmd.type = CMD_CREATE_ID;
+            }
+        }
     }
     else if (strcmp(cmd_name, "DEPOSIT") == 0) {
         if (sscanf(buffer, "%*s %d %lf", &cmd.account_id, &cmd.amount) == 2) {
@@ -103,6 +180,44 @@ ParsedCommand parse_command(const char *input) {
             cmd.type = CMD_BALANCE;
         }
     }
+    else if (strcmp(cmd_name, "TXN") == 0) {
+        // Single-line batch: TXN DEPOSIT 1 10; WITHDRAW 2 5; TRANSFER 1 3 20
+        char *body = buffer + strspn(buffer, " \t");
+        body += strcspn(body, " \t");
+        if (parse_txn_ops(body, &cmd) == 0) {
+            cmd.type = CMD_TXN;
+        }
+    }
+    else if (strcmp(cmd_name, "HISTORY") == 0) {
+        // HISTORY <id> [n] [before_seq]: newest n entries, paging backwards
+        unsigned long long cursor = 0;
+        cmd.count = HISTORY_DEFAULT_COUNT;
+        if (sscanf(buffer, "%*s %d %d %llu", &cmd.account_id, &cmd.count, &cursor) >= 1) {
+            cmd.cursor = cursor;
+            cmd.type = CMD_HISTORY;
+        }
+    }
+    else if (strcmp(cmd_name, "PREPARE") == 0) {
+        // PREPARE <txid> WITHDRAW|DEPOSIT <id> <amount> <counterparty>
+        char txid[REQUEST_ID_MAX + 1];
+        if (sscanf(buffer, "%*s %32s %15s %d %lf %d", txid, cmd.arg, &cmd.account_id,
+                   &cmd.amount, &cmd.target_id) == 5) {
+            for (int i = 0; cmd.arg[i]; i++) {
+                cmd.arg[i] = toupper(cmd.arg[i]);
+            }
+            if (strcmp(cmd.arg, "WITHDRAW") == 0 || strcmp(cmd.arg, "DEPOSIT") == 0) {
+                strcpy(cmd.txn_id, txid);
+                cmd.type = CMD_PREPARE;
+            }
+        }
+    }
+    else if (strcmp(cmd_name, "COMMIT") == 0 || strcmp(cmd_name, "ABORT") == 0) {
+        // COMMIT|ABORT <txid> <id>: the prepared account routes it like any
+        // other single-account command
+        if (sscanf(buffer, "%*s %32s %d", cmd.txn_id, &cmd.account_id) == 2) {
+            cmd.type = (cmd_name[0] == 'C') ? CMD_COMMIT : CMD_ABORT;
+        }
+    }
     else if (strcmp(cmd_name, "BALANCE_ALL") == 0) {
         cmd.type = CMD_BALANCE_ALL;
     }
@@ -115,13 +230,56 @@ ParsedCommand parse_command(const char *input) {
     else if (strcmp(cmd_name, "MODE_MULTI") == 0) {
         cmd.type = CMD_MODE_MULTI;
     }
+    else if (strcmp(cmd_name, "PROMOTE") == 0) {
+        cmd.type = CMD_PROMOTE;
+    }
+    else if (strcmp(cmd_name, "MODE_HYBRID") == 0) {
+        cmd.type = CMD_MODE_HYBRID;
+    }
     else if (strcmp(cmd_name, "MODE_STATUS") == 0) {
         cmd.type = CMD_MODE_STATUS;
     }
+    else if (strcmp(cmd_name, "STATS") == 0) {
+        cmd.type = CMD_STATS;
+    }
+    else if (strcmp(cmd_name, "CONTENTION") == 0) {
+        cmd.count = CONTENTION_DEFAULT_TOP;
+        sscanf(buffer, "%*s %d", &cmd.count);
+        cmd.type = CMD_CONTENTION;
+    }
+    else if (strcmp(cmd_name, "LOCK_PROFILE") == 0) {
+        // ON, OFF or RESET; without an argument the current state is reported
+        sscanf(buffer, "%*s %15s", cmd.arg);
+        for (int i = 0; cmd.arg[i]; i++) {
+            cmd.arg[i] = toupper(cmd.arg[i]);
+        }
+        cmd.type = CMD_LOCK_PROFILE;
+    }
+    else if (strcmp(cmd_name, "TXMODE") == 0) {
+        // OPTIMISTIC or PESSIMISTIC; without an argument the mode is reported
+        sscanf(buffer, "%*s %15s", cmd.arg);
+        for (int i = 0; cmd.arg[i]; i++) {
+            cmd.arg[i] = toupper(cmd.arg[i]);
+        }
+        cmd.type = CMD_TXMODE;
+    }
+    else if (strcmp(cmd_name, "LOG_LEVEL") == 0) {
+        // Optional level name; without it the current level is reported
+        sscanf(buffer, "%*s %15s", cmd.arg);
+        cmd.type = CMD_LOG_LEVEL;
+    }
     
     return cmd;
 }
 
+void protocol_set_delay_ms(int ms) {
+    simulated_delay_ms = ms;
+}
+
+int protocol_get_delay_ms(void) {
+    return simulated_delay_ms;
+}
+
 // Helper function to get account pointer (declared before use)
 Account* get_account_ptr(int id) {
     if (id < 0 || id >= MAX_ACCOUNTS) return NULL;
@@ -133,74 +291,212 @@ Account* get_account_ptr(int id) {
 extern void server_request_shutdown(void);
 
 // External functions to control threading mode
-extern void server_set_single_threaded(int enabled);
-extern int server_get_single_threaded(void);
+extern void server_request_mode(ExecMode mode);
+extern ExecMode server_get_mode(void);
 
-// Simulate processing delay (database access, validation, etc.)
-static void simulate_processing_delay(void) {
-#if SIMULATED_DELAY_MS > 0
-    usleep(SIMULATED_DELAY_MS * 1000);  // Convert ms to microseconds
-#endif
+// Simulate processing delay (database access, validation, etc.). A request
+// running as a coroutine yields its worker for the duration instead.
+void simulate_processing_delay(void) {
+    if (simulated_delay_ms > 0) {
+        if (coro_active()) {
+            coro_sleep_ms(simulated_delay_ms);
+        } else {
+            usleep(simulated_delay_ms * 1000);  // Convert ms to microseconds
+        }
+    }
+}
+
+// Introspection and control commands answer immediately; everything else
+// pays the simulated processing delay
+static int command_has_delay(CommandType type) {
+    switch (type) {
+        case CMD_INVALID:
+        case CMD_SHUTDOWN:
+        case CMD_LOG_LEVEL:
+        case CMD_STATS:
+        case CMD_CONTENTION:
+        case CMD_LOCK_PROFILE:
+        case CMD_TXMODE:
+        case CMD_COMMIT:   // PREPARE already paid for the work
+        case CMD_ABORT:
+            return 0;
+        default:
+            return 1;
+    }
+}
+
+// Commands whose retry would apply twice; only these honour a request id
+int command_is_mutating(CommandType type) {
+    switch (type) {
+        case CMD_CREATE:
+        case CMD_DEPOSIT:
+        case CMD_WITHDRAW:
+        case CMD_TRANSFER:
+        case CMD_TXN:
+        case CMD_CREATE_ID:
+        case CMD_PREPARE:
+        case CMD_COMMIT:
+        case CMD_ABORT:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Single-account reads, plain deposits and introspection only touch memory
+// under short account locks. A request id could make the call wait for a
+// duplicate in flight, so those go to the pool like everything else.
+int command_is_inline_safe(const ParsedCommand *cmd) {
+    switch (cmd->type) {
+        case CMD_DEPOSIT:
+            return cmd->request_id[0] == '\0';
+        case CMD_BALANCE:
+        case CMD_HISTORY:
+        case CMD_MODE_STATUS:
+        case CMD_STATS:
+        case CMD_CONTENTION:
+        case CMD_LOG_LEVEL:
+        case CMD_INVALID:
+            return 1;
+        default:
+            return 0;
+    }
 }
 
-void execute_command(const char *input, char *response, size_t resp_size) {
+static CommandType run_command(const ParsedCommand *cmd, char *response, size_t resp_size,
+                               int *resp_len, int with_delay, uint64_t exec_start);
+
+CommandType execute_command(const char *input, char *response, size_t resp_size, int *resp_len) {
+    uint64_t parse_start = metrics_phase_start(PHASE_PARSE);
     ParsedCommand cmd = parse_command(input);
+    metrics_phase_end(cmd.type, PHASE_PARSE, parse_start);
+    return run_command(&cmd, response, resp_size, resp_len, 1, metrics_phase_start(PHASE_EXEC));
+}
+
+CommandType execute_command_inline(const ParsedCommand *cmd, char *response, size_t resp_size, int *resp_len) {
+    return run_command(cmd, response, resp_size, resp_len, 0, metrics_phase_start(PHASE_EXEC));
+}
+
+// The hot commands' replies are encoded with their length (see encode.c);
+// len stays -1 for the rest, which are measured once at the end
+static CommandType run_command(const ParsedCommand *cmd, char *response, size_t resp_size,
+                               int *resp_len, int with_delay, uint64_t exec_start) {
+    // A follower's book only changes through the replication stream
+    int len = -1;
+    if (command_is_mutating(cmd->type) && repl_is_read_only()) {
+        len = snprintf(response, resp_size, "READONLY %s -1\n", protocol_command_name(cmd->type));
+        metrics_phase_end(cmd->type, PHASE_EXEC, exec_start);
+        goto done;
+    }
+    
+    // A retried request is answered from the cache, before paying the delay
+    int cache_result = 0;
+    if (cmd->request_id[0] && command_is_mutating(cmd->type)) {
+        DedupResult seen = dedup_begin(cmd, response, resp_size);
+        if (seen == DEDUP_HIT || seen == DEDUP_BUSY || seen == DEDUP_MISMATCH) {
+            len = dedup_reply(seen, cmd->type, response, resp_size);
+            logger_debug("[Protocol] Duplicate request %s not re-executed", cmd->request_id);
+            metrics_phase_end(cmd->type, PHASE_EXEC, exec_start);
+            goto done;
+        }
+        cache_result = (seen == DEDUP_NEW);
+    }
     
     // Simulate real-world processing time for most commands
-    if (cmd.type != CMD_INVALID && cmd.type != CMD_SHUTDOWN) {
+    if (with_delay && command_has_delay(cmd->type)) {
         simulate_processing_delay();
     }
     
-    switch (cmd.type) {
+    switch (cmd->type) {
         case CMD_CREATE: {
-            int new_id = create_account();
+            int new_id = cmd->arg[0] ? create_striped_account() : create_account();
             if (new_id >= 0) {
-                snprintf(response, resp_size, "SUCCESS CREATE %d\n", new_id);
+                len = reply_int(response, resp_size, CMD_CREATE, new_id);
+            } else {
+                len = reply_failure(response, resp_size, CMD_CREATE);
+            }
+            break;
+        }
+        
+        case CMD_CREATE_ID: {
+            if (create_account_with_id(cmd->account_id, cmd->arg[0] != '\0') >= 0) {
+                len = reply_int(response, resp_size, CMD_CREATE_ID, cmd->account_id);
+            } else {
+                len = reply_failure(response, resp_size, CMD_CREATE_ID);
+            }
+            break;
+        }
+        
+        case CMD_PREPARE: {
+            int is_debit = strcmp(cmd->arg, "WITHDRAW") == 0;
+            if (twophase_prepare(cmd->txn_id, is_debit, cmd->account_id, cmd->target_id, cmd->amount) > 0) {
+                len = reply_money(response, resp_size, CMD_PREPARE, peek_balance(cmd->account_id));
             } else {
-                snprintf(response, resp_size, "FAILURE CREATE -1\n");
+                len = reply_failure(response, resp_size, CMD_PREPARE);
+            }
+            break;
+        }
+        
+        case CMD_COMMIT:
+        case CMD_ABORT: {
+            int result = (cmd->type == CMD_COMMIT) ? twophase_commit(cmd->txn_id, cmd->account_id)
+                                                  : twophase_abort(cmd->txn_id, cmd->account_id);
+            if (result > 0) {
+                len = reply_money(response, resp_size, cmd->type, peek_balance(cmd->account_id));
+            } else {
+                len = reply_failure(response, resp_size, cmd->type);
             }
             break;
         }
         
         case CMD_DEPOSIT: {
-            int result = deposit(cmd.account_id, cmd.amount);
+            int result = deposit(cmd->account_id, cmd->amount);
             if (result > 0) {
-                Account *acc = get_account_ptr(cmd.account_id);
-                snprintf(response, resp_size, "SUCCESS DEPOSIT %.2f\n", acc->balance);
+                len = reply_money(response, resp_size, CMD_DEPOSIT, peek_balance(cmd->account_id));
             } else {
-                snprintf(response, resp_size, "FAILURE DEPOSIT -1\n");
+                len = reply_failure(response, resp_size, CMD_DEPOSIT);
             }
             break;
         }
         
         case CMD_WITHDRAW: {
-            int result = withdraw(cmd.account_id, cmd.amount);
+            int result = withdraw(cmd->account_id, cmd->amount);
             if (result > 0) {
-                Account *acc = get_account_ptr(cmd.account_id);
-                snprintf(response, resp_size, "SUCCESS WITHDRAW %.2f\n", acc->balance);
+                len = reply_money(response, resp_size, CMD_WITHDRAW, peek_balance(cmd->account_id));
             } else {
-                snprintf(response, resp_size, "FAILURE WITHDRAW -1\n");
+                len = reply_failure(response, resp_size, CMD_WITHDRAW);
             }
             break;
         }
         
         case CMD_TRANSFER: {
-            int result = transfer(cmd.account_id, cmd.target_id, cmd.amount);
+            int result = transfer(cmd->account_id, cmd->target_id, cmd->amount);
+            if (result > 0) {
+                len = reply_money(response, resp_size, CMD_TRANSFER, peek_balance(cmd->account_id));
+            } else {
+                len = reply_failure(response, resp_size, CMD_TRANSFER);
+            }
+            break;
+        }
+        
+        case CMD_TXN: {
+            // One round trip, one delay and one lock pass for the whole batch
+            int result = execute_batch(cmd->ops, cmd->op_count);
             if (result > 0) {
-                Account *from = get_account_ptr(cmd.account_id);
-                snprintf(response, resp_size, "SUCCESS TRANSFER %.2f\n", from->balance);
+                len = reply_int(response, resp_size, CMD_TXN, cmd->op_count);
             } else {
-                snprintf(response, resp_size, "FAILURE TRANSFER -1\n");
+                len = reply_failure(response, resp_size, CMD_TXN);
             }
             break;
         }
         
         case CMD_BALANCE: {
-            Account *acc = get_account_ptr(cmd.account_id);
+            Account *acc = get_account_ptr(cmd->account_id);
             if (acc) {
-                snprintf(response, resp_size, "SUCCESS BALANCE %.2f\n", acc->balance);
+                // Locked read: folds a striped account's sub-balances consistently
+                len = reply_money(response, resp_size, CMD_BALANCE, get_balance(cmd->account_id));
             } else {
-                snprintf(response, resp_size, "FAILURE BALANCE -1\n");
+                len = reply_failure(response, resp_size, CMD_BALANCE);
             }
             break;
         }
@@ -213,7 +509,7 @@ void execute_command(const char *input, char *response, size_t resp_size) {
                 if (bank[i] != NULL) {
                     found = 1;
                     char line[128];
-                    snprintf(line, sizeof(line), "Account ID %d: $%.2f\n", i, bank[i]->balance);
+                    snprintf(line, sizeof(line), "Account ID %d: $%.2f\n", i, get_balance(i));
                     strncat(response, line, resp_size - strlen(response) - 1);
                 }
             }
@@ -229,24 +525,136 @@ void execute_command(const char *input, char *response, size_t resp_size) {
             break;
         }
         
-        case CMD_MODE_SINGLE: {
-            server_set_single_threaded(1);
-            snprintf(response, resp_size, "SUCCESS MODE_SINGLE\n");
-            printf("[Server] Switched to SINGLE-THREADED mode\n");
+        // The switch is applied by the reactor before it dispatches the next
+        // request, once work already handed to the pool has drained
+        case CMD_MODE_SINGLE:
+        case CMD_MODE_MULTI:
+        case CMD_MODE_HYBRID: {
+            // Partition ownership is fixed at startup; there is no pool to switch
+            if (partition_enabled()) {
+                snprintf(response, resp_size, "FAILURE %s -1\n", protocol_command_name(cmd->type));
+                break;
+            }
+            server_request_mode(cmd->type == CMD_MODE_SINGLE ? EXEC_SINGLE :
+                                cmd->type == CMD_MODE_HYBRID ? EXEC_HYBRID : EXEC_MULTI);
+            snprintf(response, resp_size, "SUCCESS %s\n", protocol_command_name(cmd->type));
             break;
         }
         
-        case CMD_MODE_MULTI: {
-            server_set_single_threaded(0);
-            snprintf(response, resp_size, "SUCCESS MODE_MULTI\n");
-            printf("[Server] Switched to MULTI-THREADED mode\n");
+        case CMD_PROMOTE: {
+            if (repl_promote() < 0) {
+                len = reply_failure(response, resp_size, CMD_PROMOTE);
+            } else {
+                snprintf(response, resp_size, "SUCCESS PROMOTE\n");
+            }
             break;
         }
         
         case CMD_MODE_STATUS: {
-            int is_single = server_get_single_threaded();
+            ExecMode mode = server_get_mode();
             snprintf(response, resp_size, "SUCCESS MODE_STATUS %s\n", 
-                     is_single ? "SINGLE" : "MULTI");
+                     partition_enabled() ? "PARTITIONED" : mode == EXEC_SINGLE ? "SINGLE" :
+                     mode == EXEC_HYBRID ? "HYBRID" : "MULTI");
+            break;
+        }
+        
+        case CMD_HISTORY: {
+            Account *acc = get_account_ptr(cmd->account_id);
+            if (!acc) {
+                snprintf(response, resp_size, "FAILURE HISTORY -1\n");
+                break;
+            }
+            
+            HistoryRecord records[HISTORY_MAX_COUNT];
+            int n = cmd->count;
+            if (n <= 0 || n > HISTORY_MAX_COUNT) n = HISTORY_MAX_COUNT;
+            int found = history_read(acc->history, records, n, cmd->cursor);
+            
+            snprintf(response, resp_size, "SUCCESS HISTORY %d\n", found);
+            for (int i = 0; i < found; i++) {
+                char line[96];
+                int len = snprintf(line, sizeof(line), "#%llu %u %+.2f",
+                                   (unsigned long long)records[i].seq, records[i].time_s,
+                                   records[i].delta);
+                if (records[i].counterparty >= 0) {
+                    snprintf(line + len, sizeof(line) - len, " %s %d\n",
+                             records[i].delta < 0 ? "to" : "from", records[i].counterparty);
+                } else {
+                    snprintf(line + len, sizeof(line) - len, "\n");
+                }
+                strncat(response, line, resp_size - strlen(response) - 1);
+            }
+            break;
+        }
+        
+        case CMD_LOG_LEVEL: {
+            if (cmd->arg[0]) {
+                int level = logger_parse_level(cmd->arg);
+                if (level < 0) {
+                    snprintf(response, resp_size, "FAILURE LOG_LEVEL -1\n");
+                    break;
+                }
+                logger_set_level((LogLevel)level);
+            }
+            snprintf(response, resp_size, "SUCCESS LOG_LEVEL %s\n",
+                     logger_level_name(logger_get_level()));
+            break;
+        }
+        
+        case CMD_STATS: {
+            metrics_format_stats(response, resp_size);
+            break;
+        }
+        
+        case CMD_CONTENTION: {
+            AccountLockReport top[CONTENTION_MAX_TOP];
+            int n = cmd->count;
+            if (n <= 0 || n > CONTENTION_MAX_TOP) n = CONTENTION_MAX_TOP;
+            
+            int found = bank_top_contended(top, n);
+            snprintf(response, resp_size, "SUCCESS CONTENTION %d\n", found);
+            for (int i = 0; i < found; i++) {
+                char line[128];
+                snprintf(line, sizeof(line), "Account ID %d: acquired=%llu contended=%llu wait_us=%llu\n",
+                         top[i].id, (unsigned long long)top[i].acquisitions,
+                         (unsigned long long)top[i].contended,
+                         (unsigned long long)(top[i].wait_ns / 1000));
+                strncat(response, line, resp_size - strlen(response) - 1);
+            }
+            break;
+        }
+        
+        case CMD_TXMODE: {
+            if (strcmp(cmd->arg, "OPTIMISTIC") == 0) {
+                bank_set_transfer_mode(TRANSFER_OPTIMISTIC);
+            } else if (strcmp(cmd->arg, "PESSIMISTIC") == 0) {
+                bank_set_transfer_mode(TRANSFER_PESSIMISTIC);
+            } else if (cmd->arg[0]) {
+                snprintf(response, resp_size, "FAILURE TXMODE -1\n");
+                break;
+            }
+            uint64_t commits, retries, fallbacks;
+            bank_get_occ_stats(&commits, &retries, &fallbacks);
+            snprintf(response, resp_size, "SUCCESS TXMODE %s commits=%llu retries=%llu fallbacks=%llu\n",
+                     bank_get_transfer_mode() == TRANSFER_OPTIMISTIC ? "OPTIMISTIC" : "PESSIMISTIC",
+                     (unsigned long long)commits, (unsigned long long)retries,
+                     (unsigned long long)fallbacks);
+            break;
+        }
+        
+        case CMD_LOCK_PROFILE: {
+            if (strcmp(cmd->arg, "ON") == 0) {
+                bank_set_lock_profiling(1);
+            } else if (strcmp(cmd->arg, "OFF") == 0) {
+                bank_set_lock_profiling(0);
+            } else if (strcmp(cmd->arg, "RESET") == 0) {
+                bank_reset_lock_profile();
+            } else if (cmd->arg[0]) {
+                snprintf(response, resp_size, "FAILURE LOCK_PROFILE -1\n");
+                break;
+            }
+            snprintf(response, resp_size, "SUCCESS LOCK_PROFILE %s\n",
+                     bank_get_lock_profiling() ? "ON" : "OFF");
             break;
         }
         
@@ -254,4 +662,33 @@ void execute_command(const char *input, char *response, size_t resp_size) {
             snprintf(response, resp_size, "FAILURE INVALID -1\n");
             break;
     }
+    
+    if (cache_result) {
+        dedup_finish(cmd->request_id, response);
+    }
+    
+    metrics_phase_end(cmd->type, PHASE_EXEC, exec_start);
+    if (len < 0) len = (int)strlen(response);
+    
+done:
+    len = protocol_frame_reply(cmd->tag, response, resp_size, len);
+    if (resp_len) *resp_len = len;
+    return cmd->type;
+}
+
+int protocol_frame_reply(unsigned int tag, char *response, size_t resp_size, int len) {
+    if (tag == 0) return len;
+    
+    char header[32];
+    int header_len = snprintf(header, sizeof(header), "TAG=%u %d\n", tag, len);
+    if ((size_t)(header_len + len) >= resp_size) {
+        // Truncate the reply, not the header the client frames by (a
+        // shorter length never takes more digits)
+        len = (int)resp_size - 1 - header_len;
+        header_len = snprintf(header, sizeof(header), "TAG=%u %d\n", tag, len);
+    }
+    memmove(response + header_len, response, len);
+    memcpy(response, header, header_len);
+    response[header_len + len] = '\0';
+    return header_len + len;
 }
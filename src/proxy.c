@@ -0,0 +1,1160 @@
+// proxy.c - Consistent-hash routing proxy for sharded servers
+// ============================================================================
+// Spreads one book over several `server` processes. Every account id has
+// an owning shard, found on a hash ring where each shard holds `vnodes`
+// points; the ring is keyed by shard address, so adding a shard to the list
+// would move only about 1/N of the ids instead of nearly all of them.
+//
+// The proxy is a single-threaded epoll loop. It keeps one connection per
+// shard and pipelines every client's requests over it, prefixing each with
+// "TAG=<n>". Shards may answer out of order, so replies come back framed as
+// "TAG=<n> <len>\n<reply>" and are matched to the waiting client by tag.
+// Requests queued for a shard during one loop iteration go out in a single
+// write. A client's own TAG= is kept with its request and frames the
+// reply, since replies reach a client in the order shards finish them.
+// Replies wait in a per-client buffer until the client's socket
+// takes them, and a client that stops reading stops being read from.
+//
+// Clients see global account ids. Each shard stores its accounts in its own
+// bank[] slots, so the proxy numbers the ids every shard owns, in order, and
+// rewrites ids on the way in (and HISTORY counterparties on the way out).
+// The numbering depends only on the shard list and vnodes, so a restarted
+// proxy maps ids the same way, and the cluster holds up to MAX_ACCOUNTS
+// accounts per shard.
+//
+//   CREATE               The proxy picks the next global id and places it
+//                        with CREATE_ID <slot> on the id's owner (a taken
+//                        slot is skipped, so a restarted proxy finds its way
+//                        past existing accounts).
+//   DEPOSIT, WITHDRAW,   Forwarded to the account's owner.
+//   BALANCE, HISTORY
+//   TRANSFER             Forwarded if both accounts share an owner, else
+//                        run as a two-phase commit: PREPARE the debit and
+//                        the credit on their owners, then COMMIT both if
+//                        both agreed, otherwise ABORT what was prepared.
+//   TXN                  Forwarded if one shard owns every account in it,
+//                        otherwise refused.
+//   STATS, SHUTDOWN      Answered by the proxy itself.
+//
+// The proxy keeps no decision log. If it stops between the two phases,
+// the prepared halves stay held on the shards until an operator sends them
+// COMMIT or ABORT; the transaction id is in the proxy's error log.
+// ============================================================================
+
+#define _GNU_SOURCE  // accept4()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "../include/bank.h"        // MAX_ACCOUNTS: slots per shard
+#include "../include/connection.h"  // CONN_MAX_COMMAND
+#include "../include/logger.h"
+
+#define DEFAULT_PORT 9000
+#define DEFAULT_VNODES 128
+#define MAX_SHARDS 64
+#define MAX_EVENTS 1000
+#define MAX_FDS 65536
+#define CLIENT_BUFFER 4096
+#define CLIENT_OUT_MAX (1 << 20)    // Queued reply bytes past which a client's reads pause
+#define INFLIGHT_MAX 65536          // Power of two; tags index the pending table
+#define RECONNECT_INTERVAL_MS 1000  // Between attempts to reach a shard that is down
+#define CONNECT_TIMEOUT_MS 3000     // A connect still pending this long counts as failed
+#define SHARD_EVENT (1ULL << 32)    // epoll data: shard index, not a client fd
+#define ID_SPAN 4                   // Global ids per slot; spares let a shard with a small share fill up
+#define REMOTE_PARTY MAX_ACCOUNTS   // Cross-shard counterparty n is sent as REMOTE_PARTY + n
+
+typedef struct {
+    char host[64];
+    int port;
+    int fd;                   // -1 while disconnected
+    int connecting;           // connect() in progress: requests queue until it completes
+    uint64_t last_attempt_ms;
+    char *out;                // Tagged requests not yet written
+    size_t out_len, out_cap;
+    char *in;                 // Framed replies not yet complete
+    size_t in_len, in_cap;
+} Shard;
+
+typedef struct {
+    uint64_t point;
+    int shard;
+} RingPoint;
+
+typedef struct {
+    char buf[CLIENT_BUFFER];
+    int len;
+    int discarding;   // Skipping the rest of an over-long line
+    char *out;        // Replies not yet written
+    size_t out_len, out_cap;
+    uint32_t events;  // Registered with epoll
+} Client;
+
+// One cross-shard transfer in progress
+typedef struct {
+    int client_fd;
+    uint32_t client_gen;
+    int from_id;
+    int to_id;
+    char amount[32];
+    char txid[32];
+    int waiting;              // Replies outstanding in the current phase
+    int vote[2];              // Debit, credit: 1 prepared, 0 refused, -1 unknown (shard lost)
+    int commit;
+    char from_balance[32];    // From the debit's PREPARE reply
+    unsigned int client_tag;  // The client's TAG=, echoed in the reply frame (0 = none)
+} Transfer;
+
+typedef enum {
+    REQ_FORWARD,   // Relay the reply to the client as-is
+    REQ_HISTORY,   // Relay with counterparties mapped back to global ids
+    REQ_CREATE,    // CREATE_ID of a new global id
+    REQ_PREPARE,   // Phase one of a transfer
+    REQ_DECIDE     // Phase two of a transfer
+} RequestKind;
+
+// A request sent to a shard and not yet answered
+typedef struct {
+    uint32_t tag;        // 0 = slot free
+    RequestKind kind;
+    int shard;
+    int client_fd;
+    uint32_t client_gen; // Reply is dropped if the client has gone since
+    unsigned int client_tag;  // The client's TAG=, echoed in the reply frame (0 = none)
+    char verb[16];       // For the FAILURE reply if the shard goes away
+    int account_id;      // CREATE: id being placed; transfers: this half's account
+    int striped;
+    int half;            // Transfers: 0 debit, 1 credit
+    Transfer *xfer;
+} Pending;
+
+static Shard shards[MAX_SHARDS];
+static int num_shards = 0;
+static RingPoint *ring;
+static int ring_size;
+static int vnodes = DEFAULT_VNODES;
+
+static int *slot_of;        // Global id -> slot on its owner, -1 past the owner's capacity
+static int *global_of;      // shard * MAX_ACCOUNTS + slot -> global id, -1 if unnumbered
+static int global_limit;    // Global ids are [0, global_limit)
+
+static Pending pending[INFLIGHT_MAX];
+static uint32_t next_tag = 0;
+static int in_flight = 0;
+
+static Client *clients[MAX_FDS];
+static uint32_t client_gen[MAX_FDS];   // Bumped on every accept
+
+static int listen_fd = -1;
+static int epoll_fd = -1;
+static int proxy_port = DEFAULT_PORT;
+static volatile sig_atomic_t running = 1;
+
+static int next_global_id = 0;   // Next global id to try for CREATE
+static uint64_t txn_counter = 0;
+static uint64_t forwarded = 0, cross_shard = 0, aborted = 0;
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void signal_handler(int sig) {
+    (void)sig;
+    running = 0;
+}
+
+// ============================================================================
+// Hash ring
+// ============================================================================
+
+// FNV-1a, then a finalizer so nearby strings spread over the ring
+static uint64_t hash_string(const char *s) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// splitmix64: consecutive ids land far apart
+static uint64_t hash_id(int id) {
+    uint64_t x = (uint64_t)id + 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static int compare_points(const void *a, const void *b) {
+    uint64_t pa = ((const RingPoint *)a)->point, pb = ((const RingPoint *)b)->point;
+    return pa < pb ? -1 : pa > pb;
+}
+
+static int build_ring(void) {
+    ring_size = num_shards * vnodes;
+    ring = malloc(sizeof(RingPoint) * ring_size);
+    if (!ring) return -1;
+
+    for (int s = 0; s < num_shards; s++) {
+        for (int v = 0; v < vnodes; v++) {
+            char key[96];
+            snprintf(key, sizeof(key), "%s:%d#%d", shards[s].host, shards[s].port, v);
+            ring[s * vnodes + v].point = hash_string(key);
+            ring[s * vnodes + v].shard = s;
+        }
+    }
+    qsort(ring, ring_size, sizeof(RingPoint), compare_points);
+    return 0;
+}
+
+// Owner of an account: the first ring point at or after the id's hash
+static int shard_for(int account_id) {
+    uint64_t h = hash_id(account_id);
+    int lo = 0, hi = ring_size;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ring[mid].point < h) lo = mid + 1;
+        else hi = mid;
+    }
+    return ring[lo == ring_size ? 0 : lo].shard;
+}
+
+// Number each shard's ids in global order: the k-th id a shard owns lives
+// in its slot k. Ids past a shard's MAX_ACCOUNTS slots are never used.
+static int build_id_map(void) {
+    global_limit = num_shards * MAX_ACCOUNTS * ID_SPAN;
+    slot_of = malloc(sizeof(int) * global_limit);
+    global_of = malloc(sizeof(int) * num_shards * MAX_ACCOUNTS);
+    int *used = calloc(num_shards, sizeof(int));
+    if (!slot_of || !global_of || !used) {
+        free(used);
+        return -1;
+    }
+
+    for (int i = 0; i < num_shards * MAX_ACCOUNTS; i++) {
+        global_of[i] = -1;
+    }
+    for (int id = 0; id < global_limit; id++) {
+        int s = shard_for(id);
+        slot_of[id] = used[s] < MAX_ACCOUNTS ? used[s]++ : -1;
+        if (slot_of[id] >= 0) global_of[s * MAX_ACCOUNTS + slot_of[id]] = id;
+    }
+    free(used);
+    return 0;
+}
+
+// Slot of a global id on its owner, or -1 if it can't exist
+static int slot_for(int account_id) {
+    return (account_id >= 0 && account_id < global_limit) ? slot_of[account_id] : -1;
+}
+
+// ============================================================================
+// Shard connections
+// ============================================================================
+
+static int append(char **buf, size_t *len, size_t *cap, const char *data, size_t n) {
+    if (*len + n > *cap) {
+        size_t want = *cap ? *cap * 2 : 16384;
+        while (want < *len + n) want *= 2;
+        char *grown = realloc(*buf, want);
+        if (!grown) return -1;
+        *buf = grown;
+        *cap = want;
+    }
+    memcpy(*buf + *len, data, n);
+    *len += n;
+    return 0;
+}
+
+static void fail_shard_requests(int s);
+
+static void shard_disconnect(int s, const char *why) {
+    Shard *sh = &shards[s];
+    if (sh->fd < 0) return;
+    logger_error("[Proxy] Lost shard %d (%s:%d): %s", s, sh->host, sh->port, why);
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sh->fd, NULL);
+    close(sh->fd);
+    sh->fd = -1;
+    sh->connecting = 0;
+    sh->out_len = 0;
+    sh->in_len = 0;
+    // No reconnect while its requests are failed (an ABORT sent now would
+    // be failed with them)
+    sh->last_attempt_ms = now_ms();
+    fail_shard_requests(s);
+}
+
+// Start connecting if needed (at most once per RECONNECT_INTERVAL_MS while
+// it fails). The connect never blocks the loop: requests queue on the shard
+// until EPOLLOUT reports the outcome to shard_connected().
+static int shard_connect(int s) {
+    Shard *sh = &shards[s];
+    if (sh->fd >= 0) return 0;
+
+    uint64_t now = now_ms();
+    if (sh->last_attempt_ms && now - sh->last_attempt_ms < RECONNECT_INTERVAL_MS) return -1;
+    sh->last_attempt_ms = now;
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) return -1;
+    if (fd >= MAX_FDS) {
+        close(fd);
+        return -1;
+    }
+    // Requests are already batched per loop iteration; don't delay them further
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(sh->port);
+    inet_pton(AF_INET, sh->host, &addr.sin_addr);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLOUT;
+    ev.data.u64 = SHARD_EVENT | (uint64_t)s;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        close(fd);
+        return -1;
+    }
+    sh->fd = fd;
+    sh->connecting = 1;
+    return 0;
+}
+
+// EPOLLOUT on a connecting shard: the connect finished, one way or the other
+static void shard_connected(int s) {
+    Shard *sh = &shards[s];
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(sh->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) err = errno;
+    if (err) {
+        shard_disconnect(s, strerror(err));
+        return;
+    }
+    sh->connecting = 0;
+    sh->last_attempt_ms = 0;
+    logger_info("[Proxy] Connected to shard %d (%s:%d)", s, sh->host, sh->port);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = SHARD_EVENT | (uint64_t)s;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, sh->fd, &ev);
+}
+
+// Write as much of the shard's queued requests as the socket takes; wait
+// for EPOLLOUT if some is left
+static void shard_flush(int s) {
+    Shard *sh = &shards[s];
+    if (sh->fd < 0 || sh->connecting || sh->out_len == 0) return;
+
+    size_t off = 0;
+    while (off < sh->out_len) {
+        ssize_t n = send(sh->fd, sh->out + off, sh->out_len - off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) break;
+            shard_disconnect(s, strerror(errno));
+            return;
+        }
+        off += (size_t)n;
+    }
+    memmove(sh->out, sh->out + off, sh->out_len - off);
+    sh->out_len -= off;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | (sh->out_len ? EPOLLOUT : 0);
+    ev.data.u64 = SHARD_EVENT | (uint64_t)s;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, sh->fd, &ev);
+}
+
+// ============================================================================
+// Requests in flight
+// ============================================================================
+
+static Pending *pending_alloc(RequestKind kind, int client_fd, unsigned int client_tag, const char *verb) {
+    uint32_t tag = ++next_tag;
+    if (tag == 0) tag = ++next_tag;
+    Pending *p = &pending[tag & (INFLIGHT_MAX - 1)];
+    if (p->tag != 0) return NULL;   // A request INFLIGHT_MAX tags old is still out
+
+    memset(p, 0, sizeof(*p));
+    p->tag = tag;
+    p->kind = kind;
+    p->client_fd = client_fd;
+    p->client_gen = client_fd >= 0 ? client_gen[client_fd] : 0;
+    p->client_tag = client_tag;
+    snprintf(p->verb, sizeof(p->verb), "%s", verb);
+    in_flight++;
+    return p;
+}
+
+static void pending_free(Pending *p) {
+    p->tag = 0;
+    in_flight--;
+}
+
+// Next global id for CREATE whose owner has a slot for it, or -1
+static int take_global_id(void) {
+    while (next_global_id < global_limit) {
+        int id = next_global_id++;
+        if (slot_of[id] >= 0) return id;
+    }
+    return -1;
+}
+
+// Queue "TAG=<n> <command>\n" for shard s. Frees p and returns -1 if the
+// shard can't be reached.
+static int issue(int s, Pending *p, const char *command) {
+    if (shard_connect(s) < 0) {
+        pending_free(p);
+        return -1;
+    }
+    Shard *sh = &shards[s];
+    char line[CONN_MAX_COMMAND + 32];
+    int n = snprintf(line, sizeof(line), "TAG=%u %s\n", p->tag, command);
+    if (append(&sh->out, &sh->out_len, &sh->out_cap, line, (size_t)n) < 0) {
+        pending_free(p);
+        return -1;
+    }
+    p->shard = s;
+    return 0;
+}
+
+// Read while the client's replies are keeping up, and wait for EPOLLOUT
+// while some are queued
+static void client_watch(int fd) {
+    Client *c = clients[fd];
+    uint32_t events = (c->out_len < CLIENT_OUT_MAX ? EPOLLIN : 0) | (c->out_len ? EPOLLOUT : 0);
+    if (events == c->events) return;
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.u64 = (uint64_t)fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+    c->events = events;
+}
+
+// Write as much of the client's queued replies as the socket takes
+static void client_flush(int fd) {
+    Client *c = clients[fd];
+    size_t off = 0;
+    while (off < c->out_len) {
+        ssize_t n = send(fd, c->out + off, c->out_len - off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN) {
+                // The read side sees the connection go and closes it
+                logger_debug("[Proxy] Failed to reply to FD %d: %s", fd, strerror(errno));
+                off = c->out_len;
+            }
+            break;
+        }
+        off += (size_t)n;
+    }
+    memmove(c->out, c->out + off, c->out_len - off);
+    c->out_len -= off;
+    client_watch(fd);
+}
+
+// Queue a reply, framed as "TAG=<n> <len>\n<reply>" like the server's own
+// when the client tagged its request: replies from different shards can
+// arrive in any order
+static void reply_client(int fd, uint32_t gen, unsigned int tag, const char *data, size_t len) {
+    if (fd < 0 || !clients[fd] || client_gen[fd] != gen) return;   // Client has gone
+    Client *c = clients[fd];
+    int was_empty = c->out_len == 0;
+    char header[32];
+    int header_len = tag ? snprintf(header, sizeof(header), "TAG=%u %zu\n", tag, len) : 0;
+    if (append(&c->out, &c->out_len, &c->out_cap, header, (size_t)header_len) < 0 ||
+        append(&c->out, &c->out_len, &c->out_cap, data, len) < 0) {
+        logger_error("[Proxy] No memory to queue a reply to FD %d", fd);
+        return;
+    }
+    // Behind a backlog the socket is full; EPOLLOUT sends the rest in order
+    if (was_empty) client_flush(fd);
+    else client_watch(fd);
+}
+
+static void reply_failure(int fd, uint32_t gen, unsigned int tag, const char *verb) {
+    char line[64];
+    int n = snprintf(line, sizeof(line), "FAILURE %s -1\n", verb);
+    reply_client(fd, gen, tag, line, (size_t)n);
+}
+
+// Phase two: COMMIT both halves if both prepared, else ABORT every half
+// that did or may have
+static void transfer_decide(Transfer *x) {
+    x->commit = (x->vote[0] == 1 && x->vote[1] == 1);
+    x->waiting = 0;
+    int ends[2] = {x->from_id, x->to_id};
+    for (int i = 0; i < 2; i++) {
+        if (x->vote[i] == 0) continue;   // Refused: nothing held there
+        char command[96];
+        snprintf(command, sizeof(command), "%s %s %d", x->commit ? "COMMIT" : "ABORT", x->txid,
+                 slot_for(ends[i]));
+        Pending *p = pending_alloc(REQ_DECIDE, x->client_fd, x->client_tag, "TRANSFER");
+        if (!p) {
+            logger_error("[Proxy] Transfer %s: no slot for %s on account %d (shard %d slot %d), "
+                         "resolve by hand", x->txid, x->commit ? "COMMIT" : "ABORT", ends[i],
+                         shard_for(ends[i]), slot_for(ends[i]));
+            continue;
+        }
+        p->xfer = x;
+        p->account_id = ends[i];
+        p->half = i;
+        if (issue(shard_for(ends[i]), p, command) < 0) {
+            logger_error("[Proxy] Transfer %s: shard %d unreachable, %s slot %d (account %d) by hand",
+                         x->txid, shard_for(ends[i]), x->commit ? "COMMIT" : "ABORT",
+                         slot_for(ends[i]), ends[i]);
+            continue;
+        }
+        x->waiting++;
+    }
+    if (!x->commit) aborted++;
+}
+
+static void transfer_finish(Transfer *x) {
+    if (x->commit) {
+        char line[64];
+        int n = snprintf(line, sizeof(line), "SUCCESS TRANSFER %s\n", x->from_balance);
+        reply_client(x->client_fd, x->client_gen, x->client_tag, line, (size_t)n);
+    } else {
+        reply_failure(x->client_fd, x->client_gen, x->client_tag, "TRANSFER");
+    }
+    free(x);
+}
+
+// Rewrite a shard's HISTORY reply so each counterparty (a slot on that
+// shard, or REMOTE_PARTY + a global id) reads as a global id
+static size_t globalize_history(int shard, const char *reply, size_t len, char *out, size_t size) {
+    size_t used = 0, pos = 0;
+    while (pos < len && used < size) {
+        const char *line = reply + pos;
+        const char *newline = memchr(line, '\n', len - pos);
+        size_t line_len = newline ? (size_t)(newline - line) : len - pos;
+        pos += line_len + (newline ? 1 : 0);
+
+        // "#<seq> <time> <delta> to|from <party>"
+        const char *space = line[0] == '#' ? memrchr(line, ' ', line_len) : NULL;
+        const char *word = space ? memrchr(line, ' ', (size_t)(space - line)) : NULL;
+        int party;
+        if (word && (strncmp(word, " to ", 4) == 0 || strncmp(word, " from ", 6) == 0) &&
+            sscanf(space + 1, "%d", &party) == 1 && party >= 0 &&
+            (party >= REMOTE_PARTY || global_of[shard * MAX_ACCOUNTS + party] >= 0)) {
+            int global = party >= REMOTE_PARTY ? party - REMOTE_PARTY : global_of[shard * MAX_ACCOUNTS + party];
+            used += (size_t)snprintf(out + used, size - used, "%.*s %d%s", (int)(space - line), line,
+                                     global, newline ? "\n" : "");
+        } else {
+            used += (size_t)snprintf(out + used, size - used, "%.*s%s", (int)line_len, line,
+                                     newline ? "\n" : "");
+        }
+    }
+    return used < size ? used : size - 1;
+}
+
+// Handle one reply (or, with ok == -1, the loss of the shard it was on)
+static void on_reply(Pending *p, const char *reply, size_t len, int ok) {
+    Pending req = *p;
+    pending_free(p);
+
+    switch (req.kind) {
+        case REQ_HISTORY:
+            if (ok > 0) {
+                char out[4096];
+                size_t n = globalize_history(req.shard, reply, len, out, sizeof(out));
+                reply_client(req.client_fd, req.client_gen, req.client_tag, out, n);
+                break;
+            }
+            // fall through
+        case REQ_FORWARD:
+            if (ok < 0) reply_failure(req.client_fd, req.client_gen, req.client_tag, req.verb);
+            else reply_client(req.client_fd, req.client_gen, req.client_tag, reply, len);
+            break;
+
+        case REQ_CREATE: {
+            char line[64];
+            if (ok > 0) {
+                int n = snprintf(line, sizeof(line), "SUCCESS CREATE %d\n", req.account_id);
+                reply_client(req.client_fd, req.client_gen, req.client_tag, line, (size_t)n);
+                break;
+            }
+            // FAILURE means the id is taken: try the next one. Anything
+            // else (READONLY, OVERLOADED, a lost shard) goes to the client.
+            if (ok == 0 && len >= 8 && strncmp(reply, "FAILURE ", 8) == 0) {
+                Pending *retry = pending_alloc(REQ_CREATE, req.client_fd, req.client_tag, "CREATE");
+                if (retry && (retry->account_id = take_global_id()) < 0) {
+                    pending_free(retry);
+                    retry = NULL;
+                }
+                if (retry) {
+                    retry->client_gen = req.client_gen;
+                    retry->striped = req.striped;
+                    snprintf(line, sizeof(line), "CREATE_ID %d%s", slot_for(retry->account_id),
+                             req.striped ? " STRIPED" : "");
+                    if (issue(shard_for(retry->account_id), retry, line) == 0) break;
+                }
+            }
+            reply_failure(req.client_fd, req.client_gen, req.client_tag, "CREATE");
+            break;
+        }
+
+        case REQ_PREPARE: {
+            Transfer *x = req.xfer;
+            x->vote[req.half] = ok;
+            if (ok > 0 && req.half == 0) {
+                // "SUCCESS PREPARE <balance>": the source's balance after the debit
+                char line[64];
+                snprintf(line, sizeof(line), "%.*s", (int)(len < sizeof(line) ? len : sizeof(line) - 1), reply);
+                if (sscanf(line, "%*s %*s %31s", x->from_balance) != 1) strcpy(x->from_balance, "0.00");
+            }
+            if (--x->waiting == 0) {
+                transfer_decide(x);
+                if (x->waiting == 0) transfer_finish(x);
+            }
+            break;
+        }
+
+        case REQ_DECIDE: {
+            Transfer *x = req.xfer;
+            // A refused ABORT is fine unless the half had said it prepared
+            if (ok < 0 || (ok == 0 && (x->commit || x->vote[req.half] == 1))) {
+                logger_error("[Proxy] Transfer %s: %s not acknowledged for account %d (shard %d slot %d), "
+                             "resolve by hand", x->txid, x->commit ? "COMMIT" : "ABORT", req.account_id,
+                             req.shard, slot_for(req.account_id));
+            }
+            if (--x->waiting == 0) transfer_finish(x);
+            break;
+        }
+    }
+}
+
+// Every request still waiting on shard s fails
+static void fail_shard_requests(int s) {
+    for (int i = 0; i < INFLIGHT_MAX; i++) {
+        if (pending[i].tag != 0 && pending[i].shard == s) {
+            on_reply(&pending[i], NULL, 0, -1);
+        }
+    }
+}
+
+// Parse "TAG=<n> <len>\n<reply>" frames out of a shard's read buffer
+static void shard_read(int s) {
+    Shard *sh = &shards[s];
+    for (;;) {
+        if (sh->in_cap - sh->in_len < 4096) {
+            size_t want = sh->in_cap ? sh->in_cap * 2 : 16384;
+            char *grown = realloc(sh->in, want);
+            if (!grown) {
+                shard_disconnect(s, "out of memory");
+                return;
+            }
+            sh->in = grown;
+            sh->in_cap = want;
+        }
+        ssize_t n = read(sh->fd, sh->in + sh->in_len, sh->in_cap - sh->in_len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) break;
+        if (n <= 0) {
+            shard_disconnect(s, n == 0 ? "closed by shard" : strerror(errno));
+            return;
+        }
+        sh->in_len += (size_t)n;
+        if ((size_t)n < 4096) break;
+    }
+
+    size_t pos = 0;
+    while (pos < sh->in_len) {
+        char *header = sh->in + pos;
+        char *newline = memchr(header, '\n', sh->in_len - pos);
+        if (!newline) break;
+
+        unsigned int tag;
+        int len;
+        if (sscanf(header, "TAG=%u %d", &tag, &len) != 2 || len < 0) {
+            // Not ours (e.g. a reply to an over-long line): skip it
+            logger_error("[Proxy] Unframed reply from shard %d: %.*s", s,
+                         (int)(newline - header), header);
+            pos = (size_t)(newline + 1 - sh->in);
+            continue;
+        }
+        char *body = newline + 1;
+        if ((size_t)(body - sh->in) + (size_t)len > sh->in_len) break;   // Rest not here yet
+
+        Pending *p = &pending[tag & (INFLIGHT_MAX - 1)];
+        if (p->tag == tag && p->shard == s) {
+            on_reply(p, body, (size_t)len, len >= 8 && strncmp(body, "SUCCESS ", 8) == 0);
+        }
+        pos = (size_t)(body + len - sh->in);
+    }
+    memmove(sh->in, sh->in + pos, sh->in_len - pos);
+    sh->in_len -= pos;
+}
+
+// ============================================================================
+// Client commands
+// ============================================================================
+
+// Split a command line into its options and the command proper. The
+// client's TAG= is taken out into *tag (0 if none): the proxy tags its own
+// requests to the shards and frames the reply with the client's tag.
+// Returns the command.
+static const char *split_options(const char *line, char *options, size_t size, unsigned int *tag) {
+    size_t used = 0;
+    options[0] = '\0';
+    *tag = 0;
+    while (*line) {
+        size_t len = strcspn(line, " \t");
+        const char *eq = memchr(line, '=', len);
+        if (!eq) break;
+        if (eq - line == 3 && strncasecmp(line, "TAG", 3) == 0) {
+            *tag = (unsigned int)strtoul(eq + 1, NULL, 10);
+        } else if (used + len + 2 < size) {
+            memcpy(options + used, line, len);
+            used += len;
+            options[used++] = ' ';
+            options[used] = '\0';
+        }
+        line += len;
+        line += strspn(line, " \t");
+    }
+    return line;
+}
+
+// Copy args to out with its first `count` numbers (global ids) replaced by
+// their slots. Returns the shard owning them, -1 if args starts with no
+// number, -2 if an id can't exist, or -3 if the ids span shards.
+static int localize_ids(const char *args, int count, char *out, size_t size) {
+    int shard = -1;
+    size_t used = 0;
+    out[0] = '\0';
+    for (int i = 0; i < count; i++) {
+        int id, end;
+        if (sscanf(args, " %d%n", &id, &end) != 1) break;
+        if (slot_for(id) < 0) return -2;
+        if (shard >= 0 && shard_for(id) != shard) return -3;
+        shard = shard_for(id);
+        used += (size_t)snprintf(out + used, size - used, " %d", slot_for(id));
+        if (used >= size) return -2;
+        args += end;
+    }
+    snprintf(out + used, size - used, "%s", args);
+    return shard;
+}
+
+// Copy a TXN body to out with every account id replaced by its slot.
+// Returns the shard owning every account, -1 if they span shards, or -2
+// if an id can't exist.
+static int txn_localize(const char *body, char *out, size_t size) {
+    int owner = -1;
+    size_t used = 0;
+    out[0] = '\0';
+    while (*body) {
+        size_t len = strcspn(body, ";");
+        char part[CONN_MAX_COMMAND];
+        snprintf(part, sizeof(part), "%.*s", (int)(len < sizeof(part) ? len : sizeof(part) - 1), body);
+
+        // Malformed ops are copied as they are: let the shard reject them
+        char verb[16], ids[CONN_MAX_COMMAND];
+        int verb_end = 0;
+        int s = -1;
+        if (sscanf(part, " %15s%n", verb, &verb_end) == 1) {
+            s = localize_ids(part + verb_end, strcasecmp(verb, "TRANSFER") == 0 ? 2 : 1, ids, sizeof(ids));
+            if (s == -2) return -2;
+            if (s == -3) return -1;
+        }
+        if (s >= 0) {
+            if (owner >= 0 && s != owner) return -1;
+            owner = s;
+            used += (size_t)snprintf(out + used, size - used, "%s%.*s%s", used ? ";" : "",
+                                     verb_end, part, ids);
+        } else {
+            used += (size_t)snprintf(out + used, size - used, "%s%s", used ? ";" : "", part);
+        }
+        if (used >= size) return -2;
+        body += len;
+        if (*body == ';') body++;
+    }
+    return owner < 0 ? 0 : owner;   // Malformed: let a shard reject it
+}
+
+// Request ids and deadlines aren't passed on: a retried PREPARE answered
+// from a shard's cache would hold nothing under the new transaction id
+static void start_transfer(int fd, unsigned int tag, int from_id, int to_id, const char *amount) {
+    Transfer *x = calloc(1, sizeof(Transfer));
+    if (!x) {
+        reply_failure(fd, client_gen[fd], tag, "TRANSFER");
+        return;
+    }
+    x->client_fd = fd;
+    x->client_gen = client_gen[fd];
+    x->client_tag = tag;
+    x->from_id = from_id;
+    x->to_id = to_id;
+    snprintf(x->amount, sizeof(x->amount), "%s", amount);
+    snprintf(x->txid, sizeof(x->txid), "X%d-%llu", (int)getpid(), (unsigned long long)++txn_counter);
+    cross_shard++;
+
+    // Phase one: both halves at once. The debit holds the funds, the credit
+    // only checks that the destination exists. Each half's history names
+    // the other account by its global id, marked as remote.
+    for (int i = 0; i < 2; i++) {
+        int id = i == 0 ? from_id : to_id;
+        char command[CONN_MAX_COMMAND];
+        snprintf(command, sizeof(command), "PREPARE %s %s %d %s %d", x->txid,
+                 i == 0 ? "WITHDRAW" : "DEPOSIT", slot_for(id), amount,
+                 REMOTE_PARTY + (i == 0 ? to_id : from_id));
+        Pending *p = pending_alloc(REQ_PREPARE, fd, x->client_tag, "TRANSFER");
+        if (!p) continue;   // vote stays 0: nothing sent
+        p->account_id = id;
+        p->half = i;
+        p->xfer = x;
+        if (issue(shard_for(id), p, command) == 0) x->waiting++;
+    }
+    if (x->waiting == 0) {
+        transfer_decide(x);
+        if (x->waiting == 0) transfer_finish(x);
+    }
+}
+
+static void handle_command(int fd, const char *line) {
+    char options[CONN_MAX_COMMAND];
+    unsigned int tag;
+    const char *command = split_options(line, options, sizeof(options), &tag);
+
+    char verb[16] = {0};
+    sscanf(command, "%15s", verb);
+    for (int i = 0; verb[i]; i++) {
+        verb[i] = toupper(verb[i]);
+    }
+    const char *args = command + strcspn(command, " \t");
+
+    char forward[CONN_MAX_COMMAND * 3];  // Options and command share one line; slots never outgrow ids
+
+    int id = -1, target = -1;
+    char amount[32];
+
+    if (strcmp(verb, "CREATE") == 0) {
+        char kind[16] = {0};
+        sscanf(args, "%15s", kind);
+        int striped = strcasecmp(kind, "STRIPED") == 0;
+        Pending *p = (kind[0] == '\0' || striped) ? pending_alloc(REQ_CREATE, fd, tag, "CREATE") : NULL;
+        if (p && (p->account_id = take_global_id()) < 0) {
+            pending_free(p);
+            p = NULL;
+        }
+        if (!p) {
+            reply_failure(fd, client_gen[fd], tag, "CREATE");
+            return;
+        }
+        p->striped = striped;
+        // Like transfers, no request id: a retry would get a fresh global id anyway
+        snprintf(forward, sizeof(forward), "CREATE_ID %d%s", slot_for(p->account_id),
+                 striped ? " STRIPED" : "");
+        if (issue(shard_for(p->account_id), p, forward) < 0) {
+            reply_failure(fd, client_gen[fd], tag, "CREATE");
+        }
+        return;
+    }
+
+    if (strcmp(verb, "TRANSFER") == 0 && sscanf(args, "%d %d %31s", &id, &target, amount) == 3 &&
+        slot_for(id) >= 0 && slot_for(target) >= 0 && id != target && shard_for(id) != shard_for(target)) {
+        start_transfer(fd, tag, id, target, amount);
+        return;
+    }
+
+    // Forwarded commands carry slots in place of global ids
+    int shard;
+    char local_args[CONN_MAX_COMMAND];
+    if (strcmp(verb, "DEPOSIT") == 0 || strcmp(verb, "WITHDRAW") == 0 ||
+        strcmp(verb, "TRANSFER") == 0 || strcmp(verb, "BALANCE") == 0 ||
+        strcmp(verb, "HISTORY") == 0) {
+        shard = localize_ids(args, strcmp(verb, "TRANSFER") == 0 ? 2 : 1, local_args, sizeof(local_args));
+        if (shard < 0) {
+            reply_failure(fd, client_gen[fd], tag, verb);
+            return;
+        }
+    } else if (strcmp(verb, "TXN") == 0) {
+        shard = txn_localize(args, local_args, sizeof(local_args));
+        if (shard < 0) {
+            // Multi-shard batches would need the prepare/commit path per op
+            reply_failure(fd, client_gen[fd], tag, "TXN");
+            return;
+        }
+    } else if (strcmp(verb, "STATS") == 0) {
+        int connected = 0;
+        for (int s = 0; s < num_shards; s++) connected += shards[s].fd >= 0 && !shards[s].connecting;
+        char line_out[256];
+        int n = snprintf(line_out, sizeof(line_out),
+                         "SUCCESS STATS shards=%d connected=%d forwarded=%llu cross_shard=%llu "
+                         "aborted=%llu in_flight=%d\n", num_shards, connected,
+                         (unsigned long long)forwarded, (unsigned long long)cross_shard,
+                         (unsigned long long)aborted, in_flight);
+        reply_client(fd, client_gen[fd], tag, line_out, (size_t)n);
+        return;
+    } else if (strcmp(verb, "SHUTDOWN") == 0) {
+        reply_client(fd, client_gen[fd], tag, "SUCCESS SHUTDOWN\n", 17);
+        running = 0;
+        return;
+    } else {
+        // Per-server controls (MODE_*, LOG_LEVEL, ...) go to the shards directly
+        reply_failure(fd, client_gen[fd], tag, verb[0] ? verb : "INVALID");
+        return;
+    }
+
+    snprintf(forward, sizeof(forward), "%s%.*s%s", options, (int)(args - command), command, local_args);
+    Pending *p = pending_alloc(strcmp(verb, "HISTORY") == 0 ? REQ_HISTORY : REQ_FORWARD, fd, tag, verb);
+    if (!p) {
+        char line_out[64];
+        int n = snprintf(line_out, sizeof(line_out), "OVERLOADED %s -1\n", verb);
+        reply_client(fd, client_gen[fd], tag, line_out, (size_t)n);
+        return;
+    }
+    if (issue(shard, p, forward) < 0) {
+        reply_failure(fd, client_gen[fd], tag, verb);
+        return;
+    }
+    forwarded++;
+}
+
+static void close_client(int fd) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    free(clients[fd]->out);
+    free(clients[fd]);
+    clients[fd] = NULL;
+}
+
+static void handle_client(int fd) {
+    Client *c = clients[fd];
+    int n = read(fd, c->buf + c->len, CLIENT_BUFFER - 1 - c->len);
+    if (n <= 0) {
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) return;
+        logger_info("[Proxy] Client FD %d disconnected", fd);
+        close_client(fd);
+        return;
+    }
+    c->len += n;
+    c->buf[c->len] = '\0';
+
+    char *line = c->buf;
+    char *newline;
+    while ((newline = strchr(line, '\n')) != NULL) {
+        *newline = '\0';
+        if (newline > line && newline[-1] == '\r') newline[-1] = '\0';
+        if (c->discarding) {
+            c->discarding = 0;
+        } else if (newline - line >= CONN_MAX_COMMAND) {
+            reply_failure(fd, client_gen[fd], 0, "INVALID");
+        } else if (*line) {
+            handle_command(fd, line);
+        }
+        line = newline + 1;
+    }
+
+    int rest = c->len - (int)(line - c->buf);
+    if (rest >= CONN_MAX_COMMAND - 1) {
+        if (!c->discarding) reply_failure(fd, client_gen[fd], 0, "INVALID");
+        c->discarding = 1;
+        rest = 0;
+    }
+    memmove(c->buf, line, rest);
+    c->len = rest;
+}
+
+static void handle_accept(void) {
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EINTR) logger_error("[Proxy] accept: %s", strerror(errno));
+            return;
+        }
+        if (fd >= MAX_FDS || !(clients[fd] = calloc(1, sizeof(Client)))) {
+            close(fd);
+            continue;
+        }
+        client_gen[fd]++;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = (uint64_t)fd;
+        clients[fd]->events = EPOLLIN;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close_client(fd);
+            continue;
+        }
+        logger_info("[Proxy] Client connected on FD %d", fd);
+    }
+}
+
+// ============================================================================
+// Startup
+// ============================================================================
+
+static int listen_init(void) {
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listen_fd < 0) return -1;
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(proxy_port);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 128) < 0) {
+        logger_error("[Proxy] Could not listen on port %d: %s", proxy_port, strerror(errno));
+        return -1;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = (uint64_t)listen_fd;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+}
+
+// "[HOST:]PORT"; the host defaults to 127.0.0.1
+static int add_shard(const char *spec) {
+    if (num_shards == MAX_SHARDS) return -1;
+    Shard *sh = &shards[num_shards];
+    const char *colon = strrchr(spec, ':');
+    snprintf(sh->host, sizeof(sh->host), "%.*s", colon ? (int)(colon - spec) : 9,
+             colon ? spec : "127.0.0.1");
+    sh->port = atoi(colon ? colon + 1 : spec);
+    struct in_addr check;
+    if (sh->port <= 0 || inet_pton(AF_INET, sh->host, &check) != 1) return -1;
+    sh->fd = -1;
+    num_shards++;
+    return 0;
+}
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s --shard [HOST:]PORT [--shard ...] [options]\n", prog);
+    printf("  --port PORT             Listen on PORT (default %d)\n", DEFAULT_PORT);
+    printf("  --shard [HOST:]PORT     A server holding part of the book (repeat per shard;\n");
+    printf("                          keep the list the same for the life of the book)\n");
+    printf("  --vnodes N              Ring points per shard (default %d)\n", DEFAULT_VNODES);
+    printf("  --log-file PATH         Append logs to PATH instead of stdout\n");
+    printf("  --log-level LEVEL       error, info or debug (default info)\n");
+    printf("  --help                  Show this help\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *log_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            proxy_port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--shard") == 0 && i + 1 < argc) {
+            if (add_shard(argv[++i]) < 0) {
+                fprintf(stderr, "Bad or too many shards: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--vnodes") == 0 && i + 1 < argc) {
+            vnodes = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--log-file") == 0 && i + 1 < argc) {
+            log_path = argv[++i];
+        } else if (strcmp(argv[i], "--log-level") == 0 && i + 1 < argc) {
+            int level = logger_parse_level(argv[++i]);
+            if (level < 0) {
+                fprintf(stderr, "Unknown log level: %s\n", argv[i]);
+                return 1;
+            }
+            logger_set_level((LogLevel)level);
+        } else {
+            print_usage(argv[0]);
+            return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+    if (num_shards == 0 || vnodes <= 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    logger_init(log_path);
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0 || build_ring() < 0 || build_id_map() < 0 || listen_init() < 0) {
+        logger_cleanup();
+        return 1;
+    }
+    for (int s = 0; s < num_shards; s++) {
+        if (shard_connect(s) < 0) {
+            logger_error("[Proxy] Shard %d (%s:%d) not reachable yet", s, shards[s].host, shards[s].port);
+        }
+    }
+    logger_info("[Proxy] Listening on port %d, %d shards, %d ring points", proxy_port,
+                num_shards, ring_size);
+
+    struct epoll_event events[MAX_EVENTS];
+    while (running) {
+        int nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, 1000);
+        if (nfds < 0) {
+            if (errno != EINTR) logger_error("[Proxy] epoll_wait: %s", strerror(errno));
+            continue;
+        }
+        for (int i = 0; i < nfds; i++) {
+            uint64_t data = events[i].data.u64;
+            if (data & SHARD_EVENT) {
+                int s = (int)(data & 0xffffffffu);
+                if (shards[s].connecting) {
+                    shard_connected(s);
+                    continue;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) shard_read(s);
+                if (events[i].events & EPOLLOUT) shard_flush(s);
+            } else if ((int)data == listen_fd) {
+                handle_accept();
+            } else if (clients[(int)data]) {
+                int fd = (int)data;
+                if (events[i].events & EPOLLOUT) client_flush(fd);
+                if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) handle_client(fd);
+            }
+        }
+        // Everything queued this iteration goes out in one write per shard
+        uint64_t now = now_ms();
+        for (int s = 0; s < num_shards; s++) {
+            if (shards[s].connecting && now - shards[s].last_attempt_ms >= CONNECT_TIMEOUT_MS) {
+                shard_disconnect(s, "connect timed out");
+            }
+            shard_flush(s);
+        }
+    }
+
+    if (in_flight > 0) {
+        logger_error("[Proxy] Stopping with %d requests in flight", in_flight);
+    }
+    logger_info("[Proxy] Shut down (forwarded=%llu cross_shard=%llu aborted=%llu)",
+                (unsigned long long)forwarded, (unsigned long long)cross_shard,
+                (unsigned long long)aborted);
+    for (int s = 0; s < num_shards; s++) {
+        if (shards[s].fd >= 0) close(shards[s].fd);
+    }
+    close(listen_fd);
+    close(epoll_fd);
+    logger_cleanup();
+    return 0;
+}
@@ -0,0 +1,576 @@
+// replication.c - Primary/follower replication of committed balance changes
+// ============================================================================
+// The primary numbers every committed change with a log sequence number
+// (LSN) and stamps it into a ring of REPL_LOG_SIZE records. Each slot's LSN
+// is written last, so a reader knows whether a slot holds the record it
+// wants, is not written yet, or was already overwritten.
+//
+// A follower connecting to the replication port first gets a snapshot of
+// every account, then the log from just after the snapshot's LSN. Mutations
+// hold a shared lock from before they touch a balance until their record is
+// logged, and the snapshot takes it exclusively. So no change can be in the
+// snapshot and also in the stream. A follower that falls more than the ring
+// behind is disconnected, and it resyncs from a fresh snapshot.
+//
+// The stream is text, one line per item, with balances as hex floats so
+// they copy exactly:
+//   S <lsn> <accounts>                  snapshot header
+//   A <id> <striped> <balance>          one account
+//   R <id> <seq> <delta> <counterparty> <time_s>
+//                                       one history entry of that account
+//   E                                   snapshot end
+//   C <lsn> <id> <striped> <commit_ns>  account created
+//   D <lsn> <id> <delta> <counterparty> <commit_ns>
+//   H <lsn> <now_ns>                    heartbeat while idle
+// ============================================================================
+
+#define _GNU_SOURCE  // PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP
+#include <pthread.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../include/replication.h"
+#include "../include/bank.h"
+#include "../include/history.h"
+#include "../include/logger.h"
+#include "../include/metrics.h"
+
+#define REPL_SEND_BUFFER   65536
+#define REPL_IDLE_SLEEP_US 1000     // Sender poll interval when caught up
+#define REPL_HEARTBEAT_MS  100
+#define REPL_RETRY_MS      1000     // Follower reconnect interval
+#define REPL_SEND_CHECK_MS 200      // How often a blocked send checks for shutdown
+
+typedef enum {
+    REC_CREATE,
+    REC_CHANGE
+} RecordType;
+
+typedef struct {
+    _Atomic uint64_t lsn;   // Stamped last; 0 while the slot is being rewritten
+    uint8_t type;
+    uint8_t striped;
+    int32_t id;
+    int32_t counterparty;
+    double delta;
+    uint64_t commit_ns;     // CLOCK_REALTIME, comparable across processes
+} LogRecord;
+
+typedef enum {
+    ROLE_NONE,
+    ROLE_PRIMARY,
+    ROLE_FOLLOWER
+} ReplRole;
+
+static ReplRole role = ROLE_NONE;
+static int logging = 0;                 // This process keeps a log (serves followers)
+static _Atomic int read_only = 0;
+static _Atomic int repl_running = 0;    // Accept loop and senders
+static _Atomic int following = 0;       // Follower thread
+
+// Primary state
+static LogRecord *log_ring = NULL;
+static _Atomic uint64_t last_lsn = 0;
+static _Atomic int log_epoch = 0;       // Bumped when the book is reloaded; senders resync
+static _Atomic int followers = 0;
+static pthread_mutex_t followers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t followers_gone = PTHREAD_COND_INITIALIZER;  // Last sender exited
+static pthread_rwlock_t snapshot_lock;
+static int listen_fd = -1;
+static pthread_t accept_thread;
+
+// Follower state
+static int primary_port = 0;
+static _Atomic int upstream_fd = -1;
+static pthread_t follow_thread;
+static _Atomic uint64_t applied_lsn = 0;
+static _Atomic uint64_t upstream_lsn = 0;   // Newest LSN the primary has announced
+static _Atomic uint64_t lag_ns = 0;         // Commit-to-apply delay of the last record
+
+static uint64_t realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Gauges for STATS and the Prometheus endpoint
+static void report_status(MetricsReplication *out) {
+    out->role = (role == ROLE_FOLLOWER) ? "follower" : "primary";
+    out->followers = atomic_load(&followers);
+    if (role == ROLE_FOLLOWER) {
+        uint64_t applied = atomic_load(&applied_lsn);
+        uint64_t upstream = atomic_load(&upstream_lsn);
+        out->lsn = applied;
+        out->lag_records = upstream > applied ? upstream - applied : 0;
+        out->lag_seconds = atomic_load(&lag_ns) / 1e9;
+    } else {
+        // A promoted follower that keeps no log of its own is still at the
+        // last change it applied
+        out->lsn = logging ? atomic_load(&last_lsn) : atomic_load(&applied_lsn);
+        out->lag_records = 0;
+        out->lag_seconds = 0.0;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Log
+// ---------------------------------------------------------------------------
+
+void repl_write_begin(void) {
+    if (logging) pthread_rwlock_rdlock(&snapshot_lock);
+}
+
+void repl_write_end(void) {
+    if (logging) pthread_rwlock_unlock(&snapshot_lock);
+}
+
+static void log_append(RecordType type, int id, int striped, double delta, int counterparty) {
+    uint64_t lsn = atomic_fetch_add(&last_lsn, 1) + 1;
+    LogRecord *rec = &log_ring[lsn % REPL_LOG_SIZE];
+
+    atomic_store_explicit(&rec->lsn, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    rec->type = (uint8_t)type;
+    rec->striped = (uint8_t)striped;
+    rec->id = id;
+    rec->counterparty = counterparty;
+    rec->delta = delta;
+    rec->commit_ns = realtime_ns();
+    atomic_store_explicit(&rec->lsn, lsn, memory_order_release);
+}
+
+void repl_log_create(int id, int striped) {
+    if (logging) log_append(REC_CREATE, id, striped, 0.0, -1);
+}
+
+void repl_log_change(int id, double delta, int counterparty) {
+    if (logging) log_append(REC_CHANGE, id, 0, delta, counterparty);
+}
+
+// Copy record `lsn` out of the ring. Returns 1 on success, 0 if it hasn't
+// been stamped yet, -1 if it was overwritten.
+static int log_read(uint64_t lsn, LogRecord *out) {
+    LogRecord *rec = &log_ring[lsn % REPL_LOG_SIZE];
+    uint64_t before = atomic_load_explicit(&rec->lsn, memory_order_acquire);
+    if (before != lsn) {
+        if (before > lsn) return -1;
+        // 0 (mid-write) or an older lap: overwritten if the writer is past us
+        return (atomic_load(&last_lsn) >= lsn + REPL_LOG_SIZE) ? -1 : 0;
+    }
+    out->type = rec->type;
+    out->striped = rec->striped;
+    out->id = rec->id;
+    out->counterparty = rec->counterparty;
+    out->delta = rec->delta;
+    out->commit_ns = rec->commit_ns;
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&rec->lsn, memory_order_relaxed) == lsn ? 1 : -1;
+}
+
+// ---------------------------------------------------------------------------
+// Primary: one sender thread per follower
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    int fd;
+    char buf[REPL_SEND_BUFFER];
+    size_t len;
+} Sender;
+
+static int sender_flush(Sender *s) {
+    size_t off = 0;
+    while (off < s->len) {
+        ssize_t n = send(s->fd, s->buf + off, s->len - off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            // Send timeout: keep waiting on a slow follower unless we are stopping
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && atomic_load(&repl_running)) continue;
+            return -1;
+        }
+        off += (size_t)n;
+    }
+    s->len = 0;
+    return 0;
+}
+
+static int sender_printf(Sender *s, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static int sender_printf(Sender *s, const char *fmt, ...) {
+    if (REPL_SEND_BUFFER - s->len < 128 && sender_flush(s) < 0) return -1;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(s->buf + s->len, REPL_SEND_BUFFER - s->len, fmt, ap);
+    va_end(ap);
+    if (n > 0) s->len += (size_t)n;
+    return 0;
+}
+
+// Write every account, its history, and the LSN they are current as of.
+// Writers are held off only while these are copied into this sender's own
+// arrays, never while a (possibly slow) follower is sent them.
+static int send_snapshot(Sender *s, uint64_t *snapshot_lsn) {
+    double *balances = malloc(sizeof(double) * MAX_ACCOUNTS);
+    int8_t *striped = malloc(MAX_ACCOUNTS);   // -1: no account (ids placed by the shard proxy leave gaps)
+    HistoryRecord *history = malloc(sizeof(HistoryRecord) * HISTORY_DEPTH * MAX_ACCOUNTS);
+    int *history_len = malloc(sizeof(int) * MAX_ACCOUNTS);
+    if (!balances || !striped || !history || !history_len) {
+        free(balances);
+        free(striped);
+        free(history);
+        free(history_len);
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&snapshot_lock);
+    *snapshot_lsn = atomic_load(&last_lsn);
+    pthread_mutex_lock(&bank_state_lock);
+    int count = next_account_id;
+    pthread_mutex_unlock(&bank_state_lock);
+    for (int i = 0; i < count; i++) {
+        // No mutation is in progress, so unlocked reads are consistent
+        striped[i] = bank[i] ? bank[i]->stripes != NULL : -1;
+        balances[i] = bank[i] ? peek_balance(i) : 0.0;
+        history_len[i] = bank[i] ? history_read(bank[i]->history, &history[i * HISTORY_DEPTH],
+                                                HISTORY_DEPTH, 0) : 0;
+    }
+    pthread_rwlock_unlock(&snapshot_lock);
+
+    int rc = sender_printf(s, "S %llu %d\n", (unsigned long long)*snapshot_lsn, count);
+    for (int i = 0; i < count && rc == 0; i++) {
+        if (striped[i] < 0) continue;
+        rc = sender_printf(s, "A %d %d %a\n", i, striped[i], balances[i]);
+        // Oldest first, as they were recorded
+        for (int j = history_len[i] - 1; j >= 0 && rc == 0; j--) {
+            const HistoryRecord *r = &history[i * HISTORY_DEPTH + j];
+            rc = sender_printf(s, "R %d %llu %a %d %u\n", i, (unsigned long long)r->seq,
+                               r->delta, r->counterparty, r->time_s);
+        }
+    }
+    free(balances);
+    free(striped);
+    free(history);
+    free(history_len);
+
+    if (rc == 0) rc = sender_printf(s, "E\n");
+    return rc == 0 ? sender_flush(s) : -1;
+}
+
+// Every sender ends here; repl_stop waits for the last one
+static void follower_exit(void) {
+    pthread_mutex_lock(&followers_lock);
+    if (atomic_fetch_sub(&followers, 1) == 1) pthread_cond_broadcast(&followers_gone);
+    pthread_mutex_unlock(&followers_lock);
+}
+
+static void *sender_thread(void *arg) {
+    Sender *s = malloc(sizeof(Sender));
+    if (!s) {
+        close((int)(intptr_t)arg);
+        follower_exit();
+        return NULL;
+    }
+    s->fd = (int)(intptr_t)arg;
+    s->len = 0;
+
+    int epoch = atomic_load(&log_epoch);
+    uint64_t next;
+    if (send_snapshot(s, &next) < 0) goto done;
+    next++;
+    logger_info("[Repl] Follower on FD %d synced at LSN %llu", s->fd, (unsigned long long)(next - 1));
+
+    uint64_t last_send_ns = metrics_now_ns();
+    while (atomic_load(&repl_running) && atomic_load(&log_epoch) == epoch) {
+        int sent = 0;
+        LogRecord rec;
+        int r;
+        while ((r = log_read(next, &rec)) == 1) {
+            if (rec.type == REC_CREATE) {
+                r = sender_printf(s, "C %llu %d %d %llu\n", (unsigned long long)next, rec.id,
+                                  rec.striped, (unsigned long long)rec.commit_ns);
+            } else {
+                r = sender_printf(s, "D %llu %d %a %d %llu\n", (unsigned long long)next, rec.id,
+                                  rec.delta, rec.counterparty, (unsigned long long)rec.commit_ns);
+            }
+            if (r < 0) goto done;
+            next++;
+            sent = 1;
+        }
+        if (r < 0) {
+            logger_error("[Repl] Follower on FD %d fell more than %d records behind, resyncing",
+                         s->fd, REPL_LOG_SIZE);
+            goto done;
+        }
+
+        uint64_t now = metrics_now_ns();
+        if (!sent && now - last_send_ns >= REPL_HEARTBEAT_MS * 1000000ULL) {
+            if (sender_printf(s, "H %llu %llu\n", (unsigned long long)(next - 1),
+                              (unsigned long long)realtime_ns()) < 0) goto done;
+            sent = 1;
+        }
+        if (sent) {
+            if (sender_flush(s) < 0) goto done;
+            last_send_ns = now;
+        } else {
+            usleep(REPL_IDLE_SLEEP_US);
+        }
+    }
+
+done:
+    logger_info("[Repl] Follower on FD %d disconnected", s->fd);
+    close(s->fd);
+    free(s);
+    follower_exit();
+    return NULL;
+}
+
+static void *accept_loop(void *arg) {
+    (void)arg;
+    while (atomic_load(&repl_running)) {
+        struct pollfd pfd = { .fd = listen_fd, .events = POLLIN };
+        if (poll(&pfd, 1, 500) <= 0) continue;
+
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) continue;
+        // A follower that stops reading must not pin its sender past repl_stop
+        struct timeval tv = { 0, REPL_SEND_CHECK_MS * 1000 };
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+        pthread_t tid;
+        atomic_fetch_add(&followers, 1);
+        if (pthread_create(&tid, NULL, sender_thread, (void *)(intptr_t)fd) != 0) {
+            follower_exit();
+            close(fd);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+    return NULL;
+}
+
+int repl_start_primary(int port) {
+    log_ring = calloc(REPL_LOG_SIZE, sizeof(LogRecord));
+    if (!log_ring) return -1;
+
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    // Without writer preference a steady stream of mutations starves snapshots
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&snapshot_lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) return -1;
+    int opt = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 8) < 0) {
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+
+    logging = 1;
+    if (role == ROLE_NONE) role = ROLE_PRIMARY;
+    atomic_store(&repl_running, 1);
+    metrics_set_replication_source(report_status);
+    pthread_create(&accept_thread, NULL, accept_loop, NULL);
+    logger_info("[Repl] Serving followers on 127.0.0.1:%d", port);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Follower
+// ---------------------------------------------------------------------------
+
+static int connect_upstream(void) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(primary_port);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Apply one line of the stream; -1 ends the session (the caller resyncs)
+static int apply_line(char *line) {
+    unsigned long long lsn, ts;
+    int id, striped, counterparty, count;
+    double value;
+
+    switch (line[0]) {
+        case 'S':
+            if (sscanf(line, "S %llu %d", &lsn, &count) != 2) return -1;
+            atomic_store(&applied_lsn, lsn);
+            atomic_store(&upstream_lsn, lsn);
+            return 0;
+
+        case 'A':
+            if (sscanf(line, "A %d %d %la", &id, &striped, &value) != 3) return -1;
+            if (!get_account(id) && bank_replica_create(id, striped) < 0) {
+                logger_error("[Repl] Snapshot account %d does not match the local book", id);
+                return -1;
+            }
+            // A resync replaces whatever history the account had
+            history_clear(get_account(id)->history);
+            return bank_replica_set_balance(id, value);
+
+        case 'R': {
+            unsigned long long seq;
+            unsigned int time_s;
+            if (sscanf(line, "R %d %llu %la %d %u", &id, &seq, &value, &counterparty, &time_s) != 5) {
+                return -1;
+            }
+            Account *acc = get_account(id);
+            if (!acc) return -1;
+            HistoryRecord r = { seq, value, counterparty, time_s };
+            history_restore(acc->history, &r);
+            return 0;
+        }
+
+        case 'E':
+            // Anyone following us was synced to the book we just replaced
+            atomic_fetch_add(&log_epoch, 1);
+            logger_info("[Repl] Synced with primary at LSN %llu",
+                        (unsigned long long)atomic_load(&applied_lsn));
+            return 0;
+
+        case 'C':
+        case 'D':
+            if (line[0] == 'C') {
+                if (sscanf(line, "C %llu %d %d %llu", &lsn, &id, &striped, &ts) != 4) return -1;
+            } else if (sscanf(line, "D %llu %d %la %d %llu", &lsn, &id, &value, &counterparty, &ts) != 5) {
+                return -1;
+            }
+            if (lsn != atomic_load(&applied_lsn) + 1) {
+                logger_error("[Repl] Expected LSN %llu, got %llu",
+                             (unsigned long long)atomic_load(&applied_lsn) + 1, lsn);
+                return -1;
+            }
+            if ((line[0] == 'C' ? bank_replica_create(id, striped)
+                                : bank_replica_apply(id, value, counterparty)) < 0) {
+                logger_error("[Repl] Could not apply LSN %llu", lsn);
+                return -1;
+            }
+            atomic_store(&applied_lsn, lsn);
+            if (lsn > atomic_load(&upstream_lsn)) atomic_store(&upstream_lsn, lsn);
+            uint64_t now = realtime_ns();
+            atomic_store(&lag_ns, now > ts ? now - ts : 0);
+            return 0;
+
+        case 'H':
+            if (sscanf(line, "H %llu %llu", &lsn, &ts) != 2) return -1;
+            atomic_store(&upstream_lsn, lsn);
+            if (atomic_load(&applied_lsn) >= lsn) atomic_store(&lag_ns, 0);
+            return 0;
+
+        default:
+            return -1;
+    }
+}
+
+static void *follow_loop(void *arg) {
+    (void)arg;
+    char line[256];
+
+    while (atomic_load(&following)) {
+        int fd = connect_upstream();
+        if (fd < 0) {
+            usleep(REPL_RETRY_MS * 1000);
+            continue;
+        }
+        atomic_store(&upstream_fd, fd);
+        logger_info("[Repl] Connected to primary on port %d", primary_port);
+
+        FILE *in = fdopen(fd, "r");
+        while (in && fgets(line, sizeof(line), in)) {
+            if (apply_line(line) < 0) break;
+        }
+
+        atomic_store(&upstream_fd, -1);
+        if (in) fclose(in);
+        else close(fd);
+        if (atomic_load(&following)) {
+            logger_error("[Repl] Lost primary stream at LSN %llu, reconnecting",
+                         (unsigned long long)atomic_load(&applied_lsn));
+            usleep(REPL_RETRY_MS * 1000);
+        }
+    }
+    return NULL;
+}
+
+int repl_start_follower(int port) {
+    primary_port = port;
+    role = ROLE_FOLLOWER;
+    atomic_store(&read_only, 1);
+    atomic_store(&following, 1);
+    metrics_set_replication_source(report_status);
+    if (pthread_create(&follow_thread, NULL, follow_loop, NULL) != 0) return -1;
+    logger_info("[Repl] Following primary on 127.0.0.1:%d (read-only)", port);
+    return 0;
+}
+
+// Stop applying the primary's stream. Concurrent PROMOTEs (and shutdown)
+// race here; only the caller that clears `following` joins the thread,
+// and the others get -1.
+static int stop_following(void) {
+    if (!atomic_exchange(&following, 0)) return -1;
+    int fd = atomic_exchange(&upstream_fd, -1);
+    if (fd >= 0) shutdown(fd, SHUT_RDWR);   // Unblocks the reader
+    pthread_join(follow_thread, NULL);
+    return 0;
+}
+
+// Start accepting writes. read_only is only cleared once the follower
+// thread has stopped, so no replicated change lands after a local write.
+int repl_promote(void) {
+    if (role != ROLE_FOLLOWER || stop_following() < 0) return -1;
+
+    role = ROLE_PRIMARY;
+    atomic_store(&read_only, 0);
+    logger_info("[Repl] Promoted to primary at LSN %llu",
+                (unsigned long long)atomic_load(&applied_lsn));
+    return 0;
+}
+
+int repl_is_read_only(void) {
+    return atomic_load(&read_only);
+}
+
+void repl_stop(void) {
+    if (role == ROLE_NONE) return;
+    atomic_store(&repl_running, 0);
+
+    stop_following();
+    if (listen_fd >= 0) {
+        pthread_join(accept_thread, NULL);
+        close(listen_fd);
+        listen_fd = -1;
+        // Senders notice within one idle sleep or send timeout. No new
+        // ones start once the accept thread is joined.
+        pthread_mutex_lock(&followers_lock);
+        while (atomic_load(&followers) > 0) {
+            pthread_cond_wait(&followers_gone, &followers_lock);
+        }
+        pthread_mutex_unlock(&followers_lock);
+    }
+}
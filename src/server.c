@@ -1,3 +1,4 @@
+#define _GNU_SOURCE  // accept4()
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,45 +8,112 @@
 #include <sys/epoll.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <stddef.h>
 #include <signal.h>
+#include <errno.h>
+#include <sys/resource.h>
+#include <stdatomic.h>
 
 #include "../include/bank.h"
+#include "../include/protocol.h"
+#include "../include/thread_pool.h"
+#include "../include/partition.h"
+#include "../include/dedup.h"
+#include "../include/connection.h"
+#include "../include/affinity.h"
+#include "../include/buffer.h"
+#include "../include/coro.h"
+#include "../include/replication.h"
+#include "../include/trace.h"
+#include "../include/logger.h"
+#include "../include/metrics.h"
 
-#define SERVER_PORT 8080
+#define DEFAULT_PORT 8080
 #define MAX_EVENTS 1000
 #define BUFFER_SIZE 1024
-
-// External functions from thread_pool.c
-extern void thread_pool_init(int num_workers);
-extern int submit_task(int client_fd, const char *command);
-extern void thread_pool_shutdown();
-
-// External function from protocol.c (for single-threaded mode)
-extern void execute_command(const char *input, char *response, size_t resp_size);
+#define CONN_TABLE_MAX (1 << 20)  // Cap when the file limit is unlimited
+#define DEFAULT_BACKLOG 128
+#define ACCEPT_BATCH 64           // Accepts per wakeup in level-triggered mode
+#define DEFAULT_WORKERS 10
+#define DEFAULT_TRACE_FILE "bank.trace"
 
 // External functions from transactions.c
 extern void init_bank();
 
 static int server_fd;
+static int unix_fd = -1;             // Optional AF_UNIX listener (--unix)
 static int epoll_fd;
 volatile int running = 1;
 
-// Runtime threading mode (set via command-line argument)
-static int single_threaded_mode = 0;  // Default: multi-threaded
+// Out of file descriptors, accept() fails and leaves the connection in the
+// backlog. The reserve fd is given up to accept and close it instead. If
+// even that fails, an edge-triggered listener gets no new edge for what's
+// left, so the reactor retries from its tick.
+static int reserve_fd = -1;
+static int accept_stalled = 0;
+
+// Socket options (set via command-line arguments)
+static int edge_triggered = 0;       // EPOLLET on every fd, drain to EAGAIN
+static int listen_backlog = DEFAULT_BACKLOG;
+static int server_port = DEFAULT_PORT;
+static const char *unix_path = NULL; // "@name" binds in the abstract namespace
+
+// Thread pool size; with coroutines, one worker per online CPU is enough
+static int pool_workers = DEFAULT_WORKERS;
+static int coros_per_worker = 0;
+
+// Runtime threading mode (set via command-line argument or MODE_* commands).
+// Only the reactor changes exec_mode; a MODE_* command just records the mode
+// it asked for, and the reactor switches before dispatching the next request.
+static _Atomic int exec_mode = EXEC_MULTI;      // Default: multi-threaded
+static _Atomic int requested_mode = -1;         // Pending switch, -1 = none
 
 // Functions to get/set threading mode (called from protocol.c)
-void server_set_single_threaded(int enabled) {
-    single_threaded_mode = enabled;
+void server_request_mode(ExecMode mode) {
+    atomic_store(&requested_mode, (int)mode);
+}
+
+// The mode being switched to if a switch is pending, else the current one
+ExecMode server_get_mode(void) {
+    int pending = atomic_load(&requested_mode);
+    return (ExecMode)(pending >= 0 ? pending : atomic_load(&exec_mode));
+}
+
+static const char *exec_mode_name(int mode) {
+    return mode == EXEC_SINGLE ? "SINGLE-THREADED" : mode == EXEC_HYBRID ? "HYBRID" : "MULTI-THREADED";
 }
 
-int server_get_single_threaded(void) {
-    return single_threaded_mode;
+// Apply a pending MODE_* switch (reactor thread only). Anything that moves
+// execution onto the reactor first waits for the pool to answer what it was
+// already given, so no request runs concurrently with or ahead of one the
+// client sent earlier. The pool is started on first use if the server came
+// up in single-threaded mode.
+static void apply_mode_change(void) {
+    int mode = atomic_exchange(&requested_mode, -1);
+    if (mode < 0 || mode == atomic_load(&exec_mode)) return;
+    
+    if (mode == EXEC_MULTI || mode == EXEC_HYBRID) {
+        if (!thread_pool_running()) {
+            thread_pool_init(pool_workers);
+        }
+    }
+    if (mode == EXEC_SINGLE || mode == EXEC_HYBRID) {
+        uint64_t start = metrics_now_ns();
+        thread_pool_drain();
+        logger_info("[Server] Drained thread pool in %.2f ms",
+                    (metrics_now_ns() - start) / 1e6);
+    }
+    
+    atomic_store(&exec_mode, mode);
+    logger_info("[Server] Switched to %s mode", exec_mode_name(mode));
 }
 
 // External hook for protocol to request shutdown
 void server_request_shutdown(void) {
     running = 0;
-    printf("[Server] Shutdown requested\n");
+    logger_info("[Server] Shutdown requested");
 }
 
 // Set socket to non-blocking mode
@@ -66,7 +134,7 @@ void signal_handler(int sig) {
 int server_init() {
     server_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (server_fd < 0) {
-        perror("socket");
+        logger_error("[Server] socket: %s", strerror(errno));
         return -1;
     }
     
@@ -77,21 +145,75 @@ int server_init() {
     struct sockaddr_in addr;
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port = htons(SERVER_PORT);
+    addr.sin_port = htons(server_port);
     
     if (bind(server_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        perror("bind");
+        logger_error("[Server] bind: %s", strerror(errno));
         return -1;
     }
     
-    if (listen(server_fd, 128) < 0) {
-        perror("listen");
+    if (listen(server_fd, listen_backlog) < 0) {
+        logger_error("[Server] listen: %s", strerror(errno));
         return -1;
     }
     
     set_nonblocking(server_fd);
-    printf("[Server] Listening on port %d\n", SERVER_PORT);
+    logger_info("[Server] Listening on port %d (backlog %d, %s-triggered epoll)", server_port,
+                listen_backlog, edge_triggered ? "edge" : "level");
+    
+    return 0;
+}
+
+// Fill in the AF_UNIX address for unix_path; returns its length or -1.
+// A leading '@' selects the Linux abstract namespace: no file is created,
+// and the name disappears with the last socket bound to it.
+static socklen_t unix_address(struct sockaddr_un *addr) {
+    size_t len = strlen(unix_path);
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (len == 0 || len >= sizeof(addr->sun_path)) return (socklen_t)-1;
     
+    memcpy(addr->sun_path, unix_path, len);
+    if (unix_path[0] == '@') {
+        addr->sun_path[0] = '\0';
+        return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len);
+    }
+    return (socklen_t)sizeof(*addr);
+}
+
+// Listen on unix_path as well as the TCP port. Co-located clients skip the
+// loopback TCP stack (no checksums, segmentation, ACKs or Nagle).
+int unix_init() {
+    struct sockaddr_un addr;
+    socklen_t addrlen = unix_address(&addr);
+    if (addrlen == (socklen_t)-1) {
+        logger_error("[Server] Unix socket path too long: %s", unix_path);
+        return -1;
+    }
+    
+    // A socket file left by a server that didn't exit cleanly blocks bind;
+    // only ever remove a socket, never some other file at that path
+    struct stat st;
+    if (unix_path[0] != '@' && stat(unix_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(unix_path);
+    }
+    
+    unix_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (unix_fd < 0) {
+        logger_error("[Server] socket(AF_UNIX): %s", strerror(errno));
+        return -1;
+    }
+    if (bind(unix_fd, (struct sockaddr *)&addr, addrlen) < 0) {
+        logger_error("[Server] bind %s: %s", unix_path, strerror(errno));
+        return -1;
+    }
+    if (listen(unix_fd, listen_backlog) < 0) {
+        logger_error("[Server] listen %s: %s", unix_path, strerror(errno));
+        return -1;
+    }
+    
+    set_nonblocking(unix_fd);
+    logger_info("[Server] Listening on Unix socket %s", unix_path);
     return 0;
 }
 
@@ -99,77 +221,302 @@ int server_init() {
 int epoll_init() {
     epoll_fd = epoll_create1(0);
     if (epoll_fd < 0) {
-        perror("epoll_create1");
+        logger_error("[Server] epoll_create1: %s", strerror(errno));
         return -1;
     }
     
     struct epoll_event ev;
-    ev.events = EPOLLIN;
+    ev.events = EPOLLIN | (edge_triggered ? EPOLLET : 0);
     ev.data.fd = server_fd;
     
     if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &ev) < 0) {
-        perror("epoll_ctl");
+        logger_error("[Server] epoll_ctl: %s", strerror(errno));
         return -1;
     }
     
+    if (unix_fd >= 0) {
+        ev.data.fd = unix_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, unix_fd, &ev) < 0) {
+            logger_error("[Server] epoll_ctl: %s", strerror(errno));
+            return -1;
+        }
+    }
+    
     return 0;
 }
 
-// Handle new client connection
-void handle_new_connection() {
-    struct sockaddr_in client_addr;
-    socklen_t addrlen = sizeof(client_addr);
-    
-    int client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &addrlen);
-    if (client_fd < 0) {
-        perror("accept");
+// Register one accepted (already non-blocking) client
+static void register_client(int client_fd, const struct sockaddr_storage *client_addr) {
+    if (!conn_open(client_fd)) {
+        logger_error("[Server] Connection table full (FD %d), rejecting client", client_fd);
+        close(client_fd);
         return;
     }
     
-    set_nonblocking(client_fd);
-    
     struct epoll_event ev;
-    ev.events = EPOLLIN;
+    ev.events = EPOLLIN | (edge_triggered ? EPOLLET : 0);
     ev.data.fd = client_fd;
     
     if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) < 0) {
-        perror("epoll_ctl");
+        logger_error("[Server] epoll_ctl: %s", strerror(errno));
+        conn_close(client_fd);
         close(client_fd);
         return;
     }
     
-    printf("[Server] New client connected: FD %d from %s:%d\n", client_fd,
-           inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+    metrics_connection_opened();
+    if (client_addr->ss_family == AF_INET) {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)client_addr;
+        logger_info("[Server] New client connected: FD %d from %s:%d", client_fd,
+                    inet_ntoa(in->sin_addr), ntohs(in->sin_port));
+    } else {
+        logger_info("[Server] New client connected: FD %d on %s", client_fd, unix_path);
+    }
 }
 
-// Handle incoming data from client
-void handle_client_data(int client_fd) {
-    char buffer[BUFFER_SIZE];
-    int n = read(client_fd, buffer, sizeof(buffer) - 1);
+// Give up the reserve fd to accept one pending connection and close it at
+// once, so the client sees a close instead of hanging in the backlog.
+// Returns 1 if a connection was shed, 0 if the backlog is empty, -1 if
+// there was no fd to do it with.
+static int shed_pending_connection(int listen_fd) {
+    if (reserve_fd < 0) return -1;
+    close(reserve_fd);
     
-    if (n <= 0) {
-        // Connection closed or error
-        printf("[Server] Client FD %d disconnected\n", client_fd);
-        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_fd, NULL);
-        close(client_fd);
-        return;
+    int fd = accept(listen_fd, NULL, NULL);
+    int accept_errno = errno;
+    if (fd >= 0) close(fd);
+    reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    
+    if (fd >= 0) return 1;
+    return accept_errno == EAGAIN ? 0 : -1;
+}
+
+// Handle new client connections. accept4() makes each socket non-blocking in
+// the same syscall, and the loop takes a whole burst per wakeup: everything
+// pending in edge-triggered mode, up to ACCEPT_BATCH otherwise so a storm of
+// connects can't starve clients that are already connected.
+void handle_new_connection(int listen_fd) {
+    int shed = 0;
+    
+    for (int accepted = 0; edge_triggered || accepted < ACCEPT_BATCH; accepted++) {
+        struct sockaddr_storage client_addr;
+        socklen_t addrlen = sizeof(client_addr);
+        
+        int client_fd = accept4(listen_fd, (struct sockaddr *)&client_addr, &addrlen, SOCK_NONBLOCK);
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno == EMFILE || errno == ENFILE) {
+                int result = shed_pending_connection(listen_fd);
+                if (result > 0) {
+                    shed++;
+                    continue;
+                }
+                if (result < 0) accept_stalled = 1;
+                break;
+            }
+            if (errno != EAGAIN) logger_error("[Server] accept: %s", strerror(errno));
+            break;
+        }
+        
+        register_client(client_fd, &client_addr);
     }
     
-    buffer[n] = '\0';
-    printf("[Server] Received from FD %d: %s\n", client_fd, buffer);
+    if (shed > 0) {
+        logger_error("[Server] Out of file descriptors, closed %d pending connection(s)", shed);
+    }
+}
+
+static void release_client(int client_fd) {
+    conn_close(client_fd);
+    close(client_fd);
+}
+
+// Drop a client: unregister, free its table slot, close the socket. If
+// workers still owe it replies, the fd stays open until conn_reap() sees
+// them sent, so a new client can't be given the same number meanwhile.
+static void close_client(int client_fd) {
+    if (conn_closing(client_fd)) return;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_fd, NULL);
+    metrics_connection_closed();
+    if (!conn_defer_close(client_fd)) {
+        release_client(client_fd);
+    }
+}
+
+static void close_idle_client(int client_fd) {
+    logger_info("[Server] Closing idle client FD %d", client_fd);
+    close_client(client_fd);
+}
+
+// Run or queue one complete command line, which lives inside buf
+// Hybrid mode: answer the command on the reactor if it's cheap and can't
+// block, skipping the queue hop and the context switch to a worker.
+// Returns 0 if it has to go to the pool instead. Inline commands skip the
+// simulated processing delay: they stand for work that is cheap enough to
+// do on the event loop.
+static int run_inline(int client_fd, const char *command, int trace) {
+    // An earlier command of this client is still with the pool: answering
+    // now would overtake its reply (and could read state it hasn't written)
+    if (conn_requests_in_flight(client_fd) > 0) {
+        return 0;
+    }
     
-    if (single_threaded_mode) {
+    uint64_t parse_start = metrics_phase_start(PHASE_PARSE);
+    ParsedCommand cmd = parse_command(command);
+    if (!command_is_inline_safe(&cmd)) {
+        return 0;
+    }
+    metrics_phase_end(cmd.type, PHASE_PARSE, parse_start);
+    
+    // Executed from the parse above, so the line is only parsed once
+    char response[BUFFER_SIZE];
+    int len;
+    trace_set_current(trace);
+    CommandType type = execute_command_inline(&cmd, response, sizeof(response), &len);
+    trace_set_current(0);
+    trace_mark(trace, TRACE_EXEC_DONE);
+    uint64_t send_start = metrics_phase_start(PHASE_SEND);
+    send(client_fd, response, len, MSG_NOSIGNAL);
+    metrics_phase_end(type, PHASE_SEND, send_start);
+    trace_end(trace, type);
+    return 1;
+}
+
+// read_ns: when the reactor read the command (0 unless tracing is on)
+static void dispatch_command(int client_fd, Buffer *buf, const char *command, uint64_t read_ns) {
+    logger_info("[Server] Received from FD %d: %s", client_fd, command);
+    
+    apply_mode_change();
+    int mode = atomic_load(&exec_mode);
+    int trace = trace_begin(read_ns);
+    
+    if (partition_enabled()) {
+        // PARTITIONED: Route to the single worker that owns the account
+        conn_request_start(client_fd);
+        partition_submit(client_fd, command, trace);
+    } else if (mode == EXEC_HYBRID && run_inline(client_fd, command, trace)) {
+        // HYBRID: cheap command already answered on the reactor; the
+        // rest still goes to the pool
+    } else if (mode == EXEC_SINGLE) {
         // SINGLE-THREADED: Process request directly in main thread (BLOCKING)
         // This demonstrates sequential processing - each client waits for others
         char response[BUFFER_SIZE];
-        printf("[Server-SingleThread] Processing inline...\n");
-        execute_command(buffer, response, sizeof(response));
-        send(client_fd, response, strlen(response), 0);
-        printf("[Server-SingleThread] Done processing FD %d\n", client_fd);
+        logger_debug("[Server-SingleThread] Processing inline...");
+        int len;
+        trace_set_current(trace);
+        CommandType type = execute_command(command, response, sizeof(response), &len);
+        trace_set_current(0);
+        trace_mark(trace, TRACE_EXEC_DONE);
+        uint64_t send_start = metrics_phase_start(PHASE_SEND);
+        send(client_fd, response, len, MSG_NOSIGNAL);
+        metrics_phase_end(type, PHASE_SEND, send_start);
+        trace_end(trace, type);
+        logger_debug("[Server-SingleThread] Done processing FD %d", client_fd);
     } else {
         // MULTI-THREADED: Submit task to thread pool (NON-BLOCKING)
         // This demonstrates parallel processing - multiple workers handle requests
-        submit_task(client_fd, buffer);
+        // The worker gets a reference to the read buffer, not a copy
+        buffer_ref(buf);
+        conn_request_start(client_fd);
+        if (submit_task(client_fd, buf, command, trace) < 0) {
+            conn_request_done(client_fd);  // Shed: already answered OVERLOADED
+        }
+    }
+}
+
+// Handle incoming data from client. Commands are newline-terminated; a read
+// may carry several of them, or end partway through one, which is kept in
+// the connection's buffer until the rest arrives.
+// Returns 1 after consuming data, 0 when the socket has nothing more to
+// read, and -1 once the client has been closed.
+static int read_client(int client_fd, Connection *conn) {
+    if (!conn->rx && !(conn->rx = buffer_alloc())) {
+        logger_error("[Server] Out of buffers, dropping client FD %d", client_fd);
+        close_client(client_fd);
+        return -1;
+    }
+    Buffer *rx = conn->rx;
+    
+    int n = read(client_fd, rx->data + rx->len, BUFFER_CAPACITY - 1 - rx->len);
+    uint64_t read_ns = trace_enabled() ? metrics_now_ns() : 0;
+    
+    if (n <= 0) {
+        if (n < 0 && errno == EINTR) return 1;
+        if (n < 0 && errno == EAGAIN) return 0;
+        // Connection closed or error
+        logger_info("[Server] Client FD %d disconnected", client_fd);
+        close_client(client_fd);
+        return -1;
+    }
+    
+    conn_touch(conn);
+    conn->bytes_in += n;
+    rx->len += n;
+    rx->data[rx->len] = '\0';
+    
+    // Frame commands in place: each one is NUL-terminated inside rx
+    char *line = rx->data;
+    char *newline;
+    while ((newline = strchr(line, '\n')) != NULL) {
+        *newline = '\0';
+        if (newline > line && newline[-1] == '\r') newline[-1] = '\0';
+        if (conn->discarding) {
+            conn->discarding = 0;  // End of the over-long line
+        } else if (newline - line >= CONN_MAX_COMMAND) {
+            send(client_fd, "FAILURE INVALID -1\n", 19, MSG_NOSIGNAL);
+        } else if (*line) {
+            conn->requests++;
+            dispatch_command(client_fd, rx, line, read_ns);
+        }
+        line = newline + 1;
+    }
+    
+    int rest = rx->len - (int)(line - rx->data);
+    if (rest >= CONN_MAX_COMMAND - 1) {
+        if (!conn->discarding) {
+            logger_error("[Server] Command from FD %d exceeds %d bytes, discarding",
+                         client_fd, CONN_MAX_COMMAND - 1);
+            send(client_fd, "FAILURE INVALID -1\n", 19, MSG_NOSIGNAL);
+            conn->discarding = 1;
+        }
+        rest = 0;
+    }
+    
+    // Keep the unterminated tail for the next read. Workers may still be
+    // reading commands framed in rx, so it's only reused if nobody else
+    // holds it; otherwise the (short) tail moves to a fresh buffer.
+    if (rest == 0) {
+        buffer_release(rx);
+        conn->rx = NULL;
+    } else if (line != rx->data) {
+        if (atomic_load(&rx->refs) == 1) {
+            memmove(rx->data, line, rest);
+        } else {
+            Buffer *fresh = buffer_alloc();
+            if (!fresh) {
+                close_client(client_fd);
+                return -1;
+            }
+            memcpy(fresh->data, line, rest);
+            buffer_release(rx);
+            conn->rx = rx = fresh;
+        }
+        rx->len = rest;
+    }
+    return 1;
+}
+
+void handle_client_data(int client_fd) {
+    Connection *conn = conn_get(client_fd);
+    if (!conn) {
+        close_client(client_fd);
+        return;
+    }
+    
+    // Level-triggered: one read per wakeup, epoll reports the fd again if
+    // more is pending. Edge-triggered: this is the only notification, so
+    // drain the socket until EAGAIN.
+    while (read_client(client_fd, conn) > 0 && edge_triggered) {
     }
 }
 
@@ -179,16 +526,25 @@ void reactor_loop() {
     
     while (running) {
         int nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, 1000);
+        conn_tick(close_idle_client);
+        conn_reap(release_client);
+        apply_mode_change();
+        
+        if (accept_stalled) {
+            accept_stalled = 0;
+            handle_new_connection(server_fd);
+            if (unix_fd >= 0) handle_new_connection(unix_fd);
+        }
         
         if (nfds < 0) {
-            if (running) perror("epoll_wait");
+            if (running && errno != EINTR) logger_error("[Server] epoll_wait: %s", strerror(errno));
             continue;
         }
         
         for (int i = 0; i < nfds; i++) {
-            if (events[i].data.fd == server_fd) {
+            if (events[i].data.fd == server_fd || events[i].data.fd == unix_fd) {
                 // New connection
-                handle_new_connection();
+                handle_new_connection(events[i].data.fd);
             } else {
                 // Data from existing client
                 handle_client_data(events[i].data.fd);
@@ -199,58 +555,284 @@ void reactor_loop() {
 
 // Cleanup resources
 void server_cleanup() {
+    if (reserve_fd >= 0) close(reserve_fd);
     if (epoll_fd >= 0) close(epoll_fd);
     if (server_fd >= 0) close(server_fd);
+    if (unix_fd >= 0) {
+        close(unix_fd);
+        if (unix_path[0] != '@') unlink(unix_path);
+    }
     
-    printf("[Server] Cleanup complete\n");
+    logger_info("[Server] Cleanup complete");
+}
+
+// Fds are table indices, so the table must cover the open file limit. Ask
+// for max_conns (plus headroom for listeners and logs) if it's higher.
+static int connection_table_size(int max_conns) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0) return max_conns > 0 ? max_conns : 1024;
+    
+    if (max_conns > 0 && rl.rlim_cur < (rlim_t)max_conns + 64) {
+        rl.rlim_cur = (rl.rlim_max == RLIM_INFINITY || rl.rlim_max > (rlim_t)max_conns + 64)
+                      ? (rlim_t)max_conns + 64 : rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) < 0) getrlimit(RLIMIT_NOFILE, &rl);
+    }
+    return (rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > CONN_TABLE_MAX) ? CONN_TABLE_MAX : (int)rl.rlim_cur;
+}
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [options]\n", prog);
+    printf("  --port PORT             Client port (default %d)\n", DEFAULT_PORT);
+    printf("  --unix PATH             Also listen on a Unix socket (@name: abstract namespace)\n");
+    printf("  --log-file PATH         Write the log to PATH instead of stdout\n");
+    printf("  --log-level LEVEL       error, info (default) or debug\n");
+    printf("  --metrics-port PORT     Serve Prometheus metrics on 127.0.0.1:PORT\n");
+    printf("  --no-metrics            Don't record latency histograms (to measure their overhead)\n");
+    printf("  --occ                   Use optimistic concurrency control for transfers\n");
+    printf("  --lock-profile          Collect per-account lock contention counters\n");
+    printf("  --lane-weights R,W,B    Thread pool turns for read/write/bulk lanes (default 8,4,1)\n");
+    printf("  --shed-ms MS            Reply OVERLOADED when estimated queue wait exceeds MS\n");
+    printf("  --edge-triggered        Use edge-triggered epoll (drain sockets until EAGAIN)\n");
+    printf("  --backlog N             listen() backlog (default %d)\n", DEFAULT_BACKLOG);
+    printf("  --pin-reactor CPU       Pin the reactor thread to CPU\n");
+    printf("  --pin-workers LIST      Pin workers/partitions round-robin to CPUs, e.g. 2-9,12\n");
+    printf("  --max-conns N           Size of the connection table (default: open file limit)\n");
+    printf("  --idle-timeout S        Close connections idle for S seconds (default: never)\n");
+    printf("  --single                Start in single-threaded mode (no thread pool until MODE_MULTI)\n");
+    printf("  --hybrid                Run cheap commands (BALANCE, DEPOSIT, ...) on the reactor\n");
+    printf("  --coroutines N          Run up to N requests per worker as coroutines, one worker per CPU\n");
+    printf("  --partitions N          Run N single-writer partitions instead of the thread pool\n");
+    printf("  --dedup-ttl-ms MS       How long RID= request ids are remembered (default %d)\n",
+           DEDUP_DEFAULT_TTL_MS);
+    printf("  --repl-port PORT        Stream committed changes to followers on 127.0.0.1:PORT\n");
+    printf("  --follow PORT           Run as a read-only follower of the primary's --repl-port\n");
+    printf("  --trace-sample N        Trace 1 in N requests' stages (see trace_dump)\n");
+    printf("  --trace-file PATH       Trace ring file (default %s)\n", DEFAULT_TRACE_FILE);
+    printf("  --delay-ms MS           Simulated processing delay per request (default %d)\n",
+           protocol_get_delay_ms());
 }
 
 // Main server function
 int main(int argc, char *argv[]) {
-    (void)argc;
-    (void)argv;
+    const char *log_path = NULL;
+    int metrics_port = 0;
+    int num_partitions = 0;
+    int max_conns = 0;
+    int idle_timeout_s = 0;
+    int repl_port = 0;
+    int follow_port = 0;
+    int trace_sample = 0;
+    const char *trace_file = DEFAULT_TRACE_FILE;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            server_port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--unix") == 0 && i + 1 < argc) {
+            unix_path = argv[++i];
+        } else if (strcmp(argv[i], "--log-file") == 0 && i + 1 < argc) {
+            log_path = argv[++i];
+        } else if (strcmp(argv[i], "--log-level") == 0 && i + 1 < argc) {
+            int level = logger_parse_level(argv[++i]);
+            if (level < 0) {
+                fprintf(stderr, "Unknown log level: %s\n", argv[i]);
+                return 1;
+            }
+            logger_set_level((LogLevel)level);
+        } else if (strcmp(argv[i], "--metrics-port") == 0 && i + 1 < argc) {
+            metrics_port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--no-metrics") == 0) {
+            metrics_set_recording(0);
+        } else if (strcmp(argv[i], "--occ") == 0) {
+            bank_set_transfer_mode(TRANSFER_OPTIMISTIC);
+        } else if (strcmp(argv[i], "--lock-profile") == 0) {
+            bank_set_lock_profiling(1);
+        } else if (strcmp(argv[i], "--lane-weights") == 0 && i + 1 < argc) {
+            int r, w, b;
+            if (sscanf(argv[++i], "%d,%d,%d", &r, &w, &b) != 3 || r <= 0 || w <= 0 || b <= 0) {
+                fprintf(stderr, "Lane weights must be three positive integers, e.g. 8,4,1\n");
+                return 1;
+            }
+            thread_pool_set_lane_weights(r, w, b);
+        } else if (strcmp(argv[i], "--shed-ms") == 0 && i + 1 < argc) {
+            thread_pool_set_shed_ms(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--edge-triggered") == 0) {
+            edge_triggered = 1;
+        } else if (strcmp(argv[i], "--backlog") == 0 && i + 1 < argc) {
+            listen_backlog = atoi(argv[++i]);
+            if (listen_backlog <= 0) listen_backlog = DEFAULT_BACKLOG;
+        } else if (strcmp(argv[i], "--pin-reactor") == 0 && i + 1 < argc) {
+            if (affinity_set_reactor_cpu(atoi(argv[++i])) < 0) {
+                fprintf(stderr, "Invalid reactor CPU: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--pin-workers") == 0 && i + 1 < argc) {
+            if (affinity_set_worker_cpus(argv[++i]) < 0) {
+                fprintf(stderr, "Invalid CPU list: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--max-conns") == 0 && i + 1 < argc) {
+            max_conns = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--idle-timeout") == 0 && i + 1 < argc) {
+            idle_timeout_s = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--single") == 0) {
+            exec_mode = EXEC_SINGLE;
+        } else if (strcmp(argv[i], "--hybrid") == 0) {
+            exec_mode = EXEC_HYBRID;
+        } else if (strcmp(argv[i], "--coroutines") == 0 && i + 1 < argc) {
+            coros_per_worker = atoi(argv[++i]);
+            if (coros_per_worker <= 0 || coros_per_worker > CORO_MAX_PER_THREAD) {
+                fprintf(stderr, "Coroutines per worker must be 1..%d\n", CORO_MAX_PER_THREAD);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--partitions") == 0 && i + 1 < argc) {
+            num_partitions = atoi(argv[++i]);
+            if (num_partitions <= 0 || num_partitions > PARTITION_MAX) {
+                fprintf(stderr, "Partitions must be 1..%d\n", PARTITION_MAX);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--dedup-ttl-ms") == 0 && i + 1 < argc) {
+            dedup_set_ttl_ms(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--repl-port") == 0 && i + 1 < argc) {
+            repl_port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--follow") == 0 && i + 1 < argc) {
+            follow_port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--trace-sample") == 0 && i + 1 < argc) {
+            trace_sample = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--trace-file") == 0 && i + 1 < argc) {
+            trace_file = argv[++i];
+        } else if (strcmp(argv[i], "--delay-ms") == 0 && i + 1 < argc) {
+            protocol_set_delay_ms(atoi(argv[++i]));
+        } else {
+            print_usage(argv[0]);
+            return (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) ? 0 : 1;
+        }
+    }
+    
+    // Replicated changes are applied by their own thread, which the
+    // lock-free partitions can't allow
+    if (follow_port > 0 && num_partitions > 0) {
+        fprintf(stderr, "--follow can't be combined with --partitions\n");
+        return 1;
+    }
+    
+    // Waiting requests no longer hold a thread, so more threads than CPUs
+    // would only add context switches
+    if (coros_per_worker > 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        pool_workers = cpus < 1 ? 1 : cpus > DEFAULT_WORKERS ? DEFAULT_WORKERS : (int)cpus;
+        thread_pool_set_coroutines(coros_per_worker);
+    }
     
     signal(SIGINT, signal_handler);
+    // A client that gave up and closed its socket must not take the server
+    // down with it: every reply send passes MSG_NOSIGNAL, and this also
+    // covers any other write to a peer that has gone away
+    signal(SIGPIPE, SIG_IGN);
+    
+    // Hot-path logging goes through per-thread rings drained in the background
+    logger_init(log_path);
+    
+    affinity_report();
     
     // Initialize bank
     init_bank();
-    printf("[Server] Bank initialized\n");
+    logger_info("[Server] Bank initialized");
+    
+    if (trace_init(trace_sample, trace_file) < 0) {
+        logger_cleanup();
+        return 1;
+    }
+    for (int t = 0; t < CMD_COUNT; t++) {
+        trace_name_type(t, protocol_command_name((CommandType)t));
+    }
     
-    // Initialize thread pool (multi-threaded by default)
-    if (!single_threaded_mode) {
-        thread_pool_init(10);
+    if (repl_port > 0 && repl_start_primary(repl_port) < 0) {
+        logger_error("[Server] Could not serve replication on port %d", repl_port);
+        logger_cleanup();
+        return 1;
+    }
+    if (follow_port > 0 && repl_start_follower(follow_port) < 0) {
+        logger_error("[Server] Could not start following port %d", follow_port);
+        logger_cleanup();
+        return 1;
+    }
+    
+    // Initialize thread pool (multi-threaded by default) or the partitions
+    if (num_partitions > 0) {
+        if (partition_init(num_partitions) < 0) {
+            logger_error("[Server] Could not start %d partitions", num_partitions);
+            logger_cleanup();
+            return 1;
+        }
+    } else if (exec_mode != EXEC_SINGLE) {
+        thread_pool_init(pool_workers);
     }
     
     printf("\n============================================\n");
-    if (single_threaded_mode) {
+    if (num_partitions > 0) {
+        printf("  RUNNING IN PARTITIONED MODE\n");
+        printf("  %d single-writer partitions, no account locks\n", num_partitions);
+    } else if (exec_mode == EXEC_SINGLE) {
         printf("  RUNNING IN SINGLE-THREADED MODE (SLOW)\n");
         printf("  All requests processed sequentially\n");
+    } else if (exec_mode == EXEC_HYBRID) {
+        printf("  RUNNING IN HYBRID MODE\n");
+        printf("  Cheap commands inline, %d workers for the rest\n", pool_workers);
     } else {
         printf("  RUNNING IN MULTI-THREADED MODE (FAST)\n");
-        printf("  10 workers processing in parallel\n");
+        printf("  %d workers processing in parallel\n", pool_workers);
+    }
+    if (num_partitions == 0 && coros_per_worker > 0) {
+        printf("  Up to %d requests in flight per worker (coroutines)\n", coros_per_worker);
     }
     printf("============================================\n\n");
     
-    // Initialize server socket
-    if (server_init() < 0) {
+    // Pin the reactor only after the workers exist (they'd inherit its mask),
+    // but before it first touches the connection table
+    affinity_pin_reactor();
+    
+    // Connection table sized for the fds this process may open
+    if (conn_table_init(connection_table_size(max_conns), idle_timeout_s) < 0) {
+        logger_error("[Server] Could not allocate the connection table");
+        logger_cleanup();
+        return 1;
+    }
+    
+    reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    
+    // Initialize server socket(s)
+    if (server_init() < 0 || (unix_path && unix_init() < 0)) {
+        logger_cleanup();
         return 1;
     }
     
     // Initialize epoll
     if (epoll_init() < 0) {
         server_cleanup();
+        logger_cleanup();
         return 1;
     }
     
+    if (metrics_port > 0 && metrics_start_http(metrics_port) < 0) {
+        logger_error("[Server] Could not start metrics endpoint on port %d", metrics_port);
+    }
+    
     // Run reactor loop
-    printf("[Server] Starting reactor loop\n");
+    logger_info("[Server] Starting reactor loop");
     reactor_loop();
     
     // Shutdown
-    if (!single_threaded_mode) {
-        thread_pool_shutdown();
+    if (partition_enabled()) {
+        partition_shutdown();
+    } else {
+        thread_pool_shutdown();  // No-op if the pool was never started
     }
+    trace_shutdown();
+    repl_stop();
+    metrics_stop_http();
     server_cleanup();
+    conn_table_free();
+    logger_cleanup();
     
     return 0;
 }
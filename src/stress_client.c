@@ -2,18 +2,28 @@
 // ============================================================================
 // This client spawns multiple threads to simulate concurrent bank clients,
 // measuring throughput to demonstrate single-threaded vs multi-threaded
-// server performance difference.
+// server performance difference. Connects over TCP, or over a Unix socket
+// with --unix; --compare-unix runs the same load over both and compares.
 // ============================================================================
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <sys/un.h>
+#include <stddef.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 
 #define SERVER_HOST "127.0.0.1"
 #define SERVER_PORT 8080
@@ -24,21 +34,78 @@
 // ============================================================================
 #define NUM_CLIENTS       10     // Number of concurrent client threads
 #define OPS_PER_CLIENT    20    // Operations each client performs
+#define LOG_BUFFER_SIZE   8192  // Per-thread buffer for verbose per-op output
+#define ASYNC_LOOPS       4     // Event-loop threads in --async mode
+#define ASYNC_CONNECT_BATCH 256 // Max in-progress connects per event loop
 // ============================================================================
 
+// Runtime configuration (overridable from the command line)
+static int num_clients = NUM_CLIENTS;
+static int ops_per_client = OPS_PER_CLIENT;
+static int verbose = 0;  // Per-op output is off by default so it can't skew results
+static int async_mode = 0;  // Drive many connections from a few epoll loops
+static int async_loops = ASYNC_LOOPS;
+static int server_port = SERVER_PORT;
+static const char *unix_path = NULL;  // Connect here instead of TCP ("@name": abstract)
+
 // Statistics
 static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
 static int total_success = 0;
 static int total_failure = 0;
 static int accounts_created = 0;
+static uint64_t *latencies_ns = NULL;  // Per-request round trips (thread-per-client mode)
+static int latency_count = 0;
 
 // Thread argument structure
 typedef struct {
     int thread_id;
     int ops_completed;
     int ops_failed;
+    uint64_t rng_state;       // Private PRNG state (rand() is not thread-safe)
+    char *log_buf;            // Buffered per-op output, only used when verbose
+    size_t log_len;
+    uint64_t *latencies_ns;   // One round trip per op, merged after the run
+    int latency_count;
 } ClientArgs;
 
+// xorshift64* - tiny, fast, and lock-free since each thread owns its state
+static inline uint32_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return (uint32_t)((x * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+// Flush a thread's buffered output with a single write under stdio's lock
+static void flush_log(ClientArgs *args) {
+    if (args->log_len > 0) {
+        fwrite(args->log_buf, 1, args->log_len, stdout);
+        args->log_len = 0;
+    }
+}
+
+// Append a line to the thread's output buffer instead of printf-ing per op
+static void buffer_log(ClientArgs *args, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void buffer_log(ClientArgs *args, const char *fmt, ...) {
+    if (!args->log_buf) return;
+    
+    if (LOG_BUFFER_SIZE - args->log_len < 256) {
+        flush_log(args);
+    }
+    
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(args->log_buf + args->log_len, LOG_BUFFER_SIZE - args->log_len, fmt, ap);
+    va_end(ap);
+    
+    if (n > 0) {
+        size_t room = LOG_BUFFER_SIZE - args->log_len - 1;
+        args->log_len += ((size_t)n < room) ? (size_t)n : room;
+    }
+}
+
 // Get current time in seconds (high precision)
 double get_time_sec(void) {
     struct timespec ts;
@@ -46,20 +113,55 @@ double get_time_sec(void) {
     return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
+// CPU time (user + system) consumed by this process so far, in seconds
+double get_cpu_time_sec(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+           ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static uint64_t get_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Server address for the chosen transport; returns its length
+static socklen_t server_address(struct sockaddr_storage *storage) {
+    memset(storage, 0, sizeof(*storage));
+    if (unix_path) {
+        struct sockaddr_un *un = (struct sockaddr_un *)storage;
+        size_t len = strlen(unix_path);
+        if (len >= sizeof(un->sun_path)) len = sizeof(un->sun_path) - 1;
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, unix_path, len);
+        if (unix_path[0] == '@') {
+            un->sun_path[0] = '\0';   // Abstract namespace: length, not NUL, ends the name
+            return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len);
+        }
+        return (socklen_t)sizeof(*un);
+    }
+    
+    struct sockaddr_in *in = (struct sockaddr_in *)storage;
+    in->sin_family = AF_INET;
+    in->sin_port = htons(server_port);
+    inet_pton(AF_INET, SERVER_HOST, &in->sin_addr);
+    return (socklen_t)sizeof(*in);
+}
+
 // Connect to server
 int connect_to_server(void) {
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    int sock = socket(unix_path ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
     if (sock < 0) {
         perror("socket");
         return -1;
     }
     
-    struct sockaddr_in addr;
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(SERVER_PORT);
-    inet_pton(AF_INET, SERVER_HOST, &addr.sin_addr);
+    struct sockaddr_storage addr;
+    socklen_t addrlen = server_address(&addr);
     
-    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    if (connect(sock, (struct sockaddr *)&addr, addrlen) < 0) {
         perror("connect");
         close(sock);
         return -1;
@@ -114,25 +216,26 @@ void* client_thread(void *arg) {
         return NULL;
     }
     
-    printf("[Client %2d] Created account #%d\n", args->thread_id, my_account);
+    buffer_log(args, "[Client %2d] Created account #%d\n", args->thread_id, my_account);
     
     // Perform operations
-    for (int i = 0; i < OPS_PER_CLIENT; i++) {
-        int op = rand() % 3;  // 0=deposit, 1=withdraw, 2=balance
+    for (int i = 0; i < ops_per_client; i++) {
+        int op = next_random(&args->rng_state) % 3;  // 0=deposit, 1=withdraw, 2=balance
         int success = 0;
+        uint64_t op_start = get_time_ns();
         double amount;
         const char *op_name;
         
         switch (op) {
             case 0:  // Deposit
-                amount = (rand() % 1000) + 1.0;
+                amount = (next_random(&args->rng_state) % 1000) + 1.0;
                 snprintf(cmd, sizeof(cmd), "DEPOSIT %d %.2f\n", my_account, amount);
                 success = (send_command(sock, cmd, response, sizeof(response)) == 0);
                 op_name = "DEPOSIT";
                 break;
                 
             case 1:  // Withdraw (small amount to avoid insufficient funds)
-                amount = (rand() % 10) + 1.0;
+                amount = (next_random(&args->rng_state) % 10) + 1.0;
                 snprintf(cmd, sizeof(cmd), "WITHDRAW %d %.2f\n", my_account, amount);
                 success = (send_command(sock, cmd, response, sizeof(response)) == 0);
                 op_name = "WITHDRAW";
@@ -149,13 +252,18 @@ void* client_thread(void *arg) {
                 op_name = "UNKNOWN";
                 break;
         }
+        if (args->latencies_ns) {
+            args->latencies_ns[args->latency_count++] = get_time_ns() - op_start;
+        }
         
-        // Trim newline from response for cleaner output
-        char *newline = strchr(response, '\n');
-        if (newline) *newline = '\0';
-        
-        printf("[Client %2d] Op %2d: %-8s -> %s\n", 
-               args->thread_id, i + 1, op_name, response);
+        if (verbose) {
+            // Trim newline from response for cleaner output
+            char *newline = strchr(response, '\n');
+            if (newline) *newline = '\0';
+            
+            buffer_log(args, "[Client %2d] Op %2d: %-8s -> %s\n", 
+                       args->thread_id, i + 1, op_name, response);
+        }
         
         if (success) {
             args->ops_completed++;
@@ -170,75 +278,536 @@ void* client_thread(void *arg) {
     pthread_mutex_lock(&stats_lock);
     total_success += args->ops_completed;
     total_failure += args->ops_failed;
+    if (latencies_ns && args->latencies_ns) {
+        memcpy(latencies_ns + latency_count, args->latencies_ns,
+               sizeof(uint64_t) * args->latency_count);
+        latency_count += args->latency_count;
+    }
     pthread_mutex_unlock(&stats_lock);
     
-    printf("[Client %d] Completed: %d ops, Failed: %d ops\n", 
-           args->thread_id, args->ops_completed, args->ops_failed);
+    buffer_log(args, "[Client %d] Completed: %d ops, Failed: %d ops\n", 
+               args->thread_id, args->ops_completed, args->ops_failed);
+    flush_log(args);
     
     return NULL;
 }
 
-int main(int argc, char *argv[]) {
-    // Parse command-line arguments
-    for (int i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
-            printf("Usage: %s\n", argv[0]);
-            printf("\nStress test the bank server with %d clients x %d operations.\n", NUM_CLIENTS, OPS_PER_CLIENT);
-            return 0;
+// ============================================================================
+// ASYNC MODE - a few epoll loops multiplexing thousands of connections
+// ============================================================================
+// Instead of one blocking thread per simulated client, each event-loop thread
+// owns a slice of the connections and advances each one through a small state
+// machine as its socket becomes ready. This lets one box hold tens of
+// thousands of concurrent connections against the server.
+
+typedef enum {
+    CONN_IDLE,        // Not yet connected
+    CONN_CONNECTING,  // Non-blocking connect() in progress
+    CONN_CREATING,    // Waiting for the CREATE response
+    CONN_RUNNING,     // Waiting for the response to an operation
+    CONN_DONE         // Finished (or failed) and closed
+} ConnState;
+
+typedef struct {
+    int fd;
+    ConnState state;
+    int account;
+    int ops_done;
+    char tx[64];          // Pending request
+    int tx_len;
+    int tx_off;
+    char rx[128];         // Partial response
+    int rx_len;
+} AsyncConn;
+
+typedef struct {
+    int loop_id;
+    int num_conns;
+    int ops_completed;
+    int ops_failed;
+    int accounts;
+    int connect_failed;
+    int connecting;       // Connects currently in flight
+    uint64_t rng_state;
+} LoopArgs;
+
+static void async_close(int epfd, AsyncConn *c) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->fd = -1;
+    c->state = CONN_DONE;
+}
+
+// Start a non-blocking connect; returns 0 when in progress or connected
+static int async_connect(int epfd, AsyncConn *c) {
+    int fd = socket(unix_path ? AF_UNIX : AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) return -1;
+    
+    struct sockaddr_storage addr;
+    socklen_t addrlen = server_address(&addr);
+    
+    // A Unix socket whose backlog is full fails with EAGAIN instead of
+    // completing later; count it like any other failed connect
+    if (connect(fd, (struct sockaddr *)&addr, addrlen) < 0 && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    
+    c->fd = fd;
+    c->state = CONN_CONNECTING;
+    
+    struct epoll_event ev;
+    ev.events = EPOLLOUT;
+    ev.data.ptr = c;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        close(fd);
+        c->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+// Queue a request and try to write it right away
+static int async_send(int epfd, AsyncConn *c, const char *cmd) {
+    c->tx_len = snprintf(c->tx, sizeof(c->tx), "%s", cmd);
+    c->tx_off = 0;
+    c->rx_len = 0;
+    
+    int n = send(c->fd, c->tx, c->tx_len, MSG_NOSIGNAL);
+    if (n < 0 && errno != EAGAIN) return -1;
+    if (n > 0) c->tx_off = n;
+    
+    // Wait for the rest of the request to drain, or for the response
+    struct epoll_event ev;
+    ev.events = (c->tx_off < c->tx_len) ? EPOLLOUT : EPOLLIN;
+    ev.data.ptr = c;
+    return epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+// Pick the next random operation for a connection and send it
+static int async_next_op(int epfd, AsyncConn *c, LoopArgs *args) {
+    char cmd[64];
+    switch (next_random(&args->rng_state) % 3) {
+        case 0:
+            snprintf(cmd, sizeof(cmd), "DEPOSIT %d %.2f\n", c->account,
+                     (next_random(&args->rng_state) % 1000) + 1.0);
+            break;
+        case 1:
+            snprintf(cmd, sizeof(cmd), "WITHDRAW %d %.2f\n", c->account,
+                     (next_random(&args->rng_state) % 10) + 1.0);
+            break;
+        default:
+            snprintf(cmd, sizeof(cmd), "BALANCE %d\n", c->account);
+            break;
+    }
+    return async_send(epfd, c, cmd);
+}
+
+// Advance one connection's state machine after a readiness event
+static void async_handle(int epfd, AsyncConn *c, uint32_t events, LoopArgs *args) {
+    if (c->state == CONN_CONNECTING) {
+        args->connecting--;
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0 || (events & (EPOLLERR | EPOLLHUP))) {
+            args->connect_failed++;
+            async_close(epfd, c);
+            return;
+        }
+        c->state = CONN_CREATING;
+        if (async_send(epfd, c, "CREATE\n") < 0) async_close(epfd, c);
+        return;
+    }
+    
+    // Finish writing a partially sent request
+    if (c->tx_off < c->tx_len) {
+        int n = send(c->fd, c->tx + c->tx_off, c->tx_len - c->tx_off, MSG_NOSIGNAL);
+        if (n < 0 && errno != EAGAIN) {
+            async_close(epfd, c);
+            return;
+        }
+        if (n > 0) c->tx_off += n;
+        if (c->tx_off == c->tx_len) {
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.ptr = c;
+            epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
         }
+        return;
     }
     
-    srand(time(NULL));
+    int n = recv(c->fd, c->rx + c->rx_len, sizeof(c->rx) - 1 - c->rx_len, 0);
+    if (n <= 0) {
+        if (n < 0 && errno == EAGAIN) return;
+        // Server hung up mid-test: remaining ops count as failures
+        args->ops_failed += (c->state == CONN_RUNNING) ? ops_per_client - c->ops_done : 0;
+        async_close(epfd, c);
+        return;
+    }
+    c->rx_len += n;
+    c->rx[c->rx_len] = '\0';
+    
+    // Responses are newline-terminated; wait for the whole line
+    if (!strchr(c->rx, '\n') && c->rx_len < (int)sizeof(c->rx) - 1) return;
+    
+    int success = (strncmp(c->rx, "SUCCESS", 7) == 0);
+    
+    if (c->state == CONN_CREATING) {
+        if (!success || sscanf(c->rx, "SUCCESS CREATE %d", &c->account) != 1) {
+            async_close(epfd, c);
+            return;
+        }
+        args->accounts++;
+        c->state = CONN_RUNNING;
+    } else {
+        if (success) args->ops_completed++;
+        else args->ops_failed++;
+        c->ops_done++;
+    }
+    
+    if (c->ops_done >= ops_per_client) {
+        async_close(epfd, c);
+    } else if (async_next_op(epfd, c, args) < 0) {
+        async_close(epfd, c);
+    }
+}
+
+// Event-loop thread: owns args->num_conns connections until all are done
+void* async_loop_thread(void *arg) {
+    LoopArgs *args = (LoopArgs *)arg;
     
+    int epfd = epoll_create1(0);
+    if (epfd < 0) {
+        perror("epoll_create1");
+        return NULL;
+    }
+    
+    AsyncConn *conns = calloc(args->num_conns, sizeof(AsyncConn));
+    struct epoll_event *events = calloc(ASYNC_CONNECT_BATCH, sizeof(struct epoll_event));
+    if (!conns || !events) {
+        perror("calloc");
+        free(conns);
+        free(events);
+        close(epfd);
+        return NULL;
+    }
+    
+    int next_to_open = 0;
+    int done = 0;
+    
+    while (done < args->num_conns) {
+        // Ramp up gradually so we don't overflow the server's listen backlog
+        while (next_to_open < args->num_conns && args->connecting < ASYNC_CONNECT_BATCH) {
+            AsyncConn *c = &conns[next_to_open++];
+            c->fd = -1;
+            if (async_connect(epfd, c) < 0) {
+                args->connect_failed++;
+                c->state = CONN_DONE;
+                done++;
+            } else {
+                args->connecting++;
+            }
+        }
+        
+        int nfds = epoll_wait(epfd, events, ASYNC_CONNECT_BATCH, 1000);
+        if (nfds < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        
+        for (int i = 0; i < nfds; i++) {
+            AsyncConn *c = (AsyncConn *)events[i].data.ptr;
+            async_handle(epfd, c, events[i].events, args);
+            if (c->state == CONN_DONE) done++;
+        }
+    }
+    
+    free(events);
+    free(conns);
+    close(epfd);
+    
+    pthread_mutex_lock(&stats_lock);
+    total_success += args->ops_completed;
+    total_failure += args->ops_failed;
+    accounts_created += args->accounts;
+    pthread_mutex_unlock(&stats_lock);
+    
+    return NULL;
+}
+
+// Raise the open-file limit as far as allowed so we can hold many sockets
+static void raise_fd_limit(int wanted) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0) return;
+    if (rl.rlim_cur >= (rlim_t)wanted) return;
+    
+    rl.rlim_cur = ((rlim_t)wanted < rl.rlim_max) ? (rlim_t)wanted : rl.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &rl) < 0) {
+        perror("setrlimit");
+    }
+    if (rl.rlim_cur < (rlim_t)wanted) {
+        printf("[Main] Warning: open-file limit is %ld, fewer than %d connections\n",
+               (long)rl.rlim_cur, wanted);
+    }
+}
+
+// Spread num_clients connections over async_loops event-loop threads
+static void run_async_clients(void) {
+    raise_fd_limit(num_clients + 64);
+    
+    if (async_loops > num_clients) async_loops = num_clients;
+    
+    pthread_t *threads = calloc(async_loops, sizeof(pthread_t));
+    LoopArgs *args = calloc(async_loops, sizeof(LoopArgs));
+    if (!threads || !args) {
+        perror("calloc");
+        exit(1);
+    }
+    
+    uint64_t seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+    
+    printf("[Main] Driving %d connections from %d event loops...\n\n", num_clients, async_loops);
+    for (int i = 0; i < async_loops; i++) {
+        args[i].loop_id = i;
+        args[i].num_conns = num_clients / async_loops + (i < num_clients % async_loops ? 1 : 0);
+        args[i].rng_state = (seed + 0x9E3779B97F4A7C15ULL * (uint64_t)(i + 1)) | 1;
+        pthread_create(&threads[i], NULL, async_loop_thread, &args[i]);
+    }
+    
+    int connect_failed = 0;
+    for (int i = 0; i < async_loops; i++) {
+        pthread_join(threads[i], NULL);
+        connect_failed += args[i].connect_failed;
+    }
+    
+    if (connect_failed > 0) {
+        printf("[Main] %d connections failed to connect\n", connect_failed);
+    }
+    
+    free(threads);
+    free(args);
+}
+
+// Summary of one run, kept so --compare-unix can print both side by side
+typedef struct {
+    int total_ops;
+    double elapsed;
+    double cpu_used;
+    double p50_us, p90_us, p99_us, max_us;  // 0 when latencies weren't recorded
+} RunResult;
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_us(double p) {
+    int index = (int)(p * (latency_count - 1) + 0.5);
+    return latencies_ns[index] / 1000.0;
+}
+
+static void summarize(RunResult *r, double elapsed, double cpu_used) {
+    memset(r, 0, sizeof(*r));
+    r->total_ops = total_success + total_failure;
+    r->elapsed = elapsed;
+    r->cpu_used = cpu_used;
+    if (latencies_ns && latency_count > 0) {
+        qsort(latencies_ns, latency_count, sizeof(uint64_t), compare_u64);
+        r->p50_us = percentile_us(0.50);
+        r->p90_us = percentile_us(0.90);
+        r->p99_us = percentile_us(0.99);
+        r->max_us = latencies_ns[latency_count - 1] / 1000.0;
+    }
+}
+
+// Print the final benchmark summary
+static void print_results(const RunResult *r) {
+    double throughput = r->total_ops / r->elapsed;
+    
+    printf("\n============================================================\n");
+    printf("  BENCHMARK RESULTS\n");
     printf("============================================================\n");
-    printf("  BANK SERVER STRESS TEST\n");
+    printf("  Accounts created: %d\n", accounts_created);
+    printf("  Successful ops:   %d\n", total_success);
+    printf("  Failed ops:       %d\n", total_failure);
+    printf("  Total ops:        %d\n", r->total_ops);
+    printf("------------------------------------------------------------\n");
+    printf("  Total time:       %.2f seconds\n", r->elapsed);
+    printf("  Throughput:       %.2f ops/sec\n", throughput);
+    if (r->max_us > 0) {
+        printf("  Latency (us):     p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+               r->p50_us, r->p90_us, r->p99_us, r->max_us);
+    }
+    printf("------------------------------------------------------------\n");
+    printf("  Client CPU time:  %.2f seconds (%.1f%% of one core)\n",
+           r->cpu_used, r->elapsed > 0 ? 100.0 * r->cpu_used / r->elapsed : 0.0);
     printf("============================================================\n");
-    printf("  Clients:          %d\n", NUM_CLIENTS);
-    printf("  Ops per client:   %d\n", OPS_PER_CLIENT);
-    printf("  Total operations: %d\n", NUM_CLIENTS * OPS_PER_CLIENT);
-    printf("============================================================\n\n");
+}
+
+// One thread and one connection per client, each doing ops_per_client
+// request/response round trips
+static void run_threaded_clients(RunResult *result) {
+    pthread_t *threads = calloc(num_clients, sizeof(pthread_t));
+    ClientArgs *args = calloc(num_clients, sizeof(ClientArgs));
+    latencies_ns = calloc((size_t)num_clients * ops_per_client, sizeof(uint64_t));
+    if (!threads || !args || !latencies_ns) {
+        perror("calloc");
+        exit(1);
+    }
+    total_success = total_failure = accounts_created = latency_count = 0;
     
-    pthread_t threads[NUM_CLIENTS];
-    ClientArgs args[NUM_CLIENTS];
+    uint64_t seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
     
     // Record start time
     double start_time = get_time_sec();
+    double start_cpu = get_cpu_time_sec();
     
     // Spawn client threads
-    printf("[Main] Spawning %d client threads...\n\n", NUM_CLIENTS);
-    for (int i = 0; i < NUM_CLIENTS; i++) {
+    printf("[Main] Spawning %d client threads...\n\n", num_clients);
+    for (int i = 0; i < num_clients; i++) {
         args[i].thread_id = i;
         args[i].ops_completed = 0;
         args[i].ops_failed = 0;
+        // Distinct non-zero seed per thread (xorshift state must never be 0)
+        args[i].rng_state = (seed + 0x9E3779B97F4A7C15ULL * (uint64_t)(i + 1)) | 1;
+        args[i].log_buf = verbose ? malloc(LOG_BUFFER_SIZE) : NULL;
+        args[i].log_len = 0;
+        args[i].latencies_ns = malloc(sizeof(uint64_t) * ops_per_client);
+        args[i].latency_count = 0;
         pthread_create(&threads[i], NULL, client_thread, &args[i]);
     }
     
     // Wait for all threads to complete
-    for (int i = 0; i < NUM_CLIENTS; i++) {
+    for (int i = 0; i < num_clients; i++) {
         pthread_join(threads[i], NULL);
+        free(args[i].log_buf);
+        free(args[i].latencies_ns);
     }
     
-    // Record end time
-    double end_time = get_time_sec();
-    double elapsed = end_time - start_time;
+    summarize(result, get_time_sec() - start_time, get_cpu_time_sec() - start_cpu);
     
-    // Print results
-    int total_ops = total_success + total_failure;
-    double throughput = total_ops / elapsed;
+    free(latencies_ns);
+    latencies_ns = NULL;
+    free(threads);
+    free(args);
+}
+
+// Same load over loopback TCP, then over the Unix socket
+static void compare_transports(const char *path) {
+    RunResult tcp, local;
+    
+    unix_path = NULL;
+    printf("[Main] Pass 1: TCP %s:%d\n", SERVER_HOST, server_port);
+    run_threaded_clients(&tcp);
+    print_results(&tcp);
+    
+    unix_path = path;
+    printf("\n[Main] Pass 2: Unix socket %s\n", path);
+    run_threaded_clients(&local);
+    print_results(&local);
     
     printf("\n============================================================\n");
-    printf("  BENCHMARK RESULTS\n");
+    printf("  TRANSPORT COMPARISON\n");
     printf("============================================================\n");
-    printf("  Accounts created: %d\n", accounts_created);
-    printf("  Successful ops:   %d\n", total_success);
-    printf("  Failed ops:       %d\n", total_failure);
-    printf("  Total ops:        %d\n", total_ops);
+    printf("  %-10s %12s %9s %9s %9s\n", "Transport", "ops/sec", "p50 us", "p99 us", "CPU s");
+    printf("  %-10s %12.0f %9.1f %9.1f %9.2f\n", "TCP", tcp.total_ops / tcp.elapsed,
+           tcp.p50_us, tcp.p99_us, tcp.cpu_used);
+    printf("  %-10s %12.0f %9.1f %9.1f %9.2f\n", "Unix", local.total_ops / local.elapsed,
+           local.p50_us, local.p99_us, local.cpu_used);
     printf("------------------------------------------------------------\n");
-    printf("  Total time:       %.2f seconds\n", elapsed);
-    printf("  Throughput:       %.2f ops/sec\n", throughput);
+    printf("  Unix vs TCP: %.2fx throughput, %.2fx p50 latency\n",
+           (local.total_ops / local.elapsed) / (tcp.total_ops / tcp.elapsed),
+           tcp.p50_us > 0 ? local.p50_us / tcp.p50_us : 0.0);
     printf("============================================================\n");
-    
+}
 
+static void print_usage(const char *prog) {
+    printf("Usage: %s [-c clients] [-n ops] [-v] [--async [-t loops]] [--port N | --unix PATH]\n", prog);
+    printf("\nStress test the bank server with N clients x M operations.\n");
+    printf("  -c, --clients N   Concurrent client threads (default %d)\n", NUM_CLIENTS);
+    printf("  -n, --ops N       Operations per client (default %d)\n", OPS_PER_CLIENT);
+    printf("  -v, --verbose     Print every operation (buffered per thread)\n");
+    printf("  --async           Multiplex connections over epoll loops instead of\n");
+    printf("                    one thread per client (for very high -c values)\n");
+    printf("  -t, --loops N     Event-loop threads in --async mode (default %d)\n", ASYNC_LOOPS);
+    printf("  -p, --port N      Server TCP port (default %d)\n", SERVER_PORT);
+    printf("  --unix PATH       Connect over the server's Unix socket (@name: abstract)\n");
+    printf("  --compare-unix PATH\n");
+    printf("                    Run the test over TCP, then over PATH, and compare\n");
+    printf("                    throughput and latency (start the server with\n");
+    printf("                    --unix PATH --delay-ms 0 to see transport cost alone)\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *compare_path = NULL;
+    
+    // Parse command-line arguments
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            print_usage(argv[0]);
+            return 0;
+        } else if ((strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--clients") == 0) && i + 1 < argc) {
+            num_clients = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--ops") == 0) && i + 1 < argc) {
+            ops_per_client = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-v") == 0 || strcmp(argv[i], "--verbose") == 0) {
+            verbose = 1;
+        } else if (strcmp(argv[i], "--async") == 0) {
+            async_mode = 1;
+        } else if ((strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--loops") == 0) && i + 1 < argc) {
+            async_loops = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--port") == 0) && i + 1 < argc) {
+            server_port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--unix") == 0 && i + 1 < argc) {
+            unix_path = argv[++i];
+        } else if (strcmp(argv[i], "--compare-unix") == 0 && i + 1 < argc) {
+            compare_path = argv[++i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    
+    if (num_clients <= 0 || ops_per_client <= 0 || async_loops <= 0) {
+        fprintf(stderr, "Client, operation and loop counts must be positive\n");
+        return 1;
+    }
+    if (compare_path && async_mode) {
+        fprintf(stderr, "--compare-unix runs thread-per-client mode only\n");
+        return 1;
+    }
+    
+    printf("============================================================\n");
+    printf("  BANK SERVER STRESS TEST\n");
+    printf("============================================================\n");
+    printf("  Clients:          %d\n", num_clients);
+    printf("  Ops per client:   %d\n", ops_per_client);
+    printf("  Total operations: %d\n", num_clients * ops_per_client);
+    printf("  Mode:             %s\n", async_mode ? "async (epoll)" : "thread per client");
+    if (compare_path) {
+        printf("  Transport:        TCP port %d vs Unix %s\n", server_port, compare_path);
+    } else if (unix_path) {
+        printf("  Transport:        Unix socket %s\n", unix_path);
+    } else {
+        printf("  Transport:        TCP port %d\n", server_port);
+    }
+    printf("============================================================\n\n");
+    
+    RunResult result;
+    if (compare_path) {
+        compare_transports(compare_path);
+    } else if (async_mode) {
+        double start_time = get_time_sec();
+        double start_cpu = get_cpu_time_sec();
+        run_async_clients();
+        summarize(&result, get_time_sec() - start_time, get_cpu_time_sec() - start_cpu);
+        print_results(&result);
+    } else {
+        run_threaded_clients(&result);
+        print_results(&result);
+    }
     
     return 0;
 }
@@ -3,78 +3,300 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <stdatomic.h>
 #include <sys/socket.h>  // Add this for send()
 
 #include "../include/bank.h"
+#include "../include/protocol.h"
+#include "../include/thread_pool.h"
+#include "../include/logger.h"
+#include "../include/metrics.h"
+#include "../include/affinity.h"
+#include "../include/buffer.h"
+#include "../include/coro.h"
+#include "../include/trace.h"
+#include "../include/connection.h"
+#include "../include/dedup.h"
 
 #define THREAD_POOL_SIZE 10
-#define TASK_QUEUE_SIZE 1000
+#define TASK_QUEUE_SIZE 1000  // Per lane
 #define BUFFER_SIZE 1024
 
-// External protocol function
-extern void execute_command(const char *input, char *response, size_t resp_size);
+// Default weights of the read, write and bulk lanes (see next_lane)
+#define LANE_WEIGHT_READ  8
+#define LANE_WEIGHT_WRITE 4
+#define LANE_WEIGHT_BULK  1
 
 // Task structure to hold client FD and command data
 typedef struct {
     int client_fd;
-    char command[256];
+    CommandType type;
+    uint64_t enqueue_ns;   // When the reactor queued it (for queue-wait metrics)
+    uint64_t deadline_ns;  // Answer TIMEOUT instead of executing after this; 0 = none
+    unsigned int tag;      // Client's TAG= option, for framing a TIMEOUT reply
+    int trace;             // Sampled span, 0 if not traced
+    Buffer *buf;           // Reactor's read buffer (one reference held by the task)
+    const char *command;   // NUL-terminated command inside buf
 } Task;
 
-// Thread pool state
+// One FIFO per lane
 typedef struct {
     Task queue[TASK_QUEUE_SIZE];
     int head;
     int tail;
     int count;
+    int weight;   // Tasks taken per turn in the weighted rotation
+} TaskLane;
+
+// Thread pool state
+typedef struct {
+    TaskLane lanes[LANE_COUNT];
+    int count;            // Tasks queued across all lanes
+    int active;           // Tasks taken by a worker and not finished yet
+    int current_lane;     // Lane whose turn it is in the rotation
+    int turn_remaining;   // Tasks it may still take this turn
     pthread_mutex_t queue_lock;
     pthread_cond_t queue_not_empty;
     pthread_cond_t queue_not_full;
+    pthread_cond_t pool_idle;     // count and active both reached 0
     pthread_t workers[THREAD_POOL_SIZE];
+    int num_workers;
+    int running;          // Workers started and not shut down
     int shutdown;
 } ThreadPool;
 
 static ThreadPool thread_pool = {0};
 
-// Worker thread function
-void* worker_thread(void *arg) {
-    (void)arg; // Unused parameter
+// Load shedding: refuse new work when its estimated queue wait exceeds
+// shed_threshold_ms (0 = never shed). The estimate is queued tasks per
+// worker times a moving average of execution time.
+static int shed_threshold_ms = 0;
+static _Atomic uint64_t avg_exec_ns = 0;
+
+// Coroutines per worker (0 = each worker runs one request at a time)
+static int coros_per_worker = 0;
+
+// Cheap interactive reads, account mutations, whole-bank scans and control
+// commands each get their own lane, so a backlog in one can't stall another
+static QueueLane lane_for(CommandType type) {
+    switch (type) {
+        case CMD_BALANCE:
+        case CMD_HISTORY:
+            return LANE_READ;
+        case CMD_CREATE:
+        case CMD_DEPOSIT:
+        case CMD_WITHDRAW:
+        case CMD_TRANSFER:
+        case CMD_TXN:
+        case CMD_CREATE_ID:
+        case CMD_PREPARE:
+        case CMD_COMMIT:
+        case CMD_ABORT:
+            return LANE_WRITE;
+        case CMD_BALANCE_ALL:
+            return LANE_BULK;
+        default:
+            return LANE_ADMIN;  // MODE_*, SHUTDOWN, STATS, ... and invalid input
+    }
+}
+
+// Pick the lane to serve next (queue_lock held, count > 0). The admin lane
+// always goes first; the others take turns of up to `weight` tasks each,
+// and an empty lane forfeits its turn.
+static TaskLane *next_lane(void) {
+    if (thread_pool.lanes[LANE_ADMIN].count > 0) {
+        return &thread_pool.lanes[LANE_ADMIN];
+    }
     
-    while (1) {
-        pthread_mutex_lock(&thread_pool.queue_lock);
-        
-        // Wait while queue is empty (and not shutting down)
-        while (thread_pool.count == 0 && !thread_pool.shutdown) {
-            pthread_cond_wait(&thread_pool.queue_not_empty, &thread_pool.queue_lock);
+    for (int tried = 0; tried <= LANE_COUNT; tried++) {
+        TaskLane *lane = &thread_pool.lanes[thread_pool.current_lane];
+        if (lane->count > 0 && thread_pool.turn_remaining > 0) {
+            thread_pool.turn_remaining--;
+            return lane;
         }
-        
-        // Check if we should exit
-        if (thread_pool.shutdown && thread_pool.count == 0) {
-            pthread_mutex_unlock(&thread_pool.queue_lock);
+        // Next lane's turn (skipping the admin lane, served above)
+        do {
+            thread_pool.current_lane = (thread_pool.current_lane + 1) % LANE_COUNT;
+        } while (thread_pool.current_lane == LANE_ADMIN);
+        thread_pool.turn_remaining = thread_pool.lanes[thread_pool.current_lane].weight;
+    }
+    
+    return NULL;  // Unreachable while count > 0
+}
+
+// A worker is done with a task (replied or dropped it)
+static void task_done(Task *task) {
+    conn_request_done(task->client_fd);
+    buffer_release(task->buf);
+    
+    pthread_mutex_lock(&thread_pool.queue_lock);
+    thread_pool.active--;
+    if (thread_pool.active == 0 && thread_pool.count == 0) {
+        pthread_cond_broadcast(&thread_pool.pool_idle);
+    }
+    pthread_mutex_unlock(&thread_pool.queue_lock);
+}
+
+// Take the next task from the lane whose turn it is. With wait set, block
+// until there is one; returns 0 once shutting down with nothing left.
+// Without it, returns 0 right away if the queue is empty.
+static int take_task(Task *out, int wait) {
+    pthread_mutex_lock(&thread_pool.queue_lock);
+    
+    // Wait while queue is empty (and not shutting down)
+    while (wait && thread_pool.count == 0 && !thread_pool.shutdown) {
+        pthread_cond_wait(&thread_pool.queue_not_empty, &thread_pool.queue_lock);
+    }
+    
+    if (thread_pool.count == 0) {
+        pthread_mutex_unlock(&thread_pool.queue_lock);
+        return 0;
+    }
+    
+    TaskLane *lane = next_lane();
+    *out = lane->queue[lane->head];
+    lane->head = (lane->head + 1) % TASK_QUEUE_SIZE;
+    lane->count--;
+    thread_pool.count--;
+    thread_pool.active++;
+    
+    // Signal that queue is not full
+    pthread_cond_broadcast(&thread_pool.queue_not_full);
+    pthread_mutex_unlock(&thread_pool.queue_lock);
+    return 1;
+}
+
+// Wait until a task is queued or until_ns (CLOCK_MONOTONIC, as used by
+// metrics_now_ns) passes, whichever is first
+static void wait_for_task(uint64_t until_ns) {
+    uint64_t now = metrics_now_ns();
+    if (until_ns <= now) return;
+    
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    uint64_t ns = (uint64_t)deadline.tv_nsec + (until_ns - now);
+    deadline.tv_sec += ns / 1000000000ULL;
+    deadline.tv_nsec = ns % 1000000000ULL;
+    
+    pthread_mutex_lock(&thread_pool.queue_lock);
+    while (thread_pool.count == 0) {
+        if (pthread_cond_timedwait(&thread_pool.queue_not_empty, &thread_pool.queue_lock,
+                                   &deadline) == ETIMEDOUT) {
             break;
         }
+    }
+    pthread_mutex_unlock(&thread_pool.queue_lock);
+}
+
+// Execute one task and answer the client
+static void run_task(Task *task) {
+    uint64_t dequeue_ns = metrics_now_ns();
+    trace_mark(task->trace, TRACE_DEQUEUE);
+    
+    // The client has given up by now: skip the work, tell it why
+    if (task->deadline_ns && dequeue_ns > task->deadline_ns) {
+        char reply[64];
+        int len = snprintf(reply, sizeof(reply), "TIMEOUT %s -1\n", protocol_command_name(task->type));
+        len = protocol_frame_reply(task->tag, reply, sizeof(reply), len);
+        send(task->client_fd, reply, len, MSG_NOSIGNAL);
+        trace_end(task->trace, task->type);
+        metrics_record_timeout();
+        logger_debug("[Worker] Dropped expired task from FD %d", task->client_fd);
+        task_done(task);
+        return;
+    }
+    
+    // Process the task: execute command and send response
+    char response[BUFFER_SIZE];
+    int len;
+    trace_set_current(task->trace);
+    CommandType type = execute_command(task->command, response, sizeof(response), &len);
+    trace_set_current(0);
+    trace_mark(task->trace, TRACE_EXEC_DONE);
+    uint64_t exec_done = metrics_now_ns();
+    uint64_t exec_ns = exec_done - dequeue_ns;
+    metrics_record(type, PHASE_QUEUE, dequeue_ns - task->enqueue_ns);
+    
+    // Moving average (1/8 weight) for the shedding estimate; a lost
+    // update between racing workers only delays convergence
+    uint64_t avg = atomic_load_explicit(&avg_exec_ns, memory_order_relaxed);
+    atomic_store_explicit(&avg_exec_ns, avg - avg / 8 + exec_ns / 8, memory_order_relaxed);
+    
+    // Send response back to client
+    uint64_t send_start = metrics_phase_start(PHASE_SEND);
+    if (send(task->client_fd, response, len, MSG_NOSIGNAL) < 0) {
+        logger_error("[Worker] Failed to send response to FD %d: %s",
+                     task->client_fd, strerror(errno));
+    }
+    metrics_phase_end(type, PHASE_SEND, send_start);
+    
+    logger_info("[Worker] Processing task from FD %d: %.*s -> %s", 
+                task->client_fd, (int)strcspn(task->command, "\r\n"), task->command, response);
+    trace_end(task->trace, type);
+    task_done(task);
+}
+
+static void run_task_coro(void *arg) {
+    run_task((Task *)arg);
+}
+
+// Coroutine worker: every task runs as a coroutine, and one that waits
+// (the simulated delay) yields the thread to the others. The worker keeps
+// taking tasks while it has free coroutines, and otherwise sleeps until
+// the next coroutine is due or new work arrives.
+static void coro_worker_loop(void) {
+    Task task;
+    
+    while (1) {
+        while (coro_free_slots() > 0 && take_task(&task, 0)) {
+            if (coro_spawn(run_task_coro, &task, sizeof(task)) < 0) {
+                run_task(&task);  // No stack available: run it on the thread
+            }
+        }
         
-        // Fetch task from queue
-        Task task = thread_pool.queue[thread_pool.head];
-        thread_pool.head = (thread_pool.head + 1) % TASK_QUEUE_SIZE;
-        thread_pool.count--;
-        
-        // Signal that queue is not full
-        pthread_cond_signal(&thread_pool.queue_not_full);
-        pthread_mutex_unlock(&thread_pool.queue_lock);
-        
-        // Process the task: execute command and send response
-        char response[BUFFER_SIZE];
-        execute_command(task.command, response, sizeof(response));
-        
-        printf("[Worker] Processing task from FD %d: %s -> %s", 
-               task.client_fd, task.command, response);
+        uint64_t next_wake;
+        if (coro_run(&next_wake) > 0) {
+            if (coro_free_slots() > 0) {
+                wait_for_task(next_wake);
+            } else if (next_wake > metrics_now_ns()) {
+                uint64_t ns = next_wake - metrics_now_ns();
+                struct timespec ts = { (time_t)(ns / 1000000000ULL), (long)(ns % 1000000000ULL) };
+                nanosleep(&ts, NULL);
+            }
+            continue;
+        }
         
-        // Send response back to client
-        if (send(task.client_fd, response, strlen(response), 0) < 0) {
-            perror("send");
-            printf("[Worker] Failed to send response to FD %d\n", task.client_fd);
+        // Nothing in flight: block for the next task, or exit on shutdown
+        if (!take_task(&task, 1)) break;
+        if (coro_spawn(run_task_coro, &task, sizeof(task)) < 0) {
+            run_task(&task);
         }
     }
+}
+
+// Worker thread function
+void* worker_thread(void *arg) {
+    // Pin before touching anything, so per-thread state (metric shard, log
+    // ring, stack) is first touched on this CPU's NUMA node
+    affinity_pin_worker((int)(intptr_t)arg, "Worker");
+    // Blocking one of many workers on a duplicate's original is fine
+    dedup_allow_waiting();
+    
+    if (coros_per_worker > 0) {
+        if (coro_sched_init(coros_per_worker) == 0) {
+            coro_worker_loop();
+            coro_sched_free();
+            return NULL;
+        }
+        logger_error("[Worker] Could not set up coroutines, running one task at a time");
+    }
+    
+    Task task;
+    while (take_task(&task, 1)) {
+        run_task(&task);
+    }
     
     return NULL;
 }
@@ -83,38 +305,106 @@ void* worker_thread(void *arg) {
 void thread_pool_init(int num_workers) {
     if (num_workers > THREAD_POOL_SIZE) num_workers = THREAD_POOL_SIZE;
     
-    thread_pool.head = 0;
-    thread_pool.tail = 0;
+    for (int i = 0; i < LANE_COUNT; i++) {
+        thread_pool.lanes[i].head = 0;
+        thread_pool.lanes[i].tail = 0;
+        thread_pool.lanes[i].count = 0;
+    }
+    if (thread_pool.lanes[LANE_READ].weight == 0) {
+        thread_pool_set_lane_weights(LANE_WEIGHT_READ, LANE_WEIGHT_WRITE, LANE_WEIGHT_BULK);
+    }
     thread_pool.count = 0;
+    thread_pool.active = 0;
+    thread_pool.current_lane = LANE_READ;
+    thread_pool.turn_remaining = thread_pool.lanes[LANE_READ].weight;
     thread_pool.shutdown = 0;
     
     pthread_mutex_init(&thread_pool.queue_lock, NULL);
     pthread_cond_init(&thread_pool.queue_not_empty, NULL);
     pthread_cond_init(&thread_pool.queue_not_full, NULL);
+    pthread_cond_init(&thread_pool.pool_idle, NULL);
     
+    thread_pool.num_workers = num_workers;
     for (int i = 0; i < num_workers; i++) {
-        pthread_create(&thread_pool.workers[i], NULL, worker_thread, NULL);
+        pthread_create(&thread_pool.workers[i], NULL, worker_thread, (void *)(intptr_t)i);
     }
     
-    printf("[ThreadPool] Initialized with %d workers\n", num_workers);
+    thread_pool.running = 1;
+    metrics_set_queue_depth_source(thread_pool_queue_depth);
+    if (coros_per_worker > 0) {
+        logger_info("[ThreadPool] Initialized with %d workers x %d coroutines",
+                    num_workers, coros_per_worker);
+    } else {
+        logger_info("[ThreadPool] Initialized with %d workers", num_workers);
+    }
 }
 
-// Submit a task to the queue
-int submit_task(int client_fd, const char *command) {
+// Set the read/write/bulk lane weights (tasks per turn, minimum 1)
+void thread_pool_set_lane_weights(int read, int write, int bulk) {
+    thread_pool.lanes[LANE_READ].weight = read > 0 ? read : 1;
+    thread_pool.lanes[LANE_WRITE].weight = write > 0 ? write : 1;
+    thread_pool.lanes[LANE_BULK].weight = bulk > 0 ? bulk : 1;
+}
+
+void thread_pool_set_coroutines(int per_worker) {
+    if (per_worker > CORO_MAX_PER_THREAD) per_worker = CORO_MAX_PER_THREAD;
+    coros_per_worker = per_worker > 0 ? per_worker : 0;
+}
+
+void thread_pool_set_shed_ms(int ms) {
+    shed_threshold_ms = ms > 0 ? ms : 0;
+}
+
+// Would a task queued now wait longer than the shedding threshold?
+static int should_shed(void) {
+    if (shed_threshold_ms == 0 || thread_pool.num_workers == 0) return 0;
+    uint64_t avg = atomic_load_explicit(&avg_exec_ns, memory_order_relaxed);
+    uint64_t slots = (uint64_t)thread_pool.num_workers * (coros_per_worker > 0 ? coros_per_worker : 1);
+    uint64_t wait_ns = avg * (uint64_t)thread_pool.count / slots;
+    return wait_ns > (uint64_t)shed_threshold_ms * 1000000ULL;
+}
+
+// Submit a task to the queue. Returns -1 if it was shed instead.
+int submit_task(int client_fd, Buffer *buf, const char *command, int trace) {
+    ParsedCommand cmd = parse_command(command);
+    QueueLane lane_id = lane_for(cmd.type);
+    TaskLane *lane = &thread_pool.lanes[lane_id];
+    uint64_t now = metrics_now_ns();
+    
     pthread_mutex_lock(&thread_pool.queue_lock);
     
-    // Wait while queue is full
-    while (thread_pool.count >= TASK_QUEUE_SIZE) {
+    // Control commands are never shed: they're how an operator recovers
+    if (lane_id != LANE_ADMIN && should_shed()) {
+        pthread_mutex_unlock(&thread_pool.queue_lock);
+        char reply[64];
+        int len = snprintf(reply, sizeof(reply), "OVERLOADED %s -1\n", protocol_command_name(cmd.type));
+        len = protocol_frame_reply(cmd.tag, reply, sizeof(reply), len);
+        send(client_fd, reply, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        trace_end(trace, cmd.type);
+        metrics_record_shed();
+        buffer_release(buf);
+        return -1;
+    }
+    
+    // Wait while this lane is full
+    while (lane->count >= TASK_QUEUE_SIZE) {
         pthread_cond_wait(&thread_pool.queue_not_full, &thread_pool.queue_lock);
     }
     
     // Add task to queue
-    Task *task = &thread_pool.queue[thread_pool.tail];
+    Task *task = &lane->queue[lane->tail];
     task->client_fd = client_fd;
-    strncpy(task->command, command, sizeof(task->command) - 1);
-    task->command[sizeof(task->command) - 1] = '\0';
+    task->type = cmd.type;
+    task->enqueue_ns = now;
+    task->deadline_ns = cmd.ttl_ms > 0 ? now + (uint64_t)cmd.ttl_ms * 1000000ULL : 0;
+    task->tag = cmd.tag;
+    task->trace = trace;
+    trace_mark(trace, TRACE_ENQUEUE);
+    task->buf = buf;
+    task->command = command;
     
-    thread_pool.tail = (thread_pool.tail + 1) % TASK_QUEUE_SIZE;
+    lane->tail = (lane->tail + 1) % TASK_QUEUE_SIZE;
+    lane->count++;
     thread_pool.count++;
     
     // Signal that queue is not empty
@@ -124,18 +414,47 @@ int submit_task(int client_fd, const char *command) {
     return 0;
 }
 
+// Current number of queued (not yet started) tasks
+int thread_pool_queue_depth(void) {
+    pthread_mutex_lock(&thread_pool.queue_lock);
+    int depth = thread_pool.count;
+    pthread_mutex_unlock(&thread_pool.queue_lock);
+    return depth;
+}
+
+int thread_pool_running(void) {
+    return thread_pool.running;
+}
+
+// Block until every queued task has been executed and answered. Workers
+// stay up; the caller must not submit concurrently.
+void thread_pool_drain(void) {
+    if (!thread_pool.running) return;
+    
+    pthread_mutex_lock(&thread_pool.queue_lock);
+    while (thread_pool.count > 0 || thread_pool.active > 0) {
+        pthread_cond_wait(&thread_pool.pool_idle, &thread_pool.queue_lock);
+    }
+    pthread_mutex_unlock(&thread_pool.queue_lock);
+}
+
 // Gracefully shutdown the thread pool
 void thread_pool_shutdown() {
+    if (!thread_pool.running) return;
+    
     pthread_mutex_lock(&thread_pool.queue_lock);
     thread_pool.shutdown = 1;
     pthread_cond_broadcast(&thread_pool.queue_not_empty);
     pthread_mutex_unlock(&thread_pool.queue_lock);
     
-    for (int i = 0; i < THREAD_POOL_SIZE; i++) {
+    for (int i = 0; i < thread_pool.num_workers; i++) {
         pthread_join(thread_pool.workers[i], NULL);
     }
+    thread_pool.running = 0;
+    thread_pool.num_workers = 0;
     
     pthread_mutex_destroy(&thread_pool.queue_lock);
     pthread_cond_destroy(&thread_pool.queue_not_empty);
     pthread_cond_destroy(&thread_pool.queue_not_full);
+    pthread_cond_destroy(&thread_pool.pool_idle);
 }
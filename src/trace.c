@@ -0,0 +1,182 @@
+// trace.c - Sampled per-request tracing
+// ============================================================================
+// The reactor picks one request in every sample_every and gives it a span
+// from a small fixed table. The span travels with the request (as an index
+// in the Task or partition Request) and each stage stamps it with
+// metrics_now_ns(). Stamps need no atomics: a span is only touched by one
+// thread at a time, and the queue locks order the hand-offs.
+//
+// Account locks are taken deep inside transactions.c, which has no idea
+// which request it is serving, so the executing thread (or coroutine, since
+// several share a worker) registers its span as the current one and
+// trace_mark_lock() stamps that.
+//
+// A finished span becomes a 32-byte record: the read time plus 32-bit
+// offsets for the later stages. Records go to a ring in a MAP_SHARED file,
+// so the trace survives a crash and trace_dump can read it while the server
+// runs. A writer zeroes start_ns before filling a slot and sets it last;
+// a reader that races a writer can still see a torn record, which only
+// costs one wrong span in a diagnostic dump.
+// ============================================================================
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "../include/trace.h"
+#include "../include/coro.h"
+#include "../include/logger.h"
+#include "../include/metrics.h"
+
+#define TRACE_INFLIGHT 1024   // Sampled requests in flight at once
+#define TRACE_PROBES   8      // Busy slots skipped before giving up on a sample
+
+typedef struct {
+    _Atomic int busy;
+    uint64_t ts[TRACE_STAGE_COUNT];   // 0 = stage not reached
+} Span;
+
+static Span spans[TRACE_INFLIGHT];
+static int sample_every = 0;         // 0 = tracing off
+
+// Only the reactor starts spans
+static int sample_countdown = 0;
+static int next_slot = 0;
+
+static TraceHeader *header = NULL;
+static TraceRecord *ring = NULL;
+static size_t map_size = 0;
+static const char *trace_path = NULL;
+
+static __thread Span *current = NULL;       // Outside coroutines
+static __thread uint16_t thread_number = 0;
+static _Atomic int threads_seen = 0;
+
+int trace_init(int every, const char *path) {
+    if (every <= 0) return 0;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        logger_error("[Trace] Could not open %s: %s", path, strerror(errno));
+        return -1;
+    }
+    map_size = sizeof(TraceHeader) + (size_t)TRACE_RING_RECORDS * sizeof(TraceRecord);
+    if (ftruncate(fd, (off_t)map_size) < 0) {
+        logger_error("[Trace] Could not size %s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);  // The mapping keeps the file
+    if (map == MAP_FAILED) {
+        logger_error("[Trace] Could not map %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    header = map;
+    ring = (TraceRecord *)(header + 1);
+    memcpy(header->magic, TRACE_MAGIC, sizeof(header->magic));
+    header->record_size = sizeof(TraceRecord);
+    header->capacity = TRACE_RING_RECORDS;
+    header->written = 0;
+
+    trace_path = path;
+    sample_countdown = every;
+    sample_every = every;
+    logger_info("[Trace] Sampling 1 in %d requests into %s", every, path);
+    return 0;
+}
+
+void trace_name_type(int type, const char *name) {
+    if (!header || type < 0 || type >= TRACE_TYPE_MAX) return;
+    snprintf(header->type_names[type], TRACE_NAME_MAX, "%s", name);
+}
+
+// Call once nothing can finish a span any more (workers stopped)
+void trace_shutdown(void) {
+    if (!header) return;
+    sample_every = 0;
+    logger_info("[Trace] %llu spans written to %s",
+                (unsigned long long)header->written, trace_path);
+    munmap(header, map_size);
+    header = NULL;
+    ring = NULL;
+}
+
+int trace_enabled(void) {
+    return sample_every > 0;
+}
+
+int trace_begin(uint64_t read_ns) {
+    if (sample_every == 0 || --sample_countdown > 0) return 0;
+    sample_countdown = sample_every;
+
+    for (int probe = 0; probe < TRACE_PROBES; probe++) {
+        Span *span = &spans[next_slot];
+        int slot = next_slot;
+        next_slot = (next_slot + 1) % TRACE_INFLIGHT;
+
+        if (atomic_load_explicit(&span->busy, memory_order_acquire)) continue;
+        atomic_store_explicit(&span->busy, 1, memory_order_relaxed);
+        memset(span->ts, 0, sizeof(span->ts));
+        span->ts[TRACE_READ] = read_ns ? read_ns : metrics_now_ns();
+        return slot + 1;
+    }
+    return 0;  // Every probed span still in flight: skip this sample
+}
+
+void trace_mark(int span, TraceStage stage) {
+    if (span == 0) return;
+    spans[span - 1].ts[stage] = metrics_now_ns();
+}
+
+static uint16_t this_thread(void) {
+    if (thread_number == 0) {
+        thread_number = (uint16_t)(atomic_fetch_add(&threads_seen, 1) + 1);
+    }
+    return thread_number;
+}
+
+void trace_end(int span_id, int type) {
+    if (span_id == 0) return;
+    Span *span = &spans[span_id - 1];
+    span->ts[TRACE_SEND_DONE] = metrics_now_ns();
+
+    uint64_t n = __atomic_fetch_add(&header->written, 1, __ATOMIC_RELAXED);
+    TraceRecord *rec = &ring[n & (TRACE_RING_RECORDS - 1)];
+    uint64_t start = span->ts[TRACE_READ];
+
+    __atomic_store_n(&rec->start_ns, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (int s = 1; s < TRACE_STAGE_COUNT; s++) {
+        uint64_t ts = span->ts[s];
+        uint64_t offset = ts > start ? ts - start : 0;
+        rec->offset_ns[s - 1] = ts == 0 ? TRACE_SKIPPED
+                              : offset >= TRACE_SKIPPED ? TRACE_SKIPPED - 1 : (uint32_t)offset;
+    }
+    rec->type = (uint16_t)type;
+    rec->thread = this_thread();
+    __atomic_store_n(&rec->start_ns, start, __ATOMIC_RELEASE);
+
+    atomic_store_explicit(&span->busy, 0, memory_order_release);
+}
+
+void trace_set_current(int span) {
+    if (sample_every == 0) return;
+    Span *s = span ? &spans[span - 1] : NULL;
+    if (coro_active()) {
+        coro_set_local(s);
+    } else {
+        current = s;
+    }
+}
+
+void trace_mark_lock(void) {
+    if (sample_every == 0) return;
+    Span *s = coro_active() ? coro_get_local() : current;
+    if (s) s->ts[TRACE_LOCK] = metrics_now_ns();
+}
@@ -0,0 +1,140 @@
+// trace_dump.c - Convert the server's trace ring to Chrome trace-event JSON
+// ============================================================================
+// Reads the file written by `server --trace-sample N` (it can do so while
+// the server is running) and prints one nested async span per traced
+// request: the whole request, named after its command, split into the
+// phases between the stages it passed. Each phase is named for the stage
+// that ends it, so a request answered on the reactor has no "queued"
+// phase. Load the output in chrome://tracing or ui.perfetto.dev.
+//
+// Async events are used instead of complete ("X") events because a
+// coroutine worker interleaves several requests on one thread, and
+// complete events on one thread must nest.
+// ============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../include/trace.h"
+
+#define DEFAULT_TRACE_FILE "bank.trace"
+
+// Phase ending at each stage (TRACE_READ starts the request)
+static const char *const phase_names[TRACE_STAGE_COUNT] = {
+    [TRACE_ENQUEUE]   = "dispatch",
+    [TRACE_DEQUEUE]   = "queued",
+    [TRACE_LOCK]      = "to lock",
+    [TRACE_EXEC_DONE] = "execute",
+    [TRACE_SEND_DONE] = "send",
+};
+
+static int first_event = 1;
+
+static void emit(FILE *out, const char *name, char ph, uint64_t id, uint64_t ns, int thread) {
+    fprintf(out, "%s\n{\"name\":\"%s\",\"cat\":\"request\",\"ph\":\"%c\",\"id\":%llu,"
+                 "\"ts\":%llu.%03llu,\"pid\":1,\"tid\":%d}",
+            first_event ? "" : ",", name, ph, (unsigned long long)id,
+            (unsigned long long)(ns / 1000), (unsigned long long)(ns % 1000), thread);
+    first_event = 0;
+}
+
+// Emit one record as a request span with its phases nested inside
+static void emit_record(FILE *out, const TraceHeader *hdr, const TraceRecord *rec,
+                        uint64_t id, uint64_t base_ns) {
+    char type_name[TRACE_NAME_MAX + 8];
+    if (rec->type < TRACE_TYPE_MAX && hdr->type_names[rec->type][0]) {
+        snprintf(type_name, sizeof(type_name), "%.*s", TRACE_NAME_MAX, hdr->type_names[rec->type]);
+    } else {
+        snprintf(type_name, sizeof(type_name), "TYPE_%u", rec->type);
+    }
+
+    uint64_t start = rec->start_ns - base_ns;
+    uint64_t end = start + rec->offset_ns[TRACE_SEND_DONE - 1];
+
+    emit(out, type_name, 'b', id, start, rec->thread);
+    uint64_t prev = start;
+    for (int s = 1; s < TRACE_STAGE_COUNT; s++) {
+        if (rec->offset_ns[s - 1] == TRACE_SKIPPED) continue;
+        uint64_t at = start + rec->offset_ns[s - 1];
+        emit(out, phase_names[s], 'b', id, prev, rec->thread);
+        emit(out, phase_names[s], 'e', id, at, rec->thread);
+        prev = at;
+    }
+    emit(out, type_name, 'e', id, end, rec->thread);
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = DEFAULT_TRACE_FILE;
+    const char *out_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if (argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            printf("Usage: %s [-o out.json] [trace file (default %s)]\n", argv[0], DEFAULT_TRACE_FILE);
+            return strcmp(argv[i], "-h") == 0 ? 0 : 1;
+        }
+    }
+
+    FILE *in = fopen(path, "rb");
+    if (!in) {
+        perror(path);
+        return 1;
+    }
+
+    TraceHeader hdr;
+    if (fread(&hdr, sizeof(hdr), 1, in) != 1 || memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.record_size != sizeof(TraceRecord) || hdr.capacity == 0 ||
+        (hdr.capacity & (hdr.capacity - 1)) != 0) {
+        fprintf(stderr, "%s is not a trace file from this server version\n", path);
+        fclose(in);
+        return 1;
+    }
+
+    TraceRecord *ring = malloc((size_t)hdr.capacity * sizeof(TraceRecord));
+    if (!ring || fread(ring, sizeof(TraceRecord), hdr.capacity, in) != hdr.capacity) {
+        fprintf(stderr, "%s is truncated\n", path);
+        free(ring);
+        fclose(in);
+        return 1;
+    }
+    fclose(in);
+
+    // Oldest surviving record first; earlier ones were overwritten
+    uint64_t written = hdr.written;
+    uint64_t first = written > hdr.capacity ? written - hdr.capacity : 0;
+    uint64_t base_ns = UINT64_MAX;
+    for (uint64_t n = first; n < written; n++) {
+        const TraceRecord *rec = &ring[n & (hdr.capacity - 1)];
+        if (rec->start_ns && rec->start_ns < base_ns) base_ns = rec->start_ns;
+    }
+
+    FILE *out = out_path ? fopen(out_path, "w") : stdout;
+    if (!out) {
+        perror(out_path);
+        free(ring);
+        return 1;
+    }
+
+    uint64_t spans = 0;
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (uint64_t n = first; n < written; n++) {
+        const TraceRecord *rec = &ring[n & (hdr.capacity - 1)];
+        if (rec->start_ns == 0 || rec->offset_ns[TRACE_SEND_DONE - 1] == TRACE_SKIPPED) {
+            continue;  // Being written when the file was read
+        }
+        emit_record(out, &hdr, rec, n + 1, base_ns);
+        spans++;
+    }
+    fprintf(out, "\n]}\n");
+
+    fprintf(stderr, "%llu spans (%llu traced, %llu overwritten)\n", (unsigned long long)spans,
+            (unsigned long long)written, (unsigned long long)first);
+    if (out != stdout) fclose(out);
+    free(ring);
+    return 0;
+}
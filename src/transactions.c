@@ -1,12 +1,43 @@
+#define _GNU_SOURCE  // sched_getcpu()
 #include "../include/bank.h"
+#include "../include/metrics.h"
+#include "../include/history.h"
+#include "../include/replication.h"
+#include "../include/trace.h"
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
 
 // Global state
 Account *bank[MAX_ACCOUNTS];
 pthread_mutex_t bank_state_lock;
 int next_account_id = 0;
 
+// Lock profiling state: one cache line per account so that counting doesn't
+// add false sharing between accounts on top of the contention we measure
+typedef struct {
+    _Atomic uint64_t acquisitions;
+    _Atomic uint64_t contended;
+    _Atomic uint64_t wait_ns;
+} __attribute__((aligned(64))) LockStats;
+
+static LockStats lock_stats[MAX_ACCOUNTS];
+static _Atomic int lock_profiling = 0;
+
+// Set once at startup by the partitioned engine: every account has exactly
+// one owning thread, so account mutexes are skipped entirely
+static int single_writer = 0;
+
+// Optimistic transfer state
+#define OCC_MAX_RETRIES 8   // Conflicts tolerated before falling back to blocking locks
+
+static _Atomic int transfer_mode = TRANSFER_PESSIMISTIC;
+static _Atomic uint64_t occ_commits = 0;
+static _Atomic uint64_t occ_retries = 0;
+static _Atomic uint64_t occ_fallbacks = 0;
+
 void init_bank() {
     pthread_mutex_init(&bank_state_lock, NULL);
     for (int i = 0; i < MAX_ACCOUNTS; i++) {
@@ -21,19 +52,240 @@ Account* get_account(int id) {
     return bank[id]; 
 }
 
-// Create a new account with a unique ID
-int create_account() {
+// Lock one of account `id`'s mutexes, timing the wait only when contended
+static void lock_profiled(pthread_mutex_t *lock, int id) {
+    if (single_writer) return;
+    
+    int profiling = atomic_load_explicit(&lock_profiling, memory_order_relaxed);
+    
+    if (pthread_mutex_trylock(lock) == 0) {
+        if (profiling) {
+            atomic_fetch_add_explicit(&lock_stats[id].acquisitions, 1, memory_order_relaxed);
+        }
+        trace_mark_lock();
+        return;
+    }
+    
+    uint64_t start = metrics_now_ns();
+    pthread_mutex_lock(lock);
+    uint64_t waited = metrics_now_ns() - start;
+    trace_mark_lock();
+    metrics_record_lock_wait(waited);
+    
+    if (profiling) {
+        LockStats *st = &lock_stats[id];
+        atomic_fetch_add_explicit(&st->acquisitions, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&st->contended, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&st->wait_ns, waited, memory_order_relaxed);
+    }
+}
+
+// Non-blocking variant for optimistic transfers. A failed try counts as
+// contended; the caller reports its back-off with occ_backoff_profiled.
+static int trylock_profiled(pthread_mutex_t *lock, int id) {
+    int profiling = atomic_load_explicit(&lock_profiling, memory_order_relaxed);
+    
+    if (pthread_mutex_trylock(lock) != 0) {
+        if (profiling) {
+            atomic_fetch_add_explicit(&lock_stats[id].contended, 1, memory_order_relaxed);
+        }
+        return -1;
+    }
+    
+    if (profiling) {
+        atomic_fetch_add_explicit(&lock_stats[id].acquisitions, 1, memory_order_relaxed);
+    }
+    trace_mark_lock();
+    return 0;
+}
+
+// Time an optimistic transfer spent backing off from account `id`'s lock
+static void occ_backoff_profiled(int id, uint64_t waited) {
+    metrics_record_lock_wait(waited);
+    if (atomic_load_explicit(&lock_profiling, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&lock_stats[id].wait_ns, waited, memory_order_relaxed);
+    }
+}
+
+static void unlock_profiled(pthread_mutex_t *lock) {
+    if (single_writer) return;
+    pthread_mutex_unlock(lock);
+}
+
+// Lock a whole account. For a striped account this takes every stripe in
+// index order, which extends the by-ID lock ordering to (ID, stripe).
+static void lock_account(Account *acc) {
+    if (acc->stripes) {
+        for (int i = 0; i < ACCOUNT_STRIPES; i++) {
+            lock_profiled(&acc->stripes[i].lock, acc->id);
+        }
+    } else {
+        lock_profiled(&acc->lock, acc->id);
+    }
+}
+
+static void unlock_account(Account *acc) {
+    if (acc->stripes) {
+        for (int i = ACCOUNT_STRIPES - 1; i >= 0; i--) {
+            unlock_profiled(&acc->stripes[i].lock);
+        }
+    } else {
+        unlock_profiled(&acc->lock);
+    }
+}
+
+// Sort accounts by ID and lock them in that order. Every multi-account
+// operation goes through here, so all of them agree on one global lock order.
+static void lock_in_id_order(Account **accs, int n) {
+    for (int i = 1; i < n; i++) {
+        Account *a = accs[i];
+        int j = i - 1;
+        while (j >= 0 && accs[j]->id > a->id) {
+            accs[j + 1] = accs[j];
+            j--;
+        }
+        accs[j + 1] = a;
+    }
+    for (int i = 0; i < n; i++) {
+        lock_account(accs[i]);
+    }
+}
+
+static void unlock_in_id_order(Account **accs, int n) {
+    for (int i = n - 1; i >= 0; i--) {
+        unlock_account(accs[i]);
+    }
+}
+
+// Stripe used by the calling thread: spreads concurrent depositors by CPU
+static int local_stripe(void) {
+    int cpu = sched_getcpu();
+    return (cpu < 0 ? 0 : cpu) % ACCOUNT_STRIPES;
+}
+
+// Balance of an account whose locks are all held
+static double held_balance(const Account *acc) {
+    if (!acc->stripes) return acc->balance;
+    
+    double total = 0.0;
+    for (int i = 0; i < ACCOUNT_STRIPES; i++) {
+        total += acc->stripes[i].balance;
+    }
+    return total;
+}
+
+// Every committed balance change goes to the account's history and, on a
+// replication primary, to the replication log
+static void record_change(Account *acc, double delta, int counterparty) {
+    history_record(acc->history, delta, counterparty);
+    repl_log_change(acc->id, delta, counterparty);
+}
+
+// Publish a plain account's new balance, then bump its version. Optimistic
+// readers load the version before the balance, so a reader that sees the new
+// balance with the old version fails validation and retries.
+static void set_plain_balance(Account *acc, double balance) {
+    __atomic_store(&acc->balance, &balance, __ATOMIC_RELAXED);
+    __atomic_store_n(&acc->version, acc->version + 1, __ATOMIC_RELEASE);
+}
+
+static void held_credit(Account *acc, double amount) {
+    if (acc->stripes) {
+        acc->stripes[local_stripe()].balance += amount;
+    } else {
+        set_plain_balance(acc, acc->balance + amount);
+    }
+}
+
+// Debit an account whose locks are all held; caller checked the funds
+static void held_debit(Account *acc, double amount) {
+    if (!acc->stripes) {
+        set_plain_balance(acc, acc->balance - amount);
+        return;
+    }
+    
+    // Drain stripes starting with our own until the amount is covered
+    int first = local_stripe();
+    double remaining = amount;
+    for (int n = 0; n < ACCOUNT_STRIPES && remaining > 0; n++) {
+        AccountStripe *st = &acc->stripes[(first + n) % ACCOUNT_STRIPES];
+        double take = (st->balance < remaining) ? st->balance : remaining;
+        if (take > 0) {
+            st->balance -= take;
+            remaining -= take;
+        }
+    }
+    // Rounding dust from summing the stripes lands on the local stripe
+    if (remaining > 0) acc->stripes[first].balance -= remaining;
+}
+
+void bank_set_single_writer(int enabled) {
+    single_writer = enabled;
+}
+
+void bank_set_lock_profiling(int enabled) {
+    atomic_store(&lock_profiling, enabled ? 1 : 0);
+}
+
+int bank_get_lock_profiling(void) {
+    return atomic_load(&lock_profiling);
+}
+
+void bank_reset_lock_profile(void) {
+    for (int i = 0; i < MAX_ACCOUNTS; i++) {
+        atomic_store_explicit(&lock_stats[i].acquisitions, 0, memory_order_relaxed);
+        atomic_store_explicit(&lock_stats[i].contended, 0, memory_order_relaxed);
+        atomic_store_explicit(&lock_stats[i].wait_ns, 0, memory_order_relaxed);
+    }
+}
+
+// Ordering for the contention report: wait time, then contended count, then
+// raw acquisitions (so hot accounts show up even before they start blocking)
+static int more_contended(const AccountLockReport *a, const AccountLockReport *b) {
+    if (a->wait_ns != b->wait_ns) return a->wait_ns > b->wait_ns;
+    if (a->contended != b->contended) return a->contended > b->contended;
+    return a->acquisitions > b->acquisitions;
+}
+
+// Fill out[] with the most contended accounts, worst first
+int bank_top_contended(AccountLockReport *out, int max) {
+    int found = 0;
+    
+    for (int i = 0; i < MAX_ACCOUNTS; i++) {
+        AccountLockReport r;
+        r.acquisitions = atomic_load_explicit(&lock_stats[i].acquisitions, memory_order_relaxed);
+        if (r.acquisitions == 0) continue;
+        
+        r.id = i;
+        r.contended = atomic_load_explicit(&lock_stats[i].contended, memory_order_relaxed);
+        r.wait_ns = atomic_load_explicit(&lock_stats[i].wait_ns, memory_order_relaxed);
+        
+        // Insertion into the small sorted top-N list
+        int pos = (found < max) ? found++ : max;
+        while (pos > 0 && more_contended(&r, &out[pos - 1])) {
+            if (pos < max) out[pos] = out[pos - 1];
+            pos--;
+        }
+        if (pos < max) out[pos] = r;
+    }
+    
+    return found;
+}
+
+// Create a new account, at `id` or (id < 0) at the next unused ID. IDs
+// placed by the shard proxy may leave gaps below next_account_id; those
+// slots are only ever filled by another placed create.
+static int create_account_internal(int striped, int id) {
     pthread_mutex_lock(&bank_state_lock);
     
-    if (next_account_id >= MAX_ACCOUNTS) {
+    int new_id = (id < 0) ? next_account_id : id;
+    if (new_id >= MAX_ACCOUNTS || bank[new_id] != NULL) {
         pthread_mutex_unlock(&bank_state_lock);
-        return -1; // Out of space
+        return -1; // Out of space, or the ID is taken
     }
     
-    int new_id = next_account_id++;
-    
     // Allocate and initialize new account
-    Account *acc = (Account *)malloc(sizeof(Account));
+    Account *acc = (Account *)aligned_alloc(64, sizeof(Account));
     if (!acc) {
         pthread_mutex_unlock(&bank_state_lock);
         return -1;
@@ -41,45 +293,279 @@ int create_account() {
     
     acc->id = new_id;
     acc->balance = 0.0;
+    acc->version = 0;
+    acc->stripes = NULL;
+    acc->history = history_ring_alloc();
     pthread_mutex_init(&acc->lock, NULL);
     
+    if (!acc->history) {
+        pthread_mutex_destroy(&acc->lock);
+        free(acc);
+        pthread_mutex_unlock(&bank_state_lock);
+        return -1;
+    }
+    
+    if (striped) {
+        acc->stripes = (AccountStripe *)aligned_alloc(64, sizeof(AccountStripe) * ACCOUNT_STRIPES);
+        if (!acc->stripes) {
+            history_ring_free(acc->history);
+            pthread_mutex_destroy(&acc->lock);
+            free(acc);
+            pthread_mutex_unlock(&bank_state_lock);
+            return -1;
+        }
+        for (int i = 0; i < ACCOUNT_STRIPES; i++) {
+            pthread_mutex_init(&acc->stripes[i].lock, NULL);
+            acc->stripes[i].balance = 0.0;
+        }
+    }
+    
     bank[new_id] = acc;
+    if (new_id >= next_account_id) next_account_id = new_id + 1;
+    // Logged under bank_state_lock, so log order is creation order
+    repl_log_create(new_id, striped);
     pthread_mutex_unlock(&bank_state_lock);
     
     return new_id;
 }
 
-// Deposit funds into an account
-int deposit(int id, double amount) {
+int create_account() {
+    repl_write_begin();
+    int id = create_account_internal(0, -1);
+    repl_write_end();
+    return id;
+}
+
+int create_striped_account() {
+    repl_write_begin();
+    int id = create_account_internal(1, -1);
+    repl_write_end();
+    return id;
+}
+
+int create_account_with_id(int id, int striped) {
+    if (id < 0) return -1;
+    repl_write_begin();
+    int result = create_account_internal(striped, id);
+    repl_write_end();
+    return result;
+}
+
+// Credit an account and record it against `counterparty` (-1 for none)
+static int credit_account(int id, double amount, int counterparty) {
     Account *acc = get_account(id);
     if (!acc || amount <= 0) return -1;
 
-    pthread_mutex_lock(&acc->lock);
-    acc->balance += amount;
-    pthread_mutex_unlock(&acc->lock);
+    if (acc->stripes) {
+        // Striped: only this CPU's stripe is touched, so depositors on
+        // different CPUs never contend
+        AccountStripe *st = &acc->stripes[local_stripe()];
+        lock_profiled(&st->lock, id);
+        st->balance += amount;
+        record_change(acc, amount, counterparty);
+        unlock_profiled(&st->lock);
+        return 1;
+    }
+
+    lock_account(acc);
+    held_credit(acc, amount);
+    record_change(acc, amount, counterparty);
+    unlock_account(acc);
     
     return 1;
 }
 
-// Withdraw funds from an account
-int withdraw(int id, double amount) {
+// Debit an account if it has the funds, recording it against `counterparty`
+static int debit_account(int id, double amount, int counterparty) {
     Account *acc = get_account(id);
     if (!acc || amount <= 0) return -1;
 
-    pthread_mutex_lock(&acc->lock);
+    if (acc->stripes) {
+        // Fast path: the local stripe alone covers the withdrawal
+        AccountStripe *st = &acc->stripes[local_stripe()];
+        lock_profiled(&st->lock, id);
+        if (st->balance >= amount) {
+            st->balance -= amount;
+            record_change(acc, -amount, counterparty);
+            unlock_profiled(&st->lock);
+            return 1;
+        }
+        unlock_profiled(&st->lock);
+    }
+
+    lock_account(acc);
     
     int success = 0;
-    if (acc->balance >= amount) {
-        acc->balance -= amount;
+    if (held_balance(acc) >= amount) {
+        held_debit(acc, amount);
+        record_change(acc, -amount, counterparty);
         success = 1;
     }
 
-    pthread_mutex_unlock(&acc->lock);
+    unlock_account(acc);
     return success;
 }
 
+// Deposit funds into an account
+int deposit(int id, double amount) {
+    repl_write_begin();
+    int result = credit_account(id, amount, -1);
+    repl_write_end();
+    return result;
+}
+
+// Withdraw funds from an account
+int withdraw(int id, double amount) {
+    repl_write_begin();
+    int result = debit_account(id, amount, -1);
+    repl_write_end();
+    return result;
+}
+
+int transfer_debit(int from_id, int to_id, double amount) {
+    repl_write_begin();
+    int result = debit_account(from_id, amount, to_id);
+    repl_write_end();
+    return result;
+}
+
+int transfer_credit(int to_id, int from_id, double amount) {
+    repl_write_begin();
+    int result = credit_account(to_id, amount, from_id);
+    repl_write_end();
+    return result;
+}
+
+// Replication follower: recreate an account the primary logged
+int bank_replica_create(int id, int striped) {
+    return create_account_with_id(id, striped) == id ? 0 : -1;
+}
+
+// Replication follower: overwrite a balance from a primary snapshot
+int bank_replica_set_balance(int id, double balance) {
+    Account *acc = get_account(id);
+    if (!acc) return -1;
+    
+    lock_account(acc);
+    if (acc->stripes) {
+        for (int i = 0; i < ACCOUNT_STRIPES; i++) {
+            acc->stripes[i].balance = (i == 0) ? balance : 0.0;
+        }
+    } else {
+        set_plain_balance(acc, balance);
+    }
+    unlock_account(acc);
+    return 0;
+}
+
+// Replication follower: apply a logged change as-is. The primary already
+// checked the funds, and changes to one account commute, so a delta that
+// arrives ahead of an earlier-committed one still ends at the right balance.
+int bank_replica_apply(int id, double delta, int counterparty) {
+    Account *acc = get_account(id);
+    if (!acc) return -1;
+    
+    repl_write_begin();
+    if (acc->stripes) {
+        AccountStripe *st = &acc->stripes[0];
+        lock_profiled(&st->lock, id);
+        st->balance += delta;
+        record_change(acc, delta, counterparty);
+        unlock_profiled(&st->lock);
+    } else {
+        lock_account(acc);
+        set_plain_balance(acc, acc->balance + delta);
+        record_change(acc, delta, counterparty);
+        unlock_account(acc);
+    }
+    repl_write_end();
+    return 0;
+}
+
+void bank_set_transfer_mode(TransferMode mode) {
+    atomic_store(&transfer_mode, mode);
+}
+
+TransferMode bank_get_transfer_mode(void) {
+    return (TransferMode)atomic_load(&transfer_mode);
+}
+
+void bank_get_occ_stats(uint64_t *commits, uint64_t *retries, uint64_t *fallbacks) {
+    *commits = atomic_load(&occ_commits);
+    *retries = atomic_load(&occ_retries);
+    *fallbacks = atomic_load(&occ_fallbacks);
+}
+
+// Optimistic transfer between two plain accounts. Snapshot both versions and
+// the source balance without locking, then validate: trylock both (in ID
+// order, never blocking) and commit only if neither version moved. Any
+// conflict releases everything and retries. Returns -2 when it gives up.
+static int transfer_optimistic(Account *from, Account *to, double amount) {
+    Account *first = (from->id < to->id) ? from : to;
+    Account *second = (from->id < to->id) ? to : from;
+    
+    for (int attempt = 0; attempt < OCC_MAX_RETRIES; attempt++) {
+        uint64_t from_version = __atomic_load_n(&from->version, __ATOMIC_ACQUIRE);
+        uint64_t to_version = __atomic_load_n(&to->version, __ATOMIC_ACQUIRE);
+        double balance;
+        __atomic_load(&from->balance, &balance, __ATOMIC_RELAXED);
+        
+        if (balance < amount) {
+            // A consistent read can reject without taking any lock. The fence
+            // keeps the balance load from moving below the version re-check.
+            atomic_thread_fence(memory_order_acquire);
+            if (__atomic_load_n(&from->version, __ATOMIC_RELAXED) == from_version) return 0;
+            atomic_fetch_add_explicit(&occ_retries, 1, memory_order_relaxed);
+            continue;
+        }
+        
+        int busy_id = -1;   // Account whose lock we failed to get
+        if (trylock_profiled(&first->lock, first->id) == 0) {
+            if (trylock_profiled(&second->lock, second->id) == 0) {
+                if (from->version == from_version && to->version == to_version) {
+                    set_plain_balance(from, from->balance - amount);
+                    set_plain_balance(to, to->balance + amount);
+                    record_change(from, -amount, to->id);
+                    record_change(to, amount, from->id);
+                    pthread_mutex_unlock(&second->lock);
+                    pthread_mutex_unlock(&first->lock);
+                    atomic_fetch_add_explicit(&occ_commits, 1, memory_order_relaxed);
+                    return 1;
+                }
+                pthread_mutex_unlock(&second->lock);
+            } else {
+                busy_id = second->id;
+            }
+            pthread_mutex_unlock(&first->lock);
+        } else {
+            busy_id = first->id;
+        }
+        
+        atomic_fetch_add_explicit(&occ_retries, 1, memory_order_relaxed);
+        if (busy_id < 0) {
+            sched_yield();
+        } else {
+            uint64_t start = metrics_now_ns();
+            sched_yield();
+            occ_backoff_profiled(busy_id, metrics_now_ns() - start);
+        }
+    }
+    
+    atomic_fetch_add_explicit(&occ_fallbacks, 1, memory_order_relaxed);
+    return -2;
+}
+
+static int transfer_internal(int from_id, int to_id, double amount);
+
 // Transfer from one account to another with deadlock avoidance
 int transfer(int from_id, int to_id, double amount) {
+    repl_write_begin();
+    int result = transfer_internal(from_id, to_id, amount);
+    repl_write_end();
+    return result;
+}
+
+static int transfer_internal(int from_id, int to_id, double amount) {
     if (from_id == to_id || amount <= 0) return -1;
     
     Account *from = get_account(from_id);
@@ -87,26 +573,116 @@ int transfer(int from_id, int to_id, double amount) {
     
     if (!from || !to) return -1;
     
-    // Lock in strict ordering (by ID) to prevent deadlock
-    int first_id = (from_id < to_id) ? from_id : to_id;
-    int second_id = (from_id < to_id) ? to_id : from_id;
-    
-    Account *first = (first_id == from_id) ? from : to;
-    Account *second = (second_id == from_id) ? from : to;
+    // Striped accounts take deposits under a single stripe lock without
+    // bumping a version, so they always use the pessimistic path
+    if (atomic_load_explicit(&transfer_mode, memory_order_relaxed) == TRANSFER_OPTIMISTIC &&
+        !single_writer && !from->stripes && !to->stripes) {
+        int result = transfer_optimistic(from, to, amount);
+        if (result != -2) return result;
+    }
     
-    pthread_mutex_lock(&first->lock);
-    pthread_mutex_lock(&second->lock);
+    // Lock in strict ordering (by ID) to prevent deadlock
+    Account *accs[2] = { from, to };
+    lock_in_id_order(accs, 2);
     
     int success = 0;
-    if (from->balance >= amount) {
-        from->balance -= amount;
-        to->balance += amount;
+    if (held_balance(from) >= amount) {
+        held_debit(from, amount);
+        held_credit(to, amount);
+        record_change(from, -amount, to_id);
+        record_change(to, amount, from_id);
         success = 1;
     }
     
-    pthread_mutex_unlock(&second->lock);
-    pthread_mutex_unlock(&first->lock);
+    unlock_in_id_order(accs, 2);
+    
+    return success;
+}
+
+static int execute_batch_internal(const TxnOp *ops, int count);
+
+// Execute a list of deposits/withdrawals/transfers atomically: every involved
+// account is locked once, in ID order, and either all ops apply or none do
+int execute_batch(const TxnOp *ops, int count) {
+    repl_write_begin();
+    int result = execute_batch_internal(ops, count);
+    repl_write_end();
+    return result;
+}
+
+static int execute_batch_internal(const TxnOp *ops, int count) {
+    if (count <= 0 || count > TXN_MAX_OPS) return -1;
+    
+    Account *accs[TXN_MAX_OPS * 2];
+    int n = 0;
+    
+    // Validate every op and collect the distinct accounts involved
+    for (int i = 0; i < count; i++) {
+        const TxnOp *op = &ops[i];
+        if (op->amount <= 0) return -1;
+        
+        int ids[2] = { op->account_id, op->target_id };
+        int num_ids = (op->type == TXN_TRANSFER) ? 2 : 1;
+        if (op->type == TXN_TRANSFER && op->account_id == op->target_id) return -1;
+        
+        for (int k = 0; k < num_ids; k++) {
+            Account *acc = get_account(ids[k]);
+            if (!acc) return -1;
+            
+            int seen = 0;
+            for (int j = 0; j < n; j++) {
+                if (accs[j] == acc) seen = 1;
+            }
+            if (!seen) accs[n++] = acc;
+        }
+    }
+    
+    lock_in_id_order(accs, n);
     
+    // Dry run against shadow balances: no account may go negative at any step
+    double shadow[TXN_MAX_OPS * 2];
+    for (int j = 0; j < n; j++) {
+        shadow[j] = held_balance(accs[j]);
+    }
+    
+    int success = 1;
+    for (int i = 0; i < count && success; i++) {
+        const TxnOp *op = &ops[i];
+        for (int j = 0; j < n; j++) {
+            if (accs[j]->id == op->account_id) {
+                if (op->type == TXN_DEPOSIT) {
+                    shadow[j] += op->amount;
+                } else if (shadow[j] >= op->amount) {
+                    shadow[j] -= op->amount;
+                } else {
+                    success = 0;
+                }
+            } else if (op->type == TXN_TRANSFER && accs[j]->id == op->target_id) {
+                shadow[j] += op->amount;
+            }
+        }
+    }
+    
+    if (success) {
+        for (int i = 0; i < count; i++) {
+            const TxnOp *op = &ops[i];
+            Account *acc = get_account(op->account_id);
+            if (op->type == TXN_DEPOSIT) {
+                held_credit(acc, op->amount);
+                record_change(acc, op->amount, -1);
+            } else {
+                held_debit(acc, op->amount);
+                record_change(acc, -op->amount, op->target_id);
+                if (op->type == TXN_TRANSFER) {
+                    Account *target = get_account(op->target_id);
+                    held_credit(target, op->amount);
+                    record_change(target, op->amount, op->account_id);
+                }
+            }
+        }
+    }
+    
+    unlock_in_id_order(accs, n);
     return success;
 }
 
@@ -115,9 +691,17 @@ double get_balance(int id) {
     Account *acc = get_account(id);
     if (!acc) return -1.0;
     
-    pthread_mutex_lock(&acc->lock);
-    double balance = acc->balance;
-    pthread_mutex_unlock(&acc->lock);
+    lock_account(acc);
+    double balance = held_balance(acc);
+    unlock_account(acc);
     
     return balance;
+}
+
+// Unlocked read for response messages: may be stale or, for striped accounts,
+// mid-update, but never blocks a hot account
+double peek_balance(int id) {
+    Account *acc = get_account(id);
+    if (!acc) return -1.0;
+    return held_balance(acc);
 }
\ No newline at end of file
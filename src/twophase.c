@@ -0,0 +1,167 @@
+// twophase.c - Prepared halves of cross-shard transfers
+// ============================================================================
+// The shard proxy runs a transfer between two servers as two prepared
+// halves. The debit half takes the money out at PREPARE, so once both halves
+// are prepared neither COMMIT can fail: COMMIT of the debit just forgets it,
+// COMMIT of the credit deposits the amount. ABORT refunds a prepared debit
+// (recorded in history as a credit from the same counterparty) and drops a
+// prepared credit.
+//
+// PREPARE reserves its entry under the table lock but runs the debit
+// without it, so a slow debit doesn't hold up every other transaction's
+// phases. A reserved entry already blocks a duplicate PREPARE; COMMIT and
+// ABORT only see it once it is published.
+//
+// A prepared half stays until its decision arrives. The proxy keeps no
+// decision log, so if it dies between the phases the halves are left here;
+// there is no timeout, because aborting on our own could undo a debit whose
+// credit was already committed on the other shard.
+// ============================================================================
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../include/twophase.h"
+#include "../include/bank.h"
+#include "../include/protocol.h"
+#include "../include/logger.h"
+
+#define TWOPHASE_BUCKETS 256
+
+typedef struct {
+    char txid[REQUEST_ID_MAX + 1];
+    int16_t next;      // Bucket chain, or free list when unused
+    int8_t is_debit;
+    int8_t ready;      // Published: the debit (if any) has been taken
+    int account_id;
+    int counterparty;
+    double amount;
+} Prepared;
+
+static Prepared table[TWOPHASE_MAX];
+static int16_t buckets[TWOPHASE_BUCKETS];
+static int16_t free_head;
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+static void init_table(void) {
+    for (int b = 0; b < TWOPHASE_BUCKETS; b++) {
+        buckets[b] = -1;
+    }
+    for (int i = 0; i < TWOPHASE_MAX; i++) {
+        table[i].next = (i + 1 < TWOPHASE_MAX) ? i + 1 : -1;
+    }
+    free_head = 0;
+}
+
+// FNV-1a
+static unsigned bucket_of(const char *txid) {
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)txid; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h % TWOPHASE_BUCKETS;
+}
+
+// Unlink entry `index` from its bucket chain (table_lock held)
+static void unlink_entry(unsigned b, int index) {
+    int16_t *link = &buckets[b];
+    while (*link != index) {
+        link = &table[*link].next;
+    }
+    *link = table[index].next;
+    table[index].next = free_head;
+    free_head = index;
+}
+
+// Unlink the published entry txid prepared on account_id and return it,
+// or -1 (table_lock held)
+static int take(const char *txid, int account_id) {
+    unsigned b = bucket_of(txid);
+    for (int i = buckets[b]; i >= 0; i = table[i].next) {
+        Prepared *p = &table[i];
+        if (p->ready && strcmp(p->txid, txid) == 0 && p->account_id == account_id) {
+            unlink_entry(b, i);
+            return i;
+        }
+    }
+    return -1;
+}
+
+int twophase_prepare(const char *txid, int is_debit, int account_id, int counterparty, double amount) {
+    pthread_once(&table_once, init_table);
+    if (!txid[0] || !get_account(account_id) || amount <= 0) return 0;
+
+    pthread_mutex_lock(&table_lock);
+    unsigned b = bucket_of(txid);
+    for (int i = buckets[b]; i >= 0; i = table[i].next) {
+        if (strcmp(table[i].txid, txid) == 0) {
+            pthread_mutex_unlock(&table_lock);
+            return -1;
+        }
+    }
+    if (free_head < 0) {
+        pthread_mutex_unlock(&table_lock);
+        logger_error("[2PC] Prepared table full, refusing %s", txid);
+        return -1;
+    }
+
+    // Reserve the entry, then debit without the lock
+    int index = free_head;
+    Prepared *p = &table[index];
+    free_head = p->next;
+    strncpy(p->txid, txid, REQUEST_ID_MAX);
+    p->txid[REQUEST_ID_MAX] = '\0';
+    p->is_debit = (int8_t)is_debit;
+    p->ready = 0;
+    p->account_id = account_id;
+    p->counterparty = counterparty;
+    p->amount = amount;
+    p->next = buckets[b];
+    buckets[b] = index;
+    pthread_mutex_unlock(&table_lock);
+
+    int debited = !is_debit || transfer_debit(account_id, counterparty, amount) > 0;
+
+    // Publish the entry, or give it back if the debit was refused
+    pthread_mutex_lock(&table_lock);
+    if (debited) {
+        p->ready = 1;
+    } else {
+        unlink_entry(b, index);
+    }
+    pthread_mutex_unlock(&table_lock);
+    return debited;
+}
+
+// Run the decision for txid; commit applies a prepared credit, abort
+// refunds a prepared debit
+static int decide(const char *txid, int account_id, int commit) {
+    pthread_once(&table_once, init_table);
+
+    pthread_mutex_lock(&table_lock);
+    int index = take(txid, account_id);
+    if (index < 0) {
+        pthread_mutex_unlock(&table_lock);
+        return -1;
+    }
+    Prepared p = table[index];
+    pthread_mutex_unlock(&table_lock);
+
+    if (p.is_debit != commit) {
+        transfer_credit(p.account_id, p.counterparty, p.amount);
+    }
+    logger_debug("[2PC] %s %s: %s %.2f on account %d", commit ? "Committed" : "Aborted",
+                 p.txid, p.is_debit ? "debit" : "credit", p.amount, p.account_id);
+    return 1;
+}
+
+int twophase_commit(const char *txid, int account_id) {
+    return decide(txid, account_id, 1);
+}
+
+int twophase_abort(const char *txid, int account_id) {
+    return decide(txid, account_id, 0);
+}
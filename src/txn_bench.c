@@ -0,0 +1,178 @@
+// txn_bench.c - Pessimistic vs optimistic transfer benchmark
+// ============================================================================
+// Runs transfer() in-process (no sockets, no simulated delay) from several
+// threads and compares the two concurrency-control modes under a uniform
+// account distribution and a skewed Zipfian one, where a few hot accounts
+// take most of the traffic.
+// ============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "../include/bank.h"
+
+#define DEFAULT_THREADS    4
+#define DEFAULT_ACCOUNTS   1000
+#define DEFAULT_OPS        200000   // Transfers per thread
+#define DEFAULT_ZIPF_S     1.1
+#define INITIAL_BALANCE    1000000.0
+
+static int num_threads = DEFAULT_THREADS;
+static int num_accounts = DEFAULT_ACCOUNTS;
+static int ops_per_thread = DEFAULT_OPS;
+static double zipf_s = DEFAULT_ZIPF_S;
+
+// Cumulative distribution for Zipfian account selection (NULL = uniform)
+static double *zipf_cdf = NULL;
+
+typedef struct {
+    uint64_t rng_state;
+    int succeeded;
+} BenchArgs;
+
+static inline uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static double get_time_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void build_zipf_cdf(void) {
+    zipf_cdf = malloc(sizeof(double) * num_accounts);
+    double sum = 0.0;
+    for (int i = 0; i < num_accounts; i++) {
+        sum += 1.0 / pow(i + 1, zipf_s);
+        zipf_cdf[i] = sum;
+    }
+    for (int i = 0; i < num_accounts; i++) {
+        zipf_cdf[i] /= sum;
+    }
+}
+
+static int pick_account(uint64_t *rng) {
+    if (!zipf_cdf) {
+        return (int)(next_random(rng) % (uint64_t)num_accounts);
+    }
+
+    // Binary search for the first rank whose CDF covers u
+    double u = (next_random(rng) >> 11) * (1.0 / 9007199254740992.0);
+    int lo = 0, hi = num_accounts - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (zipf_cdf[mid] < u) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static void *bench_thread(void *arg) {
+    BenchArgs *args = (BenchArgs *)arg;
+
+    for (int i = 0; i < ops_per_thread; i++) {
+        int from = pick_account(&args->rng_state);
+        int to = pick_account(&args->rng_state);
+        if (from == to) to = (to + 1) % num_accounts;
+
+        if (transfer(from, to, 1.0) > 0) args->succeeded++;
+    }
+
+    return NULL;
+}
+
+static void run_case(const char *workload, TransferMode mode) {
+    bank_set_transfer_mode(mode);
+
+    uint64_t commits0, retries0, fallbacks0;
+    bank_get_occ_stats(&commits0, &retries0, &fallbacks0);
+
+    pthread_t *threads = calloc(num_threads, sizeof(pthread_t));
+    BenchArgs *args = calloc(num_threads, sizeof(BenchArgs));
+
+    double start = get_time_sec();
+    for (int i = 0; i < num_threads; i++) {
+        args[i].rng_state = 0x9E3779B97F4A7C15ULL * (uint64_t)(i + 1) | 1;
+        pthread_create(&threads[i], NULL, bench_thread, &args[i]);
+    }
+    int succeeded = 0;
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+        succeeded += args[i].succeeded;
+    }
+    double elapsed = get_time_sec() - start;
+
+    uint64_t commits, retries, fallbacks;
+    bank_get_occ_stats(&commits, &retries, &fallbacks);
+
+    double total = (double)num_threads * ops_per_thread;
+    printf("  %-8s %-12s %12.0f ops/sec  %6.1f ns/op  retries=%-8llu fallbacks=%llu\n",
+           workload, mode == TRANSFER_OPTIMISTIC ? "optimistic" : "pessimistic",
+           total / elapsed, elapsed * 1e9 / total * num_threads,
+           (unsigned long long)(retries - retries0),
+           (unsigned long long)(fallbacks - fallbacks0));
+
+    if (succeeded != (int)total) {
+        printf("  (warning: %d transfers failed)\n", (int)total - succeeded);
+    }
+
+    free(threads);
+    free(args);
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            num_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            num_accounts = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            ops_per_thread = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            zipf_s = atof(argv[++i]);
+        } else {
+            printf("Usage: %s [-t threads] [-a accounts] [-n transfers per thread] [-s zipf exponent]\n", argv[0]);
+            return strcmp(argv[i], "-h") == 0 ? 0 : 1;
+        }
+    }
+
+    if (num_threads <= 0 || ops_per_thread <= 0 || num_accounts < 2 || num_accounts > MAX_ACCOUNTS) {
+        fprintf(stderr, "Need threads > 0, transfers > 0 and 2..%d accounts\n", MAX_ACCOUNTS);
+        return 1;
+    }
+
+    init_bank();
+    for (int i = 0; i < num_accounts; i++) {
+        int id = create_account();
+        deposit(id, INITIAL_BALANCE);
+    }
+
+    printf("============================================================\n");
+    printf("  TRANSFER BENCHMARK: %d threads, %d accounts, %d transfers/thread\n",
+           num_threads, num_accounts, ops_per_thread);
+    printf("  (ns/op is per-thread latency; Zipf exponent %.2f)\n", zipf_s);
+    printf("============================================================\n");
+
+    run_case("uniform", TRANSFER_PESSIMISTIC);
+    run_case("uniform", TRANSFER_OPTIMISTIC);
+
+    build_zipf_cdf();
+    run_case("zipfian", TRANSFER_PESSIMISTIC);
+    run_case("zipfian", TRANSFER_OPTIMISTIC);
+
+    printf("============================================================\n");
+
+    free(zipf_cdf);
+    return 0;
+}